@@ -0,0 +1,300 @@
+/* createfs.c - build a file system image for the kernel out of a host directory
+ * vim:ts=4 noexpandtab
+ *
+ * Usage: createfs -i <dir> -o <image> [-n <inodes>] [-e <blocks>]
+ *
+ * The image is the boot block, the inodes and then the data blocks, see student-distrib/filesys.h.
+ * The root directory lives in the boot block. Every subdirectory gets an inode whose data blocks
+ * hold its dentries, starting with "." and "..", so nested directories of any size can be shipped.
+ * Inode 0 is never given to a file, a directory entry pointing at it names the root.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* layout of the image, must match student-distrib/filesys.h */
+#define BLOCK_SIZE 4096
+#define DIR_ENTRY_SIZE 64
+#define MAX_FILE_NUM 63                             // dentries the boot block has room for
+#define MAX_FILE_NAME 32
+#define MAX_FILE_BLOCK_NUM ((BLOCK_SIZE - 4) / 4)   // data block indices an inode has room for
+#define MAX_DATA_BLOCK_NUM 1024                     // the whole image has to fit in the 4 MB kernel page
+#define RTC_FILE_TYPE 0
+#define DIR_FILE_TYPE 1
+#define REGULAR_FILE_TYPE 2
+#define ROOT_DIR_INODE 0
+
+#define DEFAULT_INODE_NUM 64
+#define DEFAULT_EXTRA_BLOCK_NUM 32                  // free data blocks left for files written at run time
+
+/* one file or directory found in the input */
+typedef struct node {
+    char name[MAX_FILE_NAME + 1];
+    uint32_t type;
+    uint32_t inode;
+    uint32_t length;            // bytes of a file, bytes of the dentries of a subdirectory
+    uint32_t first_block;       // data blocks of a node are given out in one contiguous run
+    char* path;                 // host path, NULL for the rtc
+    struct node* parent;
+    struct node** children;
+    uint32_t child_num;
+} node_t;
+
+static uint32_t inode_num = DEFAULT_INODE_NUM;
+static uint32_t inode_used = 1; // inode 0 is kept for the root
+static uint32_t block_used = 0;
+
+/* die - print an error and stop */
+static void die(const char* msg, const char* what){
+    fprintf(stderr, "createfs: %s%s%s\n", msg, what ? ": " : "", what ? what : "");
+    exit(1);
+}
+
+/* xmalloc - malloc that stops on failure */
+static void* xmalloc(size_t size){
+    void* p = malloc(size);
+    if(p == NULL) die("out of memory", NULL);
+    return p;
+}
+
+/* node_cmp - order the entries of a directory by name so the image does not depend on readdir */
+static int node_cmp(const void* a, const void* b){
+    return strcmp((*(node_t* const*)a)->name, (*(node_t* const*)b)->name);
+}
+
+/* node_new
+ *
+ * make a node for one entry of a directory
+ * Inputs: parent - the directory holding it, NULL for the root
+ *         name - the name on the host, cut to MAX_FILE_NAME bytes like the kernel compares them
+ *         type - the file type
+ *         path - the host path, NULL for the rtc
+ * Outputs: the node
+ * Side Effects: a name that has to be cut is reported
+ */
+static node_t* node_new(node_t* parent, const char* name, uint32_t type, char* path){
+    node_t* node = xmalloc(sizeof(node_t));
+    memset(node, 0, sizeof(node_t));
+    if(strlen(name) > MAX_FILE_NAME){
+        fprintf(stderr, "createfs: warning: %s cut to %d bytes\n", path, MAX_FILE_NAME);
+    }
+    strncpy(node->name, name, MAX_FILE_NAME);
+    node->type = type;
+    node->path = path;
+    node->parent = parent;
+    return node;
+}
+
+/* node_add - append a child to a directory */
+static void node_add(node_t* dir, node_t* child){
+    dir->children = realloc(dir->children, (dir->child_num + 1) * sizeof(node_t*));
+    if(dir->children == NULL) die("out of memory", NULL);
+    dir->children[dir->child_num++] = child;
+}
+
+/* scan_dir
+ *
+ * read a host directory and everything below it into the tree
+ * Inputs: dir - the node of the directory, its path is set
+ * Outputs: None
+ * Side Effects: stops on an unreadable directory, entries that are neither files nor directories are skipped
+ */
+static void scan_dir(node_t* dir){
+    DIR* host_dir;
+    struct dirent* ent;
+    struct stat st;
+    node_t* child;
+    char* path;
+    uint32_t i;
+
+    if(NULL == (host_dir = opendir(dir->path))) die(strerror(errno), dir->path);
+    while(NULL != (ent = readdir(host_dir))){
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        path = xmalloc(strlen(dir->path) + strlen(ent->d_name) + 2);
+        sprintf(path, "%s/%s", dir->path, ent->d_name);
+        if(stat(path, &st) == -1) die(strerror(errno), path);
+        if(S_ISDIR(st.st_mode)){
+            child = node_new(dir, ent->d_name, DIR_FILE_TYPE, path);
+            scan_dir(child);
+        } else if(S_ISREG(st.st_mode)){
+            if((uint64_t)st.st_size > (uint64_t)MAX_FILE_BLOCK_NUM * BLOCK_SIZE) die("file too large", path);
+            child = node_new(dir, ent->d_name, REGULAR_FILE_TYPE, path);
+            child->length = st.st_size;
+        } else {
+            fprintf(stderr, "createfs: warning: %s skipped, not a file or a directory\n", path);
+            free(path);
+            continue;
+        }
+        node_add(dir, child);
+    }
+    closedir(host_dir);
+
+    qsort(dir->children, dir->child_num, sizeof(node_t*), node_cmp);
+    for(i = 0; i + 1 < dir->child_num; i++){
+        if(strcmp(dir->children[i]->name, dir->children[i + 1]->name) == 0) die("two names are the same once cut", dir->children[i + 1]->path);
+    }
+}
+
+/* assign
+ *
+ * give every node below a directory its inode and its data blocks, the inodes are numbered
+ * depth first so the files of a directory sit next to each other in the image
+ * Inputs: dir - the directory
+ * Outputs: None
+ * Side Effects: stops if the inodes run out
+ */
+static void assign(node_t* dir){
+    uint32_t i, num;
+    node_t* child;
+    for(i = 0; i < dir->child_num; i++){
+        child = dir->children[i];
+        if(child->type == RTC_FILE_TYPE) continue;
+        if(inode_used >= inode_num) die("not enough inodes, use -n", child->path);
+        child->inode = inode_used++;
+        if(child->type == DIR_FILE_TYPE){
+            child->length = (2 + child->child_num) * DIR_ENTRY_SIZE;     // "." and ".." first
+            if(child->length > MAX_FILE_BLOCK_NUM * BLOCK_SIZE) die("directory too large", child->path);
+        }
+        num = (child->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        child->first_block = block_used;
+        block_used += num;
+        if(child->type == DIR_FILE_TYPE) assign(child);
+    }
+}
+
+/* put32 - store a 32-bit value little endian, the byte order of the kernel */
+static void put32(uint8_t* p, uint32_t value){
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* put_dentry - store one dentry in the zeroed image, the name is not '\0' terminated if it takes all 32 bytes */
+static void put_dentry(uint8_t* p, const char* name, uint32_t type, uint32_t inode){
+    memcpy(p, name, strnlen(name, MAX_FILE_NAME));
+    put32(p + MAX_FILE_NAME, type);
+    put32(p + MAX_FILE_NAME + 4, inode);
+}
+
+/* inode_of - inode a dentry points at, the root and the rtc have none */
+static uint32_t inode_of(const node_t* node){
+    return (node->parent == NULL || node->type == RTC_FILE_TYPE) ? ROOT_DIR_INODE : node->inode;
+}
+
+/* fill
+ *
+ * store the inode and the content of every node below a directory
+ * Inputs: dir - the directory
+ *         image - the whole image
+ *         data - the first data block in the image
+ * Outputs: None
+ * Side Effects: stops if a file cannot be read
+ */
+static void fill(node_t* dir, uint8_t* image, uint8_t* data){
+    uint32_t i, j, num;
+    node_t* child;
+    uint8_t* content;
+    FILE* file;
+    for(i = 0; i < dir->child_num; i++){
+        child = dir->children[i];
+        if(child->type == RTC_FILE_TYPE) continue;
+
+        num = (child->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        put32(image + (1 + child->inode) * BLOCK_SIZE, child->length);
+        for(j = 0; j < num; j++){
+            put32(image + (1 + child->inode) * BLOCK_SIZE + 4 * (1 + j), child->first_block + j);
+        }
+
+        content = data + child->first_block * BLOCK_SIZE;
+        if(child->type == DIR_FILE_TYPE){
+            put_dentry(content, ".", DIR_FILE_TYPE, child->inode);
+            put_dentry(content + DIR_ENTRY_SIZE, "..", DIR_FILE_TYPE, inode_of(dir));
+            for(j = 0; j < child->child_num; j++){
+                put_dentry(content + (2 + j) * DIR_ENTRY_SIZE, child->children[j]->name,
+                           child->children[j]->type, inode_of(child->children[j]));
+            }
+            fill(child, image, data);
+        } else {
+            if(NULL == (file = fopen(child->path, "rb"))) die(strerror(errno), child->path);
+            if(fread(content, 1, child->length, file) != child->length) die("short read", child->path);
+            fclose(file);
+        }
+    }
+}
+
+static void usage(const char* prog){
+    fprintf(stderr,
+            "Usage: %s -i <dir> -o <image> [-n <inodes>] [-e <blocks>]\n"
+            "  -i, --input <path>         Path to input directory.\n"
+            "  -o, --output <path>        Path to output file.\n"
+            "  -n, --inodes <num>         Number of inodes, default %d.\n"
+            "  -e, --extra <num>          Free data blocks left for new data, default %d.\n",
+            prog, DEFAULT_INODE_NUM, DEFAULT_EXTRA_BLOCK_NUM);
+    exit(64);   // EX_USAGE
+}
+
+int main(int argc, char** argv){
+    static const struct option options[] = {
+        {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"inodes", required_argument, NULL, 'n'},
+        {"extra", required_argument, NULL, 'e'},
+        {NULL, 0, NULL, 0}
+    };
+    char* input = NULL;
+    char* output = NULL;
+    uint32_t extra = DEFAULT_EXTRA_BLOCK_NUM;
+    uint32_t i, data_blocks_num, block_num;
+    node_t* root;
+    uint8_t* image;
+    FILE* file;
+    int opt;
+
+    while(-1 != (opt = getopt_long(argc, argv, "i:o:n:e:", options, NULL))){
+        switch(opt){
+            case 'i': input = optarg; break;
+            case 'o': output = optarg; break;
+            case 'n': inode_num = strtoul(optarg, NULL, 0); break;
+            case 'e': extra = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(input == NULL || output == NULL || optind != argc || inode_num == 0) usage(argv[0]);
+
+    /* the root holds ".", the rtc and the input */
+    root = node_new(NULL, ".", DIR_FILE_TYPE, input);
+    scan_dir(root);
+    for(i = 0; i < root->child_num; i++){
+        if(strcmp(root->children[i]->name, "rtc") == 0) die("the root cannot have a file named rtc", root->children[i]->path);
+    }
+    node_add(root, node_new(root, "rtc", RTC_FILE_TYPE, NULL));
+    if(root->child_num + 1 > MAX_FILE_NUM) die("too many entries in the root directory, move some into a subdirectory", input);
+
+    assign(root);
+    data_blocks_num = block_used + extra;
+    block_num = 1 + inode_num + data_blocks_num;
+    if(data_blocks_num > MAX_DATA_BLOCK_NUM || block_num > MAX_DATA_BLOCK_NUM) die("image larger than 4 MB", NULL);
+
+    image = xmalloc(block_num * BLOCK_SIZE);
+    memset(image, 0, block_num * BLOCK_SIZE);
+    put32(image, root->child_num + 1);
+    put32(image + 4, inode_num);
+    put32(image + 8, data_blocks_num);
+    put_dentry(image + DIR_ENTRY_SIZE, ".", DIR_FILE_TYPE, ROOT_DIR_INODE);
+    for(i = 0; i < root->child_num; i++){
+        put_dentry(image + (2 + i) * DIR_ENTRY_SIZE, root->children[i]->name, root->children[i]->type, inode_of(root->children[i]));
+    }
+    fill(root, image, image + (1 + inode_num) * BLOCK_SIZE);
+
+    if(NULL == (file = fopen(output, "wb"))) die(strerror(errno), output);
+    if(fwrite(image, BLOCK_SIZE, block_num, file) != block_num || fclose(file) != 0) die("write failed", output);
+    printf("%s: %u inodes used of %u, %u data blocks used of %u\n", output, inode_used, inode_num, block_used, data_blocks_num);
+    return 0;
+}
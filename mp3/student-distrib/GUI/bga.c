@@ -15,6 +15,22 @@ void program_bga(uint16_t xres, uint16_t yres, uint16_t bpp) {
     bga_write_reg(VBE_DISPI_INDEX_BPP, bpp);
     bga_write_reg(VBE_DISPI_INDEX_FB_BASE_HI, QEMU_BASE_ADDR >> 16);
     bga_write_reg(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED);
+    /* the virtual size is reset by the mode change, make room for the pages behind the visible one */
+    bga_write_reg(VBE_DISPI_INDEX_VIRT_WIDTH, xres);
+    bga_write_reg(VBE_DISPI_INDEX_VIRT_HEIGHT, yres * BGA_PAGE_NUM);
+    bga_write_reg(VBE_DISPI_INDEX_Y_OFFSET, 0);
+}
+
+/* bga_set_page - show one page of the virtual screen
+ * Inputs: page - the page, 0 to BGA_PAGE_NUM - 1
+ * Outputs: None
+ * Side Effects: the display switches to the page on its next refresh
+ */
+void bga_set_page(uint32_t page) {
+    uint32_t flags;
+    cli_and_save(flags);
+    bga_write_reg(VBE_DISPI_INDEX_Y_OFFSET, page * Y_RESOLUTION);
+    restore_flags(flags);
 }
 
 
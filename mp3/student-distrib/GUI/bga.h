@@ -12,6 +12,10 @@
 #define VBE_DISPI_INDEX_YRES            0x2
 #define VBE_DISPI_INDEX_BPP             0x3
 #define VBE_DISPI_INDEX_ENABLE          0x4
+#define VBE_DISPI_INDEX_VIRT_WIDTH      0x6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT     0x7
+#define VBE_DISPI_INDEX_X_OFFSET        0x8
+#define VBE_DISPI_INDEX_Y_OFFSET        0x9
 
 #define VBE_DISPI_DISABLED              0x00
 #define VBE_DISPI_ENABLED               0x01
@@ -23,8 +27,13 @@
 #define Y_RESOLUTION                    768
 #define BITS_PER_PIXEL                  32
 
+// the virtual screen is BGA_PAGE_NUM screens high, the Y offset picks the one shown
+#define BGA_PAGE_NUM                    2
+#define BGA_PAGE_SIZE                   (X_RESOLUTION * Y_RESOLUTION)   // pixels in one page
+
 
 extern void program_bga(uint16_t xres, uint16_t yres, uint16_t bpp);
+extern void bga_set_page(uint32_t page);
 
 #endif
 
@@ -5,41 +5,88 @@
 #include "../lib.h"
 #include "text.h"
 #include "../date.h"
+#include "../dynamic_alloc.h"
+#include "../devices/vt.h"
 
 int32_t last_x = 0, last_y = 0;
 uint32_t mouse_initial = 0;
 uint32_t mouse_buffer[22][34];
 
-uint32_t* qemu_memory = (uint32_t *) QEMU_BASE_ADDR;
+uint32_t* qemu_memory = (uint32_t *) QEMU_BASE_ADDR;     // the page being drawn
 int box = 1;
 int back = 0;
 int col = 0x8B00FF;
 
+/* 32-bpp copies of the images drawn more than once, built by gui_init so redrawing them is a block copy */
+static uint32_t* gui_skin = NULL;                   // the terminal skin, VT_HEIGHT rows of VT_WIDTH pixels
+static uint32_t gui_clock_patch[SEC_HEIGHT][SEC_WIDTH]; // the background behind the clock
+/* an RGB565 pixel widens to gui_rgb565_lo[low byte] | gui_rgb565_hi[high byte] */
+static uint32_t gui_rgb565_lo[256];
+static uint32_t gui_rgb565_hi[256];
+
+/* rgb565_to_rgb888 - widen a pixel of the RGB565 images to the 32-bpp framebuffer format */
+static inline uint32_t rgb565_to_rgb888(uint16_t pixel) {
+    return (((((pixel & RED_MASK) >> RED_OFF) << 3) & LOW_8_BITS) << 16)
+          |(((((pixel & GRE_MASK) >> GRE_OFF) << 2) & LOW_8_BITS) << 8)
+          |((((  pixel & BLU_MASK) << BLU_OFF) & LOW_8_BITS));
+}
+
+/* rgb565_convert - widen a run of RGB565 pixels with the byte tables
+ * Inputs: dst - where the 32-bpp pixels go
+ *         src - the RGB565 pixels
+ *         n - number of pixels
+ * Outputs: None
+ * Side Effects: None
+ */
+static void rgb565_convert(uint32_t* dst, const uint16_t* src, uint32_t n) {
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        dst[i] = gui_rgb565_lo[src[i] & LOW_8_BITS] | gui_rgb565_hi[src[i] >> 8];
+    }
+}
+
 void draw_background() {
     int i;
-    int j;
     for (i = 0; i < Y_RESOLUTION; i++) {
-        for (j = 0; j < X_RESOLUTION; j++) {
-            uint32_t pixel_color = 
-             (((((bg[j + i * X_RESOLUTION] & RED_MASK) >> RED_OFF) << 3) & LOW_8_BITS) << 16)
-            |(((((bg[j + i * X_RESOLUTION] & GRE_MASK) >> GRE_OFF) << 2) & LOW_8_BITS) << 8)
-            |(((( bg[j + i * X_RESOLUTION] & BLU_MASK) << BLU_OFF) & LOW_8_BITS));
-            *(uint32_t *)(qemu_memory + i * X_RESOLUTION + j) = pixel_color;
+        rgb565_convert(qemu_memory + i * X_RESOLUTION, (const uint16_t*)bg + i * X_RESOLUTION, X_RESOLUTION);
+    }
+}
+
+/* glyph atlas, every pixel of a glyph expanded to an all ones (ink) or all zeros (background) mask,
+   a glyph is expanded the first time it is drawn */
+static uint32_t gui_glyph_atlas[GUI_GLYPH_NUM][FONT_HEIGHT][FONT_WIDTH];
+static uint8_t gui_glyph_ready[GUI_GLYPH_NUM];
+
+/* gui_glyph - get the expanded masks of a character
+ * Inputs: c - the character
+ * Outputs: FONT_HEIGHT rows of FONT_WIDTH masks
+ * Side Effects: expands the glyph from font_data on first use
+ */
+static uint32_t (*gui_glyph(uint8_t c))[FONT_WIDTH] {
+    int j, k;
+    char* font_row;
+    if (!gui_glyph_ready[c]) {
+        font_row = (char*)font_data[c];
+        for (j = 0; j < FONT_HEIGHT; ++j) {
+            for (k = 0; k < FONT_WIDTH; ++k) {
+                gui_glyph_atlas[c][j][k] = (font_row[j] & 1 << (FONT_WIDTH - k)) ? 0xFFFFFFFF : 0;
+            }
         }
+        gui_glyph_ready[c] = 1;
     }
+    return gui_glyph_atlas[c];
 }
 
 void draw_string(int x, int y, int8_t* str, uint32_t color) {
     int i, j ,k;
     int cur_x, cur_y;
-    for (i = 0; i < strlen(str); ++i) {
+    uint32_t (*glyph)[FONT_WIDTH];
+    for (i = 0; str[i] != '\0'; ++i) {
         cur_x = x + 18 * i, cur_y = y;
-        char* print_char = (char*)font_data[(uint8_t)(str[i])];
+        glyph = gui_glyph((uint8_t)(str[i]));
         for (j = 0; j < FONT_HEIGHT; ++j) {
             for (k = 0; k < FONT_WIDTH; ++k) {
-                if (print_char[j] & 1 << (FONT_WIDTH - k)) {
-                    uint32_t rgb = 0;
-                    rgb |= color;
+                if (glyph[j][k]) {
                     uint32_t* pixel = (uint32_t *)(qemu_memory + (cur_x + 2 * k) + (cur_y + 2 * j) * X_RESOLUTION);
                     pixel[0] = color;
                     pixel[1] = color;
@@ -63,15 +110,9 @@ void draw_time() {
     time_str[6] = '0' + sec / 10;
     time_str[7] = '0' + sec % 10;
     time_str[8] = '\0';
-    int i, j;
-    for (i = 130; i < 162; ++i) {
-        for (j = 434; j < 590; ++j) {
-            uint32_t pixel_color = 
-             (((((bg[j + i * X_RESOLUTION] & RED_MASK) >> RED_OFF) << 3) & LOW_8_BITS) << 16)
-            |(((((bg[j + i * X_RESOLUTION] & GRE_MASK) >> GRE_OFF) << 2) & LOW_8_BITS) << 8)
-            |(((( bg[j + i * X_RESOLUTION] & BLU_MASK) << BLU_OFF) & LOW_8_BITS));
-            *(uint32_t *)(qemu_memory + i * X_RESOLUTION + j) = pixel_color;
-        }
+    int i;
+    for (i = 0; i < SEC_HEIGHT; ++i) {
+        memcpy(qemu_memory + (SEC_START_Y + i) * X_RESOLUTION + SEC_START_X, gui_clock_patch[i], SEC_WIDTH * sizeof(uint32_t));
     }
     draw_string(SEC_START_X, SEC_START_Y , time_str, 0xFFFFFFFF);
     /* show date */
@@ -90,105 +131,186 @@ void draw_time() {
     draw_string(DAY_START_X, DAY_START_Y , time_str1, 0xFFFFFFFF);
 }
 
+/* vt_draw_string - draw text on the terminal skin, the skin shows through around the glyphs
+ * Inputs: x, y - top left pixel of the first character, inside the terminal area
+ *         str - the text
+ *         color - 32-bpp color of the glyphs
+ * Outputs: None
+ * Side Effects: every pixel of a cell is written once, ink and skin are picked with the glyph masks,
+ *               nothing is drawn before gui_init has built the skin
+ */
 void vt_draw_string(int x, int y, int8_t* str, uint32_t color) {
-    int i, j ,k, index;
-    int cur_x, cur_y;
-    char* cur_char;
-    uint32_t pixel_color;
-    for (i = 0; i < strlen(str); ++i) {
-        cur_char = (char*)font_data[(uint8_t)(str[i])];
+    int i, j, k;
+    uint32_t (*glyph)[FONT_WIDTH];
+    uint32_t* dst;
+    const uint32_t* skin;
+    uint32_t mask;
+    if (gui_skin == NULL) return;
+    for (i = 0; str[i] != '\0'; ++i) {
+        glyph = gui_glyph((uint8_t)(str[i]));
+        dst = qemu_memory + y * X_RESOLUTION + x + FONT_WIDTH * i;
+        skin = gui_skin + (y - VT_START_Y) * VT_WIDTH + (x + FONT_WIDTH * i - VT_START_X);
         for (j = 0; j < FONT_HEIGHT; ++j) {
             for (k = 0; k < FONT_WIDTH; ++k) {
-                cur_x = x + 8 * i + k, cur_y = y + j;
-                if (cur_char[j] & 1 << (FONT_WIDTH - k)) {
-                    pixel_color = 0;
-                    pixel_color |= color;
-                }
-                else {
-                    index = (cur_x - VT_START_X) + (cur_y - VT_START_Y) * VT_WIDTH;
-                    pixel_color = 
-                     (((((vt_image[index] & RED_MASK) >> RED_OFF) << 3) & LOW_8_BITS) << 16)
-                    |(((((vt_image[index] & GRE_MASK) >> GRE_OFF) << 2) & LOW_8_BITS) << 8)
-                    |(((( vt_image[index] & BLU_MASK) << BLU_OFF) & LOW_8_BITS));
-                }
-                *(uint32_t *)(qemu_memory + cur_y * X_RESOLUTION + cur_x) = pixel_color;
+                mask = glyph[j][k];
+                dst[k] = (color & mask) | (skin[k] & ~mask);
             }
+            dst += X_RESOLUTION;
+            skin += VT_WIDTH;
         }
     }
 }
-static char buffer_str[25][81];
 
-int my_strcmp(const char *str1, const char *str2) {
-    while (*str1 && (*str1 == *str2)) {
-        str1++;
-        str2++;
+/* the screen is double buffered, the compositor draws into the back page and flips it to the front,
+   each page keeps the text it shows and its own dirty bits so it can catch up when it becomes the back page */
+static uint32_t gui_back_page = 1;
+static char gui_shadow[BGA_PAGE_NUM][VT_ROW][VT_COL];  // a NUL cell of the text buffer is kept as a space
+static volatile uint32_t gui_enabled = 0;                   // set once the BGA screen has been drawn
+static volatile uint32_t gui_dirty_rows[BGA_PAGE_NUM];      // bit i set iff row i may differ from the page
+static volatile uint32_t gui_clock_dirty[BGA_PAGE_NUM];     // set when the clock of the page is out of date
+static volatile uint32_t gui_date_stale = 0;                // set when the date has to be read again
+
+/* gui_mark_row_dirty - note that a row of the foreground text buffer changed
+ * Inputs: row - the row of the text buffer
+ * Outputs: None
+ * Side Effects: the row is compared and redrawn on each page
+ */
+void gui_mark_row_dirty(uint32_t row) {
+    uint32_t flags, page;
+    if (row >= VT_ROW) return;
+    cli_and_save(flags);
+    for (page = 0; page < BGA_PAGE_NUM; page++) {
+        gui_dirty_rows[page] |= 1 << row;
     }
-    return *(const unsigned char*)str1 - *(const unsigned char*)str2;
+    restore_flags(flags);
 }
 
-char* my_strcpy(char *dest, const char *src) {
-    char *saved = dest;
-    while (*src) {
-        *dest = *src;
-        dest++;
-        src++;
+/* gui_mark_all_dirty - note that the whole foreground text buffer changed
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: every row is compared and redrawn on each page
+ */
+void gui_mark_all_dirty(void) {
+    uint32_t flags, page;
+    cli_and_save(flags);
+    for (page = 0; page < BGA_PAGE_NUM; page++) {
+        gui_dirty_rows[page] = (1 << VT_ROW) - 1;
     }
-    *dest = 0;
-    return saved;
+    restore_flags(flags);
 }
 
-
-void draw_terminal_line(int row) {
-    int j, index;
-    for (j = VT_START_X; j < VT_WIDTH + VT_START_X; ++j) {
-            index = (j - VT_START_X) + (row - VT_START_Y) * VT_WIDTH;
-            uint32_t pixel_color = 
-             (((((vt_image[index] & RED_MASK) >> RED_OFF) << 3) & LOW_8_BITS) << 16)
-            |(((((vt_image[index] & GRE_MASK) >> GRE_OFF) << 2) & LOW_8_BITS) << 8)
-            |(((( vt_image[index] & BLU_MASK) << BLU_OFF) & LOW_8_BITS));
-            *(uint32_t *)(qemu_memory + row * X_RESOLUTION + j) = pixel_color;
-        }
+/* gui_clock_tick - note that a second has passed
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: the clock is read at the next gui_compose and redrawn on each page
+ */
+void gui_clock_tick(void) {
+    uint32_t page;
+    gui_date_stale = 1;
+    for (page = 0; page < BGA_PAGE_NUM; page++) {
+        gui_clock_dirty[page] = 1;
+    }
 }
 
-void fill_terminal(void) {
-    int i, j;
-    char* vidmem;
-    vidmem = (char*)GUI_VID_MEM_ADDR;
-    for (i = 0; i < VT_ROW; ++i) {
-        char cur_str[VT_COL + 1] = {0};
-        for (j = 0; j < VT_COL; ++j) {
-            if (*(vidmem + (j + i * VT_COL) * 2) != '\0') {
-                cur_str[j] = *(vidmem + (j + i * VT_COL) * 2);
+/* gui_compose - bring the back page up to date and flip it to the front, run as the GUI softirq
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: only the cells that differ from the shadow of the back page are drawn,
+ *               runs with interrupts enabled, a row written meanwhile is marked dirty again
+ */
+void gui_compose(void) {
+    uint32_t flags, dirty, row, col, first, last, drawn = 0;
+    char* vidmem = vt_get_screen();
+    char (*shadow)[VT_COL] = gui_shadow[gui_back_page];
+    char cells[VT_COL + 1];
+    char c;
+
+    if (!gui_enabled) return;
+    if (gui_date_stale) {
+        gui_date_stale = 0;
+        get_date();
+    }
+    if (gui_clock_dirty[gui_back_page]) {
+        gui_clock_dirty[gui_back_page] = 0;
+        draw_time();
+        drawn = 1;
+    }
+
+    cli_and_save(flags);
+    dirty = gui_dirty_rows[gui_back_page];
+    gui_dirty_rows[gui_back_page] = 0;
+    restore_flags(flags);
+
+    for (row = 0; dirty != 0; row++, dirty >>= 1) {
+        if (!(dirty & 1)) continue;
+        /* find the span of cells that changed and only draw that */
+        first = VT_COL;
+        last = 0;
+        for (col = 0; col < VT_COL; col++) {
+            c = *(vidmem + (col + row * VT_COL) * 2);
+            if (c == '\0') c = ' ';
+            if (c != shadow[row][col]) {
+                shadow[row][col] = c;
+                if (first == VT_COL) first = col;
+                last = col;
             }
         }
-        if(my_strcmp(buffer_str[i], cur_str) == 0) {
-            continue;
-        }
-        else {
-            draw_terminal_line(VT_START_Y + 16 * i + 11);
-            vt_draw_string(VT_START_X + 15, VT_START_Y + 16 * i + 11, cur_str, 0XFFFFFFFF);
-            my_strcpy(buffer_str[i], cur_str);
-        }
+        if (first == VT_COL) continue;
+        memcpy(cells, &shadow[row][first], last - first + 1);
+        cells[last - first + 1] = '\0';
+        vt_draw_string(VT_START_X + 15 + FONT_WIDTH * first, VT_START_Y + 16 * row + 11, cells, 0XFFFFFFFF);
+        drawn = 1;
+    }
+
+    /* show the finished page in one register write, the old front page becomes the back page */
+    if (drawn) {
+        bga_set_page(gui_back_page);
+        gui_back_page = (gui_back_page + 1) % BGA_PAGE_NUM;
+        qemu_memory = (uint32_t*)QEMU_BASE_ADDR + gui_back_page * BGA_PAGE_SIZE;
     }
 }
 
 
 void draw_terminal() {
-    int i, j;
-    int index;
-    for (i = VT_START_Y; i < VT_HEIGHT + VT_START_Y; ++i) {
-        for (j = VT_START_X; j < VT_WIDTH + VT_START_X; ++j) {
-            index = (j - VT_START_X) + (i - VT_START_Y) * VT_WIDTH;
-            uint32_t pixel_color = 
-             (((((vt_image[index] & RED_MASK) >> RED_OFF) << 3) & LOW_8_BITS) << 16)
-            |(((((vt_image[index] & GRE_MASK) >> GRE_OFF) << 2) & LOW_8_BITS) << 8)
-            |(((( vt_image[index] & BLU_MASK) << BLU_OFF) & LOW_8_BITS));
-            *(uint32_t *)(qemu_memory + i * X_RESOLUTION + j) = pixel_color;
-        }
+    int i;
+    for (i = 0; i < VT_HEIGHT; ++i) {
+        memcpy(qemu_memory + (VT_START_Y + i) * X_RESOLUTION + VT_START_X, gui_skin + i * VT_WIDTH, VT_WIDTH * sizeof(uint32_t));
     }
 }
 
+/* gui_init - convert the images the GUI redraws into 32-bpp once
+ * Inputs: None
+ * Outputs: 0 on success, -1 if there is no memory for the terminal skin
+ * Side Effects: allocates the skin from the kernel heap the first time it is called
+ */
+int32_t gui_init(void) {
+    int i;
+    if (gui_skin != NULL) return 0;
+    for (i = 0; i < 256; i++) {
+        gui_rgb565_lo[i] = rgb565_to_rgb888(i);
+        gui_rgb565_hi[i] = rgb565_to_rgb888(i << 8);
+    }
+    if (NULL == (gui_skin = malloc(VT_WIDTH * VT_HEIGHT * sizeof(uint32_t)))) return -1;
+    rgb565_convert(gui_skin, (const uint16_t*)vt_image, VT_WIDTH * VT_HEIGHT);
+    for (i = 0; i < SEC_HEIGHT; ++i) {
+        rgb565_convert(gui_clock_patch[i], (const uint16_t*)bg + (SEC_START_Y + i) * X_RESOLUTION + SEC_START_X, SEC_WIDTH);
+    }
+    return 0;
+}
+
 void gui_set_up() {
-    draw_background();
-    draw_terminal();
+    uint32_t page;
+    /* every page starts with a blank terminal, let the compositor fill in the text and the clock */
+    for (page = 0; page < BGA_PAGE_NUM; page++) {
+        qemu_memory = (uint32_t*)QEMU_BASE_ADDR + page * BGA_PAGE_SIZE;
+        draw_background();
+        draw_terminal();
+        memset(gui_shadow[page], ' ', sizeof(gui_shadow[page]));
+    }
+    bga_set_page(0);
+    gui_back_page = 1;
+    qemu_memory = (uint32_t*)QEMU_BASE_ADDR + BGA_PAGE_SIZE;
+    gui_clock_tick();
+    gui_mark_all_dirty();
+    gui_enabled = 1;
 }
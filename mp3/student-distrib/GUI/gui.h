@@ -23,11 +23,18 @@
 #define DAY_START_Y 80
 #define SEC_START_X 434
 #define SEC_START_Y 130
+#define SEC_WIDTH   156
+#define SEC_HEIGHT  32
 
-#define GUI_VID_MEM_ADDR 0xE0000
+#define GUI_GLYPH_NUM    256
 
+extern int32_t gui_init(void);
 extern void gui_set_up();
 extern void draw_time();
-extern void fill_terminal(void);
+extern void vt_draw_string(int x, int y, int8_t* str, uint32_t color);
+extern void gui_mark_row_dirty(uint32_t row);
+extern void gui_mark_all_dirty(void);
+extern void gui_clock_tick(void);
+extern void gui_compose(void);
 
 #endif
@@ -0,0 +1,401 @@
+/* bcache.c - write-back cache of device blocks in front of the file system
+ * vim:ts=4 noexpandtab
+ */
+
+#include "bcache.h"
+#include "dynamic_alloc.h"
+#include "softirq.h"
+#include "scheduler.h"
+#include "lib.h"
+
+static bcache_buf_t bcache_bufs[BCACHE_NUM];
+static int32_t bcache_hash[BCACHE_HASH_SIZE];   // first buffer of each bucket, -1 if empty
+static int32_t bcache_buf_num = 0;              // buffers that got memory
+static int32_t lru_head = -1;                   // most recently used buffer
+static int32_t lru_tail = -1;                   // least recently used buffer, the next victim
+static uint32_t bcache_ticks = 0;               // PIT ticks since the last write back
+static uint32_t bcache_io_busy = 0;             // 1 while a block is on its way to or from a device, one at a time
+uint32_t bcache_hit_num = 0;
+uint32_t bcache_miss_num = 0;
+uint32_t bcache_writeback_num = 0;
+
+/* bcache_init
+ *
+ * give the buffers their memory, called once the kernel heap works
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: the cache holds fewer blocks if the heap runs out
+ */
+void bcache_init(void){
+    int32_t i;
+    memset(bcache_hash, 0xFF, sizeof(bcache_hash));
+    for(i = 0; i < BCACHE_NUM; i++){
+        if(NULL == (bcache_bufs[i].data = malloc(BLOCKDEV_BLOCK_SIZE))) break;
+        bcache_bufs[i].dev = NULL;
+        bcache_bufs[i].dirty = 0;
+        bcache_bufs[i].busy = 0;
+        bcache_bufs[i].hash_next = -1;
+        bcache_bufs[i].lru_prev = i - 1;
+        bcache_bufs[i].lru_next = -1;
+        if(i > 0) bcache_bufs[i - 1].lru_next = i;
+    }
+    bcache_buf_num = i;
+    lru_head = (i > 0) ? 0 : -1;
+    lru_tail = i - 1;
+}
+
+/* bcache_touch (PRIVATE)
+ *
+ * move a buffer to the most recently used end of the list
+ * Inputs: i - the buffer
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled
+ */
+static void bcache_touch(int32_t i){
+    bcache_buf_t* buf = &bcache_bufs[i];
+    if(lru_head == i) return;
+    /* unlink, the buffer is not the head so it has a previous one */
+    bcache_bufs[buf->lru_prev].lru_next = buf->lru_next;
+    if(buf->lru_next != -1) bcache_bufs[buf->lru_next].lru_prev = buf->lru_prev;
+    else lru_tail = buf->lru_prev;
+    /* put it in front */
+    buf->lru_prev = -1;
+    buf->lru_next = lru_head;
+    bcache_bufs[lru_head].lru_prev = i;
+    lru_head = i;
+}
+
+/* bcache_lookup (PRIVATE)
+ *
+ * find the buffer holding a block
+ * Inputs: dev - the device
+ *         block - the block index
+ * Outputs: the buffer, -1 if the block is not cached
+ * Side Effects: must be called with interrupts disabled
+ */
+static int32_t bcache_lookup(block_dev_t* dev, uint32_t block){
+    int32_t i;
+    for(i = bcache_hash[block & BCACHE_HASH_MASK]; i != -1; i = bcache_bufs[i].hash_next){
+        if(bcache_bufs[i].dev == dev && bcache_bufs[i].block == block) return i;
+    }
+    return -1;
+}
+
+/* bcache_unhash (PRIVATE)
+ *
+ * take a buffer out of its bucket
+ * Inputs: i - the buffer, must hold a block
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled
+ */
+static void bcache_unhash(int32_t i){
+    int32_t* link = &bcache_hash[bcache_bufs[i].block & BCACHE_HASH_MASK];
+    while(*link != i) link = &bcache_bufs[*link].hash_next;
+    *link = bcache_bufs[i].hash_next;
+    bcache_bufs[i].dev = NULL;
+}
+
+/* bcache_release (PRIVATE)
+ *
+ * give back a buffer returned by bcache_get
+ * Inputs: i - the buffer
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled, wakes the processes waiting for a buffer
+ */
+static void bcache_release(int32_t i){
+    if(--bcache_bufs[i].busy == 0) sched_wake(bcache_bufs);
+}
+
+/* bcache_transfer (PRIVATE)
+ *
+ * read a buffer in from its device or write it back, the device takes one transfer at a time
+ * Inputs: i - the buffer, busy for the caller
+ *         write - 1 to write the buffer back, 0 to read it in
+ *         flags - the interrupt flags of the bcache caller, the transfer runs with them
+ * Outputs: 0 if successful, -1 on an I/O error
+ * Side Effects: must be called with interrupts disabled and returns with them disabled,
+ *               sleeps while another transfer is going on
+ */
+static int32_t bcache_transfer(int32_t i, int32_t write, unsigned long flags){
+    bcache_buf_t* buf = &bcache_bufs[i];
+    int32_t result;
+
+    while(bcache_io_busy && sched_running != -1) sched_sleep(&bcache_io_busy);
+    bcache_io_busy = 1;
+    restore_flags(flags);
+    if(write) result = buf->dev->write_block(buf->dev, buf->block, buf->data);
+    else result = buf->dev->read_block(buf->dev, buf->block, buf->data);
+    cli();
+    bcache_io_busy = 0;
+    sched_wake(&bcache_io_busy);
+    return result;
+}
+
+/* bcache_get (PRIVATE)
+ *
+ * find the buffer of a block and make it busy, on a miss the least recently used free buffer
+ * is written back if dirty and reused
+ * Inputs: dev - the device
+ *         block - the block index
+ *         fill - 1 to read the block from the device on a miss, 0 if the caller overwrites all of it
+ *         valid - set to 1 if the buffer holds the content of the block, 0 if it was not filled
+ *         flags - the interrupt flags of the caller, the device is waited for with them
+ * Outputs: the buffer, now the most recently used, -1 on an I/O error
+ * Side Effects: must be called with interrupts disabled and returns with them disabled,
+ *               sleeps while the buffer is used by another process or every buffer is busy.
+ *               The caller gives the buffer back with bcache_release
+ */
+static int32_t bcache_get(block_dev_t* dev, uint32_t block, int32_t fill, int32_t* valid, unsigned long flags){
+    int32_t i, victim, result;
+    bcache_buf_t* buf;
+
+    /* the block may move while the process sleeps or waits for the device, look again every time */
+    for(;;){
+        i = bcache_lookup(dev, block);
+        if(i != -1){
+            /* the owner itself may come back from a page fault taken while it copies */
+            buf = &bcache_bufs[i];
+            if(buf->busy == 0 || buf->owner == sched_running || sched_running == -1){
+                bcache_hit_num++;
+                bcache_touch(i);
+                buf->busy++;
+                buf->owner = sched_running;
+                *valid = 1;
+                return i;
+            }
+        } else {
+            victim = lru_tail;
+            while(victim != -1 && bcache_bufs[victim].busy) victim = bcache_bufs[victim].lru_prev;
+            if(victim != -1 && !bcache_bufs[victim].dirty) break;
+            if(victim != -1){
+                /* write the old block back first, it stays findable meanwhile so nobody reads a stale copy */
+                bcache_bufs[victim].busy = 1;
+                bcache_bufs[victim].owner = sched_running;
+                if(0 == (result = bcache_transfer(victim, 1, flags))){
+                    bcache_bufs[victim].dirty = 0;
+                    bcache_writeback_num++;
+                }
+                bcache_release(victim);
+                if(result == -1) return -1;
+                continue;
+            }
+        }
+        if(sched_running == -1) return -1;
+        sched_sleep(bcache_bufs);
+    }
+
+    bcache_miss_num++;
+    buf = &bcache_bufs[victim];
+    if(buf->dev != NULL) bcache_unhash(victim);
+    /* hash it right away, a second process asking for the block waits for this read instead of starting one */
+    buf->dev = dev;
+    buf->block = block;
+    buf->busy = 1;
+    buf->owner = sched_running;
+    buf->hash_next = bcache_hash[block & BCACHE_HASH_MASK];
+    bcache_hash[block & BCACHE_HASH_MASK] = victim;
+    bcache_touch(victim);
+    if(fill && bcache_transfer(victim, 0, flags) == -1){
+        bcache_unhash(victim);
+        bcache_release(victim);
+        return -1;
+    }
+    *valid = fill;
+    return victim;
+}
+
+/* bcache_differs (PRIVATE)
+ *
+ * compare the bytes of a block with the ones about to be written over them
+ * Inputs: data - the bytes in the block
+ *         buf - the new bytes
+ *         length - number of bytes to compare
+ * Outputs: 1 if they differ, 0 if the block already holds them
+ * Side Effects: None
+ */
+static uint32_t bcache_differs(const uint8_t* data, const uint8_t* buf, uint32_t length){
+    uint32_t i;
+    if(data == buf) return 0;
+    for(i = 0; i + 4 <= length; i += 4){
+        if(*(const uint32_t*)(data + i) != *(const uint32_t*)(buf + i)) return 1;
+    }
+    for(; i < length; i++){
+        if(data[i] != buf[i]) return 1;
+    }
+    return 0;
+}
+
+/* bcache_read
+ *
+ * read length bytes starting at byte offset of a block, the range may go on into the following blocks
+ * Inputs: dev - the device
+ *         block - the first block index
+ *         offset - the byte to start at, counted from the start of block
+ *         buf - the buffer to fill
+ *         length - number of bytes to read
+ * Outputs: 0 if successful, -1 on an I/O error or a range past the end of the device
+ * Side Effects: a device in memory is copied from in one go, otherwise missing blocks are read in
+ */
+int32_t bcache_read(block_dev_t* dev, uint32_t block, uint32_t offset, uint8_t* buf, uint32_t length){
+    uint32_t chunk;
+    int32_t i, valid;
+    unsigned long flags;
+
+    if(length == 0) return 0;
+    block += offset / BLOCKDEV_BLOCK_SIZE;
+    offset %= BLOCKDEV_BLOCK_SIZE;
+    if(block >= dev->block_num || (length + offset - 1) / BLOCKDEV_BLOCK_SIZE >= dev->block_num - block) return -1;
+
+    if(dev->mem != NULL){
+        memcpy(buf, dev->mem + block * BLOCKDEV_BLOCK_SIZE + offset, length);
+        return 0;
+    }
+
+    while(length > 0){
+        chunk = BLOCKDEV_BLOCK_SIZE - offset;
+        if(chunk > length) chunk = length;
+        cli_and_save(flags);
+        if(-1 == (i = bcache_get(dev, block, 1, &valid, flags))){
+            restore_flags(flags);
+            return -1;
+        }
+        restore_flags(flags);
+        memcpy(buf, bcache_bufs[i].data + offset, chunk);
+        cli();
+        bcache_release(i);
+        restore_flags(flags);
+        buf += chunk;
+        length -= chunk;
+        block++;
+        offset = 0;
+    }
+    return 0;
+}
+
+/* bcache_write
+ *
+ * write length bytes starting at byte offset of a block, the range may go on into the following blocks.
+ * Only the blocks whose content changes are copied into and left for the next write back.
+ * Inputs: dev - the device
+ *         block - the first block index
+ *         offset - the byte to start at, counted from the start of block
+ *         buf - the new bytes
+ *         length - number of bytes to write
+ * Outputs: 0 if successful, -1 on an I/O error or a range past the end of the device
+ * Side Effects: a block only partly written is read in first unless it is cached
+ */
+int32_t bcache_write(block_dev_t* dev, uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length){
+    uint32_t chunk;
+    uint8_t* data;
+    int32_t i, valid;
+    unsigned long flags;
+
+    if(length == 0) return 0;
+    block += offset / BLOCKDEV_BLOCK_SIZE;
+    offset %= BLOCKDEV_BLOCK_SIZE;
+    if(block >= dev->block_num || (length + offset - 1) / BLOCKDEV_BLOCK_SIZE >= dev->block_num - block) return -1;
+
+    while(length > 0){
+        chunk = BLOCKDEV_BLOCK_SIZE - offset;
+        if(chunk > length) chunk = length;
+        if(dev->mem != NULL){
+            data = dev->mem + block * BLOCKDEV_BLOCK_SIZE + offset;
+            if(bcache_differs(data, buf, chunk)) memcpy(data, buf, chunk);
+        } else {
+            cli_and_save(flags);
+            if(-1 == (i = bcache_get(dev, block, chunk != BLOCKDEV_BLOCK_SIZE, &valid, flags))){
+                restore_flags(flags);
+                return -1;
+            }
+            restore_flags(flags);
+            data = bcache_bufs[i].data + offset;
+            if(!valid || bcache_differs(data, buf, chunk)){
+                memcpy(data, buf, chunk);
+                bcache_bufs[i].dirty = 1;
+            }
+            cli();
+            bcache_release(i);
+            restore_flags(flags);
+        }
+        buf += chunk;
+        length -= chunk;
+        block++;
+        offset = 0;
+    }
+    return 0;
+}
+
+/* bcache_zero
+ *
+ * fill a block with zeros without reading it, used for blocks a file has just been given
+ * Inputs: dev - the device
+ *         block - the block index
+ * Outputs: 0 if successful, -1 on an I/O error
+ * Side Effects: the block is left for the next write back
+ */
+int32_t bcache_zero(block_dev_t* dev, uint32_t block){
+    int32_t i, valid;
+    unsigned long flags;
+    if(block >= dev->block_num) return -1;
+
+    if(dev->mem != NULL){
+        memset(dev->mem + block * BLOCKDEV_BLOCK_SIZE, 0, BLOCKDEV_BLOCK_SIZE);
+        return 0;
+    }
+    cli_and_save(flags);
+    if(-1 == (i = bcache_get(dev, block, 0, &valid, flags))){
+        restore_flags(flags);
+        return -1;
+    }
+    memset(bcache_bufs[i].data, 0, BLOCKDEV_BLOCK_SIZE);
+    bcache_bufs[i].dirty = 1;
+    bcache_release(i);
+    restore_flags(flags);
+    return 0;
+}
+
+/* bcache_flush
+ *
+ * write every dirty buffer back to its device, the flush softirq
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: a softirq cannot sleep, so buffers in use are skipped and the flush stops while
+ *               the device is busy, what is left waits for the next one. A block that fails stays dirty
+ */
+void bcache_flush(void){
+    int32_t i;
+    unsigned long flags;
+    for(i = 0; i < bcache_buf_num; i++){
+        cli_and_save(flags);
+        if(bcache_io_busy){
+            restore_flags(flags);
+            return;
+        }
+        if(bcache_bufs[i].dev != NULL && bcache_bufs[i].dirty && bcache_bufs[i].busy == 0){
+            bcache_bufs[i].busy = 1;
+            bcache_bufs[i].owner = -1;
+            /* the device is free, so the transfer does not sleep */
+            if(bcache_transfer(i, 1, flags) == 0){
+                bcache_bufs[i].dirty = 0;
+                bcache_writeback_num++;
+            }
+            bcache_release(i);
+        }
+        restore_flags(flags);
+    }
+}
+
+/* bcache_tick
+ *
+ * count a PIT tick, busy or idle, and raise the flush softirq every BCACHE_FLUSH_TICKS of them
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: called from the PIT handler
+ */
+void bcache_tick(void){
+    if(bcache_buf_num == 0) return;
+    if(++bcache_ticks >= BCACHE_FLUSH_TICKS){
+        bcache_ticks = 0;
+        softirq_raise(SOFTIRQ_BCACHE);
+    }
+}
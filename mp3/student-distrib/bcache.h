@@ -0,0 +1,42 @@
+/* bcache.h - Defines the block buffer cache
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+#include "blockdev.h"
+
+/* define basic constant for the buffer cache */
+#define BCACHE_NUM 32                   // blocks kept in memory, 128 kB from the kernel heap
+#define BCACHE_HASH_SIZE 128            // buckets of the block lookup table, power of 2
+#define BCACHE_HASH_MASK (BCACHE_HASH_SIZE - 1)
+#define BCACHE_FLUSH_TICKS 300          // PIT ticks between two write backs of the dirty blocks, 3 s at 100 Hz
+
+/* one cached block, the buffers are linked from the most to the least recently used */
+typedef struct bcache_buf {
+    block_dev_t* dev;                   // NULL while the buffer holds no block
+    uint32_t block;
+    uint32_t dirty;                     // 1 if the device is behind the buffer
+    uint32_t busy;                      // number of bcache calls of the owner using the buffer, 0 if it is free
+    int32_t owner;                      // pid using the buffer while it is busy
+    int32_t hash_next;                  // next buffer in the same bucket, -1 at the end
+    int32_t lru_prev;
+    int32_t lru_next;
+    uint8_t* data;
+} bcache_buf_t;
+
+/* functions used by the buffer cache, devices whose mem is set are read and written in place */
+void bcache_init(void);
+int32_t bcache_read(block_dev_t* dev, uint32_t block, uint32_t offset, uint8_t* buf, uint32_t length);
+int32_t bcache_write(block_dev_t* dev, uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length);
+int32_t bcache_zero(block_dev_t* dev, uint32_t block);
+void bcache_flush(void);
+void bcache_tick(void);
+
+extern uint32_t bcache_hit_num;
+extern uint32_t bcache_miss_num;
+extern uint32_t bcache_writeback_num;
+
+#endif /* _BCACHE_H */
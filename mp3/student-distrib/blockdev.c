@@ -0,0 +1,55 @@
+/* blockdev.c - the memory block device backed by the boot module
+ * vim:ts=4 noexpandtab
+ */
+
+#include "blockdev.h"
+#include "lib.h"
+
+static block_dev_t memdisk;
+
+/* memdisk_read_block (PRIVATE)
+ *
+ * copy one block of the module into buf
+ * Inputs: dev - the memory device
+ *         block - the block index
+ *         buf - BLOCKDEV_BLOCK_SIZE bytes to fill
+ * Outputs: 0 if successful, -1 if the block is past the end
+ * Side Effects: None
+ */
+static int32_t memdisk_read_block(block_dev_t* dev, uint32_t block, uint8_t* buf){
+    if(block >= dev->block_num) return -1;
+    memcpy(buf, dev->mem + block * BLOCKDEV_BLOCK_SIZE, BLOCKDEV_BLOCK_SIZE);
+    return 0;
+}
+
+/* memdisk_write_block (PRIVATE)
+ *
+ * copy buf over one block of the module
+ * Inputs: dev - the memory device
+ *         block - the block index
+ *         buf - BLOCKDEV_BLOCK_SIZE bytes to write
+ * Outputs: 0 if successful, -1 if the block is past the end
+ * Side Effects: None
+ */
+static int32_t memdisk_write_block(block_dev_t* dev, uint32_t block, const uint8_t* buf){
+    if(block >= dev->block_num) return -1;
+    memcpy(dev->mem + block * BLOCKDEV_BLOCK_SIZE, buf, BLOCKDEV_BLOCK_SIZE);
+    return 0;
+}
+
+/* memdisk_init
+ *
+ * make a block device out of the file system image grub loaded as a module
+ * Inputs: start - first byte of the module
+ *         size - size of the module in bytes
+ * Outputs: the device
+ * Side Effects: None
+ */
+block_dev_t* memdisk_init(uint8_t* start, uint32_t size){
+    memdisk.name = (const int8_t*)"memdisk";
+    memdisk.block_num = size / BLOCKDEV_BLOCK_SIZE;
+    memdisk.mem = start;
+    memdisk.read_block = memdisk_read_block;
+    memdisk.write_block = memdisk_write_block;
+    return &memdisk;
+}
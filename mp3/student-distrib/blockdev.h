@@ -0,0 +1,25 @@
+/* blockdev.h - Defines the block devices the file system can live on
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BLOCKDEV_H
+#define _BLOCKDEV_H
+
+#include "types.h"
+
+/* define basic constant for block devices */
+#define BLOCKDEV_BLOCK_SIZE 4096    // every device is read and written in file system blocks
+
+/* one block device, the operations move a whole block and return 0 on success, -1 on an I/O error */
+typedef struct block_dev {
+    const int8_t* name;
+    uint32_t block_num;             // number of blocks on the device
+    uint8_t* mem;                   // start of the device if it is plain memory, the buffer cache is skipped then
+    int32_t (*read_block)(struct block_dev* dev, uint32_t block, uint8_t* buf);
+    int32_t (*write_block)(struct block_dev* dev, uint32_t block, const uint8_t* buf);
+} block_dev_t;
+
+/* the boot module holding the file system image, writes only last until reboot */
+block_dev_t* memdisk_init(uint8_t* start, uint32_t size);
+
+#endif /* _BLOCKDEV_H */
@@ -1,14 +1,19 @@
 #include "date.h"
-#include "GUI/gui.h"
-
-int32_t get_update_in_progress_flag() { // learnt from https://wiki.osdev.org/CMOS#Accessing_CMOS_Registers
-      outb(0x0A, CMOS_SELE_PORT);
-      return (inb(CMOS_READ_PORT) & 0x80);
-}
+#include "lib.h"
 
+/* the RTC interrupt selects register C through the same port, so select and read with interrupts off */
 int32_t read_from_RTC(int port) {
+    uint32_t flags;
+    int32_t value;
+    cli_and_save(flags);
     outb(port, CMOS_SELE_PORT);
-    return inb(CMOS_READ_PORT);
+    value = inb(CMOS_READ_PORT);
+    restore_flags(flags);
+    return value;
+}
+
+int32_t get_update_in_progress_flag() { // learnt from https://wiki.osdev.org/CMOS#Accessing_CMOS_Registers
+      return (read_from_RTC(0x0A) & 0x80);
 }
 
 void get_date() {
@@ -36,7 +41,6 @@ void get_date() {
         year = (year & 0x0F) + ((year >> 4) * 10);
     }
 
-    draw_time();
     // Convert 12 hour clock to 24 hour clock if necessary
     /*
     if (!(registerB & 0x02) && (hour & 0x80)) {
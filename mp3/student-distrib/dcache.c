@@ -0,0 +1,145 @@
+/* dcache.c - cache of the entries found in subdirectories
+ * vim:ts=4 noexpandtab
+ */
+
+#include "dcache.h"
+#include "lib.h"
+
+static dcache_entry_t dcache_entries[DCACHE_NUM];
+static int32_t dcache_hash[DCACHE_HASH_SIZE];   // first entry of each bucket, -1 if empty
+static int32_t lru_head = -1;                   // most recently used entry
+static int32_t lru_tail = -1;                   // least recently used entry, the next victim
+uint32_t dcache_hit_num = 0;
+uint32_t dcache_miss_num = 0;
+
+/* dcache_bucket (PRIVATE) - bucket of a name in a directory, the parent is mixed in so
+   the "." and ".." of every directory do not all land in the same bucket */
+static inline uint32_t dcache_bucket(uint32_t parent, uint32_t hash){
+    return (hash ^ (parent * 2654435761U)) & DCACHE_HASH_MASK;
+}
+
+/* dcache_init
+ *
+ * empty the cache, called when a file system is mounted
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: every cached entry is dropped
+ */
+void dcache_init(void){
+    int32_t i;
+    memset(dcache_hash, 0xFF, sizeof(dcache_hash));
+    for(i = 0; i < DCACHE_NUM; i++){
+        dcache_entries[i].valid = 0;
+        dcache_entries[i].hash_next = -1;
+        dcache_entries[i].lru_prev = i - 1;
+        dcache_entries[i].lru_next = (i + 1 < DCACHE_NUM) ? i + 1 : -1;
+    }
+    lru_head = 0;
+    lru_tail = DCACHE_NUM - 1;
+}
+
+/* dcache_touch (PRIVATE)
+ *
+ * move an entry to the most recently used end of the list
+ * Inputs: i - the entry
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled
+ */
+static void dcache_touch(int32_t i){
+    dcache_entry_t* entry = &dcache_entries[i];
+    if(lru_head == i) return;
+    /* unlink, the entry is not the head so it has a previous one */
+    dcache_entries[entry->lru_prev].lru_next = entry->lru_next;
+    if(entry->lru_next != -1) dcache_entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    /* put it in front */
+    entry->lru_prev = -1;
+    entry->lru_next = lru_head;
+    dcache_entries[lru_head].lru_prev = i;
+    lru_head = i;
+}
+
+/* dcache_unhash (PRIVATE)
+ *
+ * take an entry out of its bucket and mark the slot empty
+ * Inputs: i - the entry, must be valid
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled
+ */
+static void dcache_unhash(int32_t i){
+    int32_t* link = &dcache_hash[dcache_bucket(dcache_entries[i].parent, dcache_entries[i].hash)];
+    while(*link != i) link = &dcache_entries[*link].hash_next;
+    *link = dcache_entries[i].hash_next;
+    dcache_entries[i].valid = 0;
+}
+
+/* dcache_find (PRIVATE)
+ *
+ * find the entry of a name in a directory
+ * Inputs: parent - inode of the directory
+ *         name - the file name, '\0' terminated unless it takes MAX_FILE_NAME bytes
+ *         hash - the name hash
+ * Outputs: the entry, -1 if it is not cached
+ * Side Effects: must be called with interrupts disabled
+ */
+static int32_t dcache_find(uint32_t parent, const uint8_t* name, uint32_t hash){
+    int32_t i;
+    for(i = dcache_hash[dcache_bucket(parent, hash)]; i != -1; i = dcache_entries[i].hash_next){
+        if(dcache_entries[i].parent == parent && dcache_entries[i].hash == hash &&
+           strncmp((const char*)name, (const char*)dcache_entries[i].dentry.file_name, MAX_FILE_NAME) == 0) return i;
+    }
+    return -1;
+}
+
+/* dcache_lookup
+ *
+ * look up a name in a directory without reading the directory
+ * Inputs: parent - inode of the directory
+ *         name - the file name, '\0' terminated unless it takes MAX_FILE_NAME bytes
+ *         hash - the name hash
+ *         dentry - filled with the cached entry on a hit
+ * Outputs: 0 on a hit, -1 if the name is not cached, it may still be in the directory
+ * Side Effects: the entry becomes the most recently used
+ */
+int32_t dcache_lookup(uint32_t parent, const uint8_t* name, uint32_t hash, dentry_t* dentry){
+    int32_t i;
+    unsigned long flags;
+    cli_and_save(flags);
+    if(-1 == (i = dcache_find(parent, name, hash))){
+        dcache_miss_num++;
+        restore_flags(flags);
+        return -1;
+    }
+    dcache_hit_num++;
+    dcache_touch(i);
+    memcpy(dentry, &dcache_entries[i].dentry, sizeof(dentry_t));
+    restore_flags(flags);
+    return 0;
+}
+
+/* dcache_insert
+ *
+ * remember an entry found by reading a directory, the least recently used entry makes room for it
+ * Inputs: parent - inode of the directory
+ *         hash - the name hash
+ *         dentry - the entry
+ * Outputs: None
+ * Side Effects: an entry already cached under the same name is only refreshed
+ */
+void dcache_insert(uint32_t parent, uint32_t hash, const dentry_t* dentry){
+    int32_t i;
+    unsigned long flags;
+    cli_and_save(flags);
+    if(-1 == (i = dcache_find(parent, dentry->file_name, hash))){
+        i = lru_tail;
+        if(dcache_entries[i].valid) dcache_unhash(i);
+        dcache_entries[i].valid = 1;
+        dcache_entries[i].parent = parent;
+        dcache_entries[i].hash = hash;
+        dcache_entries[i].hash_next = dcache_hash[dcache_bucket(parent, hash)];
+        dcache_hash[dcache_bucket(parent, hash)] = i;
+    }
+    memcpy(&dcache_entries[i].dentry, dentry, sizeof(dentry_t));
+    dcache_touch(i);
+    restore_flags(flags);
+}
@@ -0,0 +1,35 @@
+/* dcache.h - Defines the directory entry cache
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _DCACHE_H
+#define _DCACHE_H
+
+#include "types.h"
+#include "filesys.h"
+
+/* define basic constant for the directory entry cache */
+#define DCACHE_NUM 64                   // entries kept in memory
+#define DCACHE_HASH_SIZE 128            // buckets of the lookup table, power of 2
+#define DCACHE_HASH_MASK (DCACHE_HASH_SIZE - 1)
+
+/* one cached entry of a subdirectory, the entries are linked from the most to the least recently used */
+typedef struct dcache_entry {
+    uint32_t valid;                     // 1 if this slot holds an entry
+    uint32_t parent;                    // inode of the directory the entry was found in
+    uint32_t hash;                      // name hash of the entry, computed by the file system
+    dentry_t dentry;
+    int32_t hash_next;                  // next entry in the same bucket, -1 at the end
+    int32_t lru_prev;
+    int32_t lru_next;
+} dcache_entry_t;
+
+/* functions used by the directory entry cache, keyed by (parent inode, name) */
+void dcache_init(void);
+int32_t dcache_lookup(uint32_t parent, const uint8_t* name, uint32_t hash, dentry_t* dentry);
+void dcache_insert(uint32_t parent, uint32_t hash, const dentry_t* dentry);
+
+extern uint32_t dcache_hit_num;
+extern uint32_t dcache_miss_num;
+
+#endif /* _DCACHE_H */
@@ -0,0 +1,162 @@
+#include "ata.h"
+#include "../lib.h"
+
+static int32_t ata_read_block(block_dev_t* dev, uint32_t block, uint8_t* buf);
+static int32_t ata_write_block(block_dev_t* dev, uint32_t block, const uint8_t* buf);
+
+block_dev_t ata_dev = {
+    .name = (const int8_t*)"ata",
+    .block_num = 0,
+    .mem = NULL,
+    .read_block = ata_read_block,
+    .write_block = ata_write_block
+};
+
+/* ata_delay - wait the 400 ns a drive needs before its status is valid
+ *
+ * Inputs: none
+ * Outputs: none
+ * Side Effects: each read of the alternate status takes about 100 ns
+ */
+static void ata_delay(void) {
+    inb(ATA_CONTROL_PORT);
+    inb(ATA_CONTROL_PORT);
+    inb(ATA_CONTROL_PORT);
+    inb(ATA_CONTROL_PORT);
+}
+
+/* ata_wait - poll the status until the drive is not busy
+ *
+ * Inputs: want_drq - 1 to also wait for the drive to have data to move
+ * Outputs: 0 once ready, -1 on an error, a drive fault or a timeout
+ * Side Effects: none
+ */
+static int32_t ata_wait(int32_t want_drq) {
+    uint32_t i;
+    uint8_t status;
+    for (i = 0; i < ATA_POLL_LIMIT; i++) {
+        status = inb(ATA_STATUS_PORT);
+        if (status & ATA_STATUS_BSY)
+            continue;
+        if (status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+            return -1;
+        if (!want_drq || (status & ATA_STATUS_DRQ))
+            return 0;
+    }
+    return -1;
+}
+
+/* ata_command - send a command for count sectors starting at lba
+ *
+ * Inputs: cmd - ATA_CMD_READ or ATA_CMD_WRITE
+ *         lba - first sector
+ *         count - number of sectors, 1 to 255
+ * Outputs: 0 if the drive took it, -1 otherwise
+ * Side Effects: none
+ */
+static int32_t ata_command(uint8_t cmd, uint32_t lba, uint8_t count) {
+    outb(ATA_SELECT_SLAVE | ATA_SELECT_LBA | ((lba >> 24) & 0x0F), ATA_DRIVE_PORT);
+    ata_delay();
+    if (ata_wait(0) == -1)
+        return -1;
+    outb(count, ATA_SECCOUNT_PORT);
+    outb((uint8_t)lba, ATA_LBA_LOW_PORT);
+    outb((uint8_t)(lba >> 8), ATA_LBA_MID_PORT);
+    outb((uint8_t)(lba >> 16), ATA_LBA_HIGH_PORT);
+    outb(cmd, ATA_COMMAND_PORT);
+    ata_delay();
+    return 0;
+}
+
+/* ata_read_block - read one file system block, 8 sectors, with programmed I/O
+ *
+ * Inputs: dev - the ata device
+ *         block - the block index
+ *         buf - BLOCKDEV_BLOCK_SIZE bytes to fill
+ * Outputs: 0 if successful, -1 on an I/O error
+ * Side Effects: busy waits on the drive, the buffer cache lets one transfer use the bus at a time
+ */
+static int32_t ata_read_block(block_dev_t* dev, uint32_t block, uint8_t* buf) {
+    uint32_t i, count;
+    if (block >= dev->block_num)
+        return -1;
+    if (ata_command(ATA_CMD_READ, block * ATA_SECTORS_PER_BLOCK, ATA_SECTORS_PER_BLOCK) == -1)
+        return -1;
+    for (i = 0; i < ATA_SECTORS_PER_BLOCK; i++) {
+        if (ata_wait(1) == -1)
+            return -1;
+        count = ATA_SECTOR_WORDS;
+        asm volatile("cld; rep insw"
+                     : "+D"(buf), "+c"(count)
+                     : "d"(ATA_DATA_PORT)
+                     : "memory");
+    }
+    return 0;
+}
+
+/* ata_write_block - write one file system block, 8 sectors, with programmed I/O
+ *
+ * Inputs: dev - the ata device
+ *         block - the block index
+ *         buf - BLOCKDEV_BLOCK_SIZE bytes to write
+ * Outputs: 0 once the drive has flushed them, -1 on an I/O error
+ * Side Effects: busy waits on the drive, the buffer cache lets one transfer use the bus at a time
+ */
+static int32_t ata_write_block(block_dev_t* dev, uint32_t block, const uint8_t* buf) {
+    uint32_t i, j;
+    const uint16_t* words = (const uint16_t*)buf;
+    if (block >= dev->block_num)
+        return -1;
+    if (ata_command(ATA_CMD_WRITE, block * ATA_SECTORS_PER_BLOCK, ATA_SECTORS_PER_BLOCK) == -1)
+        return -1;
+    for (i = 0; i < ATA_SECTORS_PER_BLOCK; i++) {
+        if (ata_wait(1) == -1)
+            return -1;
+        // one word at a time, some drives cannot keep up with rep outsw
+        for (j = 0; j < ATA_SECTOR_WORDS; j++) {
+            outw(*words++, ATA_DATA_PORT);
+        }
+    }
+    outb(ATA_CMD_FLUSH, ATA_COMMAND_PORT);
+    ata_delay();
+    return ata_wait(0);
+}
+
+/* ata_init - look for the file system disk on the primary slave
+ *
+ * Inputs: none
+ * Outputs: 0 if an ATA disk answered IDENTIFY, -1 otherwise
+ * Side Effects: turns the interrupts of the bus off and sets ata_dev.block_num
+ */
+int32_t ata_init(void) {
+    uint16_t identify[ATA_SECTOR_WORDS];
+    uint32_t i, sectors;
+
+    outb(ATA_CONTROL_NIEN, ATA_CONTROL_PORT);
+    outb(ATA_SELECT_SLAVE, ATA_DRIVE_PORT);
+    ata_delay();
+    outb(0, ATA_SECCOUNT_PORT);
+    outb(0, ATA_LBA_LOW_PORT);
+    outb(0, ATA_LBA_MID_PORT);
+    outb(0, ATA_LBA_HIGH_PORT);
+    outb(ATA_CMD_IDENTIFY, ATA_COMMAND_PORT);
+    ata_delay();
+
+    // a status of 0 means there is no drive, a floating bus reads 0xFF
+    if (inb(ATA_STATUS_PORT) == 0 || inb(ATA_STATUS_PORT) == 0xFF)
+        return -1;
+    for (i = 0; i < ATA_POLL_LIMIT && (inb(ATA_STATUS_PORT) & ATA_STATUS_BSY); i++);
+    // ATAPI and SATA devices set the LBA registers to their signature instead of answering
+    if (inb(ATA_LBA_MID_PORT) != 0 || inb(ATA_LBA_HIGH_PORT) != 0)
+        return -1;
+    if (ata_wait(1) == -1)
+        return -1;
+    for (i = 0; i < ATA_SECTOR_WORDS; i++) {
+        identify[i] = inw(ATA_DATA_PORT);
+    }
+
+    sectors = identify[ATA_IDENTIFY_LBA28] | ((uint32_t)identify[ATA_IDENTIFY_LBA28 + 1] << 16);
+    ata_dev.block_num = sectors / ATA_SECTORS_PER_BLOCK;
+    printf("ata: %u blocks on the primary slave\n", ata_dev.block_num);
+    return ata_dev.block_num == 0 ? -1 : 0;
+}
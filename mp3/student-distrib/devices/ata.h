@@ -0,0 +1,46 @@
+#ifndef _ATA_H
+#define _ATA_H
+
+#include "../types.h"
+#include "../blockdev.h"
+
+/* primary IDE bus, the boot disk is the master so the file system image is the slave (qemu -hdb) */
+#define ATA_DATA_PORT       0x1F0
+#define ATA_ERROR_PORT      0x1F1
+#define ATA_SECCOUNT_PORT   0x1F2
+#define ATA_LBA_LOW_PORT    0x1F3
+#define ATA_LBA_MID_PORT    0x1F4
+#define ATA_LBA_HIGH_PORT   0x1F5
+#define ATA_DRIVE_PORT      0x1F6
+#define ATA_STATUS_PORT     0x1F7   // read
+#define ATA_COMMAND_PORT    0x1F7   // write
+#define ATA_CONTROL_PORT    0x3F6   // write, reads give the alternate status
+
+/* drive select, bit 4 picks the slave and bit 6 turns on LBA addressing */
+#define ATA_SELECT_SLAVE    0xB0
+#define ATA_SELECT_LBA      0x40
+
+/* status bits */
+#define ATA_STATUS_BSY      0x80
+#define ATA_STATUS_DF       0x20
+#define ATA_STATUS_DRQ      0x08
+#define ATA_STATUS_ERR      0x01
+
+/* commands */
+#define ATA_CMD_READ        0x20    // read sectors, 28-bit LBA
+#define ATA_CMD_WRITE       0x30    // write sectors, 28-bit LBA
+#define ATA_CMD_FLUSH       0xE7    // flush the write cache of the drive
+#define ATA_CMD_IDENTIFY    0xEC
+
+#define ATA_CONTROL_NIEN    0x02    // the drive raises no interrupts, every transfer is polled
+#define ATA_SECTOR_SIZE     512
+#define ATA_SECTOR_WORDS    (ATA_SECTOR_SIZE / 2)
+#define ATA_SECTORS_PER_BLOCK (BLOCKDEV_BLOCK_SIZE / ATA_SECTOR_SIZE)
+#define ATA_IDENTIFY_LBA28  60      // words 60 and 61 of the identify data count the 28-bit LBA sectors
+#define ATA_POLL_LIMIT      1000000 // status reads before a drive is given up on
+
+extern block_dev_t ata_dev;
+
+int32_t ata_init(void);
+
+#endif
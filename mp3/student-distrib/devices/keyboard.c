@@ -14,8 +14,8 @@ static const uint8_t ps2_set1_keycode[128] = {
     KEY_DOT, KEY_SLASH, KEY_RIGHTSHIFT, KEY_KPASTERISK, KEY_LEFTALT,
     KEY_SPACE, KEY_CAPSLOCK, KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5,
     KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_NUMLOCK, KEY_SCROLLLOCK,
-    KEY_KP7, KEY_ARROW_UP, KEY_KP9, KEY_KPMINUS, KEY_ARROW_LEFT, KEY_KP5, KEY_ARROW_RIGHT,
-    KEY_KPPLUS, KEY_KP1, KEY_ARROW_DOWN, KEY_KP3, KEY_KP0, KEY_KPDOT,
+    KEY_KP7, KEY_ARROW_UP, KEY_PAGE_UP, KEY_KPMINUS, KEY_ARROW_LEFT, KEY_KP5, KEY_ARROW_RIGHT,
+    KEY_KPPLUS, KEY_KP1, KEY_ARROW_DOWN, KEY_PAGE_DOWN, KEY_KP0, KEY_KPDOT,
     // Remaining keys are not used but will be mapped to KEY_RESERVED (0) anyway
 };
 
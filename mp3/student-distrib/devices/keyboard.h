@@ -35,6 +35,7 @@ enum keycodes_ {
     KEY_KP7, KEY_KP8, KEY_KP9, KEY_KPMINUS, KEY_KP4, KEY_KP5, KEY_KP6, 
     KEY_KPPLUS, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KP0, KEY_KPDOT,
     KEY_ARROW_UP, KEY_ARROW_LEFT, KEY_ARROW_DOWN, KEY_ARROW_RIGHT,
+    KEY_PAGE_UP, KEY_PAGE_DOWN,
 };
 
 DECLARE_DEVICE_HANDLER(keyboard);
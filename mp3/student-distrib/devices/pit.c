@@ -3,9 +3,20 @@
 #include "../lib.h"
 #include "../scheduler.h"
 #include "../signal.h"
+#include "../bcache.h"
+#include "../softirq.h"
 
 int32_t alarm_signal_counter = 0;
 
+/* time accounting, a tick is one period of the rate set by pit_set_rate */
+uint32_t pit_busy_ticks = 0;                // ticks that interrupted a running process
+uint32_t pit_idle_ticks = 0;                // ticks spent halted with nothing to run
+static uint32_t pit_idle_cycles = 0;        // idle input clock cycles not yet making up a whole tick
+
+static uint32_t pit_divisor = PIT_FREQ;     // input clock cycles per tick
+static uint32_t pit_oneshot_count = 0;      // count loaded in one-shot mode, 0 while ticking periodically
+static volatile int32_t pit_skip_irq = 0;   // a one-shot interrupt is still pending after idle ended
+
 /* PIT_init - Initialization of Programmable Interval Timer (PIT)
  * 
  * Initializes the PIT to a frequency of 100Hz.
@@ -15,26 +26,152 @@ int32_t alarm_signal_counter = 0;
  * Side Effects: Modifies PIT Mode Register and Channel 0 Data Register
  */
 void pit_init(void) {
-    outb(MODE_CONTAIN, MODE_REG);
-    outb((uint8_t)PIT_FREQ, CHAN_0_DATA_PORT);
-    outb((uint8_t)(PIT_FREQ >> 8), CHAN_0_DATA_PORT);
+    pit_set_rate(PIT_INPUT_HZ / PIT_FREQ);
     enable_irq(PIT_IRQ);
 }
 
+/* pit_load - program channel 0
+ * 
+ * Inputs: mode - MODE_CONTAIN for periodic ticks or MODE_ONESHOT for a single interrupt
+ *         count - input clock cycles until the (next) interrupt
+ * Outputs: none
+ * Side Effects: Modifies PIT Mode Register and Channel 0 Data Register
+ */
+static void pit_load(uint8_t mode, uint32_t count) {
+    outb(mode, MODE_REG);
+    outb((uint8_t)count, CHAN_0_DATA_PORT);
+    outb((uint8_t)(count >> 8), CHAN_0_DATA_PORT);
+}
+
+/* pit_set_rate - change how often the scheduler gets a tick
+ * 
+ * Inputs: hz - ticks per second, between 19 and PIT_INPUT_HZ
+ * Outputs: none
+ * Side Effects: reprograms channel 0 unless it is in the middle of an idle one-shot,
+ *               which picks the new rate up when idle ends
+ */
+void pit_set_rate(uint32_t hz) {
+    uint32_t flags;
+    if (hz == 0 || PIT_INPUT_HZ / hz > PIT_MAX_COUNT || PIT_INPUT_HZ / hz == 0)
+        return;
+    cli_and_save(flags);
+    pit_divisor = PIT_INPUT_HZ / hz;
+    if (pit_oneshot_count == 0)
+        pit_load(MODE_CONTAIN, pit_divisor);
+    restore_flags(flags);
+}
+
+/* pit_alarm_tick - advance the alarm deadline by one tick
+ * 
+ * Inputs: none
+ * Outputs: none
+ * Side Effects: sends the alarm signal every PIT_ALARM_TICKS ticks
+ */
+static void pit_alarm_tick(void) {
+    alarm_signal_counter++;
+    if(alarm_signal_counter >= PIT_ALARM_TICKS){
+        alarm_signal_counter = 0;
+        send_signal_by_pid(SIGNUM_ALARM, 3);
+    }
+}
+
+/* pit_account_idle - turn idle input clock cycles into idle ticks
+ * 
+ * Inputs: cycles - cycles spent halted
+ * Outputs: none
+ * Side Effects: the alarm deadline keeps moving while the cpu is halted
+ */
+static void pit_account_idle(uint32_t cycles) {
+    pit_idle_cycles += cycles;
+    while (pit_idle_cycles >= pit_divisor) {
+        pit_idle_cycles -= pit_divisor;
+        pit_idle_ticks++;
+        pit_alarm_tick();
+        bcache_tick();
+    }
+}
+
+/* pit_arm_oneshot - load a single interrupt for the next deadline
+ * 
+ * The only deadline kept by PIT ticks is the alarm signal, RTC readers are woken by the
+ * RTC interrupt and the keyboard by its own, so nothing else needs the PIT while idle.
+ * Inputs: none
+ * Outputs: none
+ * Side Effects: the count is capped by the 16-bit counter, about 55 ms
+ */
+static void pit_arm_oneshot(void) {
+    uint32_t ticks = PIT_ALARM_TICKS - alarm_signal_counter;
+    if (ticks > PIT_MAX_COUNT / pit_divisor)
+        ticks = PIT_MAX_COUNT / pit_divisor;
+    if (ticks == 0)
+        ticks = 1;
+    // the partial tick already spent idle is part of the way to the deadline
+    pit_oneshot_count = ticks * pit_divisor - pit_idle_cycles;
+    pit_load(MODE_ONESHOT, pit_oneshot_count);
+}
+
+/* pit_idle_enter - stop periodic ticks before the scheduler halts the cpu
+ * 
+ * Inputs: none
+ * Outputs: none
+ * Side Effects: must be called with interrupts disabled, switches channel 0 to one-shot mode
+ */
+void pit_idle_enter(void) {
+    pit_arm_oneshot();
+}
+
+/* pit_idle_exit - go back to periodic ticks once a process is runnable again
+ * 
+ * Inputs: none
+ * Outputs: none
+ * Side Effects: must be called with interrupts disabled, charges the part of the
+ *               one-shot that has elapsed to the idle time
+ */
+void pit_idle_exit(void) {
+    uint8_t status;
+    uint32_t remaining;
+
+    outb(MODE_READBACK_CH0, MODE_REG);
+    status = inb(CHAN_0_DATA_PORT);
+    remaining = inb(CHAN_0_DATA_PORT);
+    remaining |= inb(CHAN_0_DATA_PORT) << 8;
+
+    if (status & STATUS_OUT) {
+        // ran out after interrupts were disabled, its interrupt has not been handled yet
+        pit_account_idle(pit_oneshot_count);
+        pit_skip_irq = 1;
+    } else if (remaining <= pit_oneshot_count) {
+        pit_account_idle(pit_oneshot_count - remaining);
+    }
+    pit_oneshot_count = 0;
+    pit_load(MODE_CONTAIN, pit_divisor);
+}
+
 /* __intr_PIT_handler - Programmable Interval Timer (PIT) Interrupt Handler
  * 
  * Handles interrupts generated by the PIT.
  * 
  * Inputs: None (Triggered by PIT interrupt)
  * Outputs: None (Handles interrupt side effects)
- * Side Effects: Call the scheduler
+ * Side Effects: While idle, accounts the one-shot and loads the next one. Otherwise runs the
+ *               raised softirqs, charges the tick to the running process and calls the scheduler
+ *               once its slice is used up
  */
 void __intr_PIT_handler(void) {
-    alarm_signal_counter++;
-    if(alarm_signal_counter >= 1000){
-        alarm_signal_counter = 0;
-        send_signal_by_pid(SIGNUM_ALARM, 3);
-    }
     send_eoi(PIT_IRQ);
-    scheduler();
+    if (pit_skip_irq) {
+        // already accounted by pit_idle_exit
+        pit_skip_irq = 0;
+        return;
+    }
+    if (pit_oneshot_count != 0) {
+        pit_account_idle(pit_oneshot_count);
+        pit_arm_oneshot();
+        return;
+    }
+    pit_busy_ticks++;
+    pit_alarm_tick();
+    bcache_tick();
+    do_softirq();   // the write back bcache_tick raises, before the slice may switch away
+    sched_tick();
 }
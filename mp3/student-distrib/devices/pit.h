@@ -1,8 +1,12 @@
 #ifndef _PIT_H
 #define _PIT_H
 
+#include "../types.h"
+
 /* oscillator's freq: 1.193182 MHz, actually 100Hz */
 #define PIT_FREQ 11931  
+#define PIT_INPUT_HZ 1193182    // input clock of every channel
+#define PIT_MAX_COUNT 0xFFFF    // largest count a channel can be loaded with
 
 /* Mode/Command register (write only, read ignored) */
 #define MODE_REG 0x43
@@ -15,12 +19,28 @@ Bits
 0:     0 = 16-bit binary*/
 #define MODE_CONTAIN 0x36
 
+/* same as above but mode 0 (interrupt on terminal count), fires once */
+#define MODE_ONESHOT 0x30
+
+/* read-back command latching the status and the count of channel 0,
+   bit 7 of the status is the output pin, which goes high when a one-shot count runs out */
+#define MODE_READBACK_CH0 0xC2
+#define STATUS_OUT 0x80
+
 /* Channel 0 data port (read/write) */
 #define CHAN_0_DATA_PORT 0X40
 
 #define PIT_IRQ 0
 
+#define PIT_ALARM_TICKS 1000    // ticks between two alarm signals
+
+extern uint32_t pit_busy_ticks;
+extern uint32_t pit_idle_ticks;
+
 void pit_init(void);
+void pit_set_rate(uint32_t hz);
+void pit_idle_enter(void);
+void pit_idle_exit(void);
 void __intr_PIT_handler(void);
 
 #endif
@@ -5,19 +5,24 @@
 #include "../pcb.h"
 #include "../GUI/gui.h"
 #include "../signal.h"
+#include "../scheduler.h"
+#include "../softirq.h"
 
 volatile int32_t max_freq = 32;
 volatile int32_t min_rate = 11;
 
-/* struct storing frequency and counter for process with
-different frequencies. Used to implement virtualization */
+/* virtual RTC of one open rtc file, time is counted in 1/RTC_TIME_HZ seconds so
+   it does not depend on the rate the hardware currently runs at */
 typedef struct {
-    int32_t proc_freq;
-    volatile int32_t proc_count;
-} proc_freqcount_pair;
+    uint32_t period;            // time between two virtual interrupts
+    uint32_t deadline;          // time of the next virtual interrupt
+    int32_t heap_index;         // position in RTC_timer_heap, -1 while nobody waits on it
+} rtc_timer_t;
 
-static proc_freqcount_pair RTC_proc_list[MAX_PROC_NUM];
-static int GUI_counter;
+static rtc_timer_t RTC_timers[MAX_PID_NUM * NUM_FILES];     // timer of file descriptor fd of pid is [pid * NUM_FILES + fd]
+static rtc_timer_t* RTC_timer_heap[MAX_PID_NUM * NUM_FILES]; // min-heap by deadline of the timers with a sleeping reader
+static int32_t RTC_timer_num = 0;
+static volatile uint32_t RTC_time = 0;                      // advanced by RTC_TIME_HZ / max_freq every interrupt
 
 operation_table_t RTC_operation_table = {
     .open_operation = RTC_open,
@@ -49,77 +54,111 @@ void RTC_init(void) {
     outb(RTC_A, RTC_PORT);     // set the index again
     outb((prev & 0xF0) | min_rate, RTC_CMOS_PORT);  // set the frequency to 2 Hz
 
-    int i;
-    for (i = 0; i < MAX_PROC_NUM; ++i) {
-        RTC_proc_list[i].proc_freq = 2;
-        RTC_proc_list[i].proc_count = max_freq / 2;
-    }
-    GUI_counter = (max_freq / 2);
-
     enable_irq(RTC_IRQ);
 }
 
+/* set_RTC_freq - run the hardware at max_freq, the rate is 16 - log2(frequency)
+ * 
+ * Inputs: none
+ * Outputs: none
+ * Side Effects: Modifies RTC control register A
+ */
 void set_RTC_freq(void) {
-    switch (max_freq) {
-        case 32768:
-            min_rate = 1;
-            break;
-        case 16384:
-            min_rate = 2;
-            break;
-        case 8192:
-            min_rate = 3;
-            break;
-        case 4096:
-            min_rate = 4;
-            break;
-        case 2048:
-            min_rate = 5;
-            break;
-        case 1024:
-            min_rate = 6;
-            break;
-        case 512:
-            min_rate = 7;
-            break;
-        case 256:
-            min_rate = 8;
-            break;
-        case 128:
-            min_rate = 9;
-            break;
-        case 64:
-            min_rate = 10;
-            break;
-        case 32:
-            min_rate = 11;
-            break;
-        case 16:
-            min_rate = 12;
-            break;
-        case 8:
-            min_rate = 13;
-            break;
-        case 4:
-            min_rate = 14;
-            break;
-        case 2:
-            min_rate = 15;
-            break;
-        default:
-            break;
-    }
+    int32_t log2_freq;
+    asm volatile("bsrl %1, %0" : "=r"(log2_freq) : "r"(max_freq));
+    min_rate = RTC_RATE_BASE - log2_freq;
     outb(RTC_A, RTC_PORT);     // set index to register A, disable NMI
     char prev = inb(RTC_CMOS_PORT); // get the previous value of register B
     outb(RTC_A, RTC_PORT);     // set the index again
     outb((prev & 0xF0) | min_rate, RTC_CMOS_PORT);  // set the frequency to the max freq
-    int i;
-    for(i=0; i < MAX_PROC_NUM; i++) {
-        RTC_proc_list[i].proc_count = max_freq / RTC_proc_list[i].proc_freq;
+}
+
+/* RTC_before - compare two times of the virtual clock, correct across wrap around
+ * Inputs: a, b - the two times
+ * Outputs: 1 if a comes before b, 0 otherwise
+ */
+static inline int32_t RTC_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+/* RTC_heap_set - place a timer at a slot of the heap
+ * Inputs: index - the slot
+ *         timer - the timer
+ * Outputs: none
+ */
+static inline void RTC_heap_set(int32_t index, rtc_timer_t* timer) {
+    RTC_timer_heap[index] = timer;
+    timer->heap_index = index;
+}
+
+/* RTC_heap_up - move a timer towards the root while its deadline is earlier than its parent's
+ * Inputs: index - slot of the timer
+ * Outputs: none
+ */
+static void RTC_heap_up(int32_t index) {
+    rtc_timer_t* timer = RTC_timer_heap[index];
+    while (index > 0 && RTC_before(timer->deadline, RTC_timer_heap[(index - 1) / 2]->deadline)) {
+        RTC_heap_set(index, RTC_timer_heap[(index - 1) / 2]);
+        index = (index - 1) / 2;
+    }
+    RTC_heap_set(index, timer);
+}
+
+/* RTC_heap_down - move a timer towards the leaves while a child has an earlier deadline
+ * Inputs: index - slot of the timer
+ * Outputs: none
+ */
+static void RTC_heap_down(int32_t index) {
+    rtc_timer_t* timer = RTC_timer_heap[index];
+    int32_t child;
+    while ((child = 2 * index + 1) < RTC_timer_num) {
+        if (child + 1 < RTC_timer_num &&
+            RTC_before(RTC_timer_heap[child + 1]->deadline, RTC_timer_heap[child]->deadline))
+            child++;
+        if (!RTC_before(RTC_timer_heap[child]->deadline, timer->deadline))
+            break;
+        RTC_heap_set(index, RTC_timer_heap[child]);
+        index = child;
     }
-    GUI_counter = (max_freq / 2);
+    RTC_heap_set(index, timer);
 }
 
+/* RTC_heap_remove - take a timer out of the heap
+ * Inputs: timer - a timer in the heap
+ * Outputs: none
+ * Side Effects: must be called with interrupts disabled
+ */
+static void RTC_heap_remove(rtc_timer_t* timer) {
+    int32_t index = timer->heap_index;
+    rtc_timer_t* last;
+    timer->heap_index = -1;
+    if (--RTC_timer_num == index) return;
+    // the last timer fills the hole, then goes whichever way its deadline asks for
+    last = RTC_timer_heap[RTC_timer_num];
+    RTC_heap_set(index, last);
+    RTC_heap_up(index);
+    RTC_heap_down(last->heap_index);
+}
+
+/* RTC_timer_of - find the virtual RTC of a file descriptor of the current process
+ * Inputs: fd - file descriptor
+ * Outputs: the timer
+ */
+static rtc_timer_t* RTC_timer_of(int32_t fd) {
+    return &RTC_timers[get_current_pid() * NUM_FILES + fd];
+}
+
+/* RTC_timer_reset - start a new period of a virtual RTC
+ * Inputs: timer - the timer
+ *         freq - virtual interrupts per second, a power of 2 up to RTC_TIME_HZ
+ * Outputs: none
+ * Side Effects: must be called with interrupts disabled
+ */
+static void RTC_timer_reset(rtc_timer_t* timer, int32_t freq) {
+    timer->period = RTC_TIME_HZ / freq;
+    timer->deadline = RTC_time + timer->period;
+    timer->heap_index = -1;
+}
 
 /* __intr_RTC_handler - Real-Time Clock (RTC) Interrupt Handler
  * 
@@ -127,27 +166,28 @@ void set_RTC_freq(void) {
  * 
  * Inputs: None (Triggered by RTC interrupt)
  * Outputs: None (Handles interrupt side effects)
- * Side Effects: Increments rtc_time_counter. Acknowledges RTC interrupt by reading from register C.
- *               Sends EOI to the RTC IRQ. Potentially triggers other interrupt handlers through the
- *               test_interrupts() function.
+ * Side Effects: Advances RTC_time and wakes the readers whose deadline passed. Acknowledges RTC interrupt
+ *               by reading from register C. Sends EOI to the RTC IRQ. Raises the GUI softirq, which
+ *               repaints the screen once the handler is done.
  */
 void __intr_RTC_handler(void) {
     send_eoi(RTC_IRQ);
-    int32_t pid;
-    /* update each process's counter */
-    for (pid = 0; pid < MAX_PROC_NUM; ++pid) {
-            RTC_proc_list[pid].proc_count --;
+    rtc_timer_t* timer;
+    RTC_time += RTC_TIME_HZ / max_freq;
+    /* wake the readers whose deadline has passed, the earliest one is at the root */
+    while (RTC_timer_num > 0 && !RTC_before(RTC_time, RTC_timer_heap[0]->deadline)) {
+        timer = RTC_timer_heap[0];
+        RTC_heap_remove(timer);
+        sched_wake(timer);
     }
-    get_date();
-    fill_terminal();
-    /*if(--GUI_counter == 0) {
-        fill_terminal();
-        GUI_counter = (max_freq / 2);
+    /* the screen is repainted after the interrupt is acknowledged, with interrupts enabled */
+    if (RTC_time / RTC_TIME_HZ != (RTC_time - RTC_TIME_HZ / max_freq) / RTC_TIME_HZ) {
+        gui_clock_tick();
     }
-    sti();*/
+    softirq_raise(SOFTIRQ_GUI);
     outb(RTC_C &0x0F, RTC_PORT); // select register C
     inb(RTC_CMOS_PORT);		    // just throw away contents
-
+    do_softirq();
 }
 
 /* 
@@ -173,6 +213,9 @@ int32_t RTC_open(const uint8_t* fd) {
             cur_fd->inode_index = 0;
             cur_fd->file_position = 0;
             cur_fd->flags = IN_USE;
+            cli();
+            RTC_timer_reset(RTC_timer_of(i), RTC_OPEN_FREQ);
+            sti();
             return i;
         }
     }
@@ -200,6 +243,10 @@ int32_t RTC_close(int32_t fd) {
 
     /* free that file descriptor if every thing all right */
     cur_fd->flags = READY_TO_BE_USED;
+    cli();
+    if(RTC_timer_of(fd)->heap_index != -1)
+        RTC_heap_remove(RTC_timer_of(fd));
+    sti();
     return 0;
 }
 
@@ -216,16 +263,20 @@ int32_t RTC_close(int32_t fd) {
  */
 int32_t RTC_read(int32_t fd, void* buf, int32_t nbytes) {
     /* if proc_id out of boundary, read fails */
-    if(fd < 2 || fd >= MAX_PROC_NUM) return -1;
+    if(fd < 2 || fd >= NUM_FILES) return -1;
 
-    /* virtualization: wait counter reaches zero */
-    int32_t proc_id = get_current_pid();
-    while(RTC_proc_list[proc_id].proc_count > 0);
-    /* reset counter */
+    /* virtualization: sleep in the deadline heap until the interrupt handler pops us */
+    rtc_timer_t* timer = RTC_timer_of(fd);
     cli();
-    if(RTC_proc_list[proc_id].proc_freq)
-        RTC_proc_list[proc_id].proc_count = max_freq / RTC_proc_list[proc_id].proc_freq;
-        RTC_proc_list[proc_id].proc_count = max_freq / RTC_proc_list[proc_id].proc_freq;
+    while(RTC_before(RTC_time, timer->deadline)) {
+        if(timer->heap_index == -1) {
+            RTC_heap_set(RTC_timer_num++, timer);
+            RTC_heap_up(timer->heap_index);
+        }
+        sched_sleep(timer);
+    }
+    /* the next period starts now */
+    timer->deadline = RTC_time + timer->period;
     sti();
     return 0;
 }
@@ -244,28 +295,21 @@ int32_t RTC_read(int32_t fd, void* buf, int32_t nbytes) {
 int32_t RTC_write(int32_t fd, const void* buf, int32_t nbytes) {
     int32_t freq;
     /* if buf is NULL or proc_id out of boundary, write fails */
-    if(fd < 2 || fd >= MAX_PROC_NUM || buf == NULL) return -1;
+    if(fd < 2 || fd >= NUM_FILES || buf == NULL) return -1;
     
     freq = *(int32_t*) buf;
     if(freq <= 0) return -1;
     /* ensuring freq is a power of 2 and within acceptable limits */
-    if(!(freq && !(freq & (freq - 1))) || freq > 1024) {
+    if(!(freq && !(freq & (freq - 1))) || freq > RTC_TIME_HZ) {
         return -1;
     }
-    /* adjusts the freq */
-    int32_t proc_id = get_current_pid();
+    /* adjusts the freq, the hardware runs at the highest frequency asked for */
     cli();
-    RTC_proc_list[proc_id].proc_freq = freq;
-    if(freq > max_freq) {
-        max_freq = freq;
-        set_RTC_freq();
-    }
-    RTC_proc_list[proc_id].proc_count = max_freq / freq;
     if(freq > max_freq) {
         max_freq = freq;
         set_RTC_freq();
     }
-    RTC_proc_list[proc_id].proc_count = max_freq / freq;
+    RTC_timer_reset(RTC_timer_of(fd), freq);
     sti();
     return 0;
 }
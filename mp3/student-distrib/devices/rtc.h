@@ -19,8 +19,14 @@
 #define RTC_BASE_FREQ    1024
 #define RTC_BASE_RATE    6
 
-/* maximum number of processes */
-#define MAX_PROC_NUM    8
+/* rate written to register A is RTC_RATE_BASE - log2(frequency) */
+#define RTC_RATE_BASE    16
+
+/* virtual RTCs count time in 1/RTC_TIME_HZ seconds, the highest frequency a process may ask for */
+#define RTC_TIME_HZ      RTC_BASE_FREQ
+
+/* frequency of a freshly opened rtc file */
+#define RTC_OPEN_FREQ    2
 
 /* Initialize the rtc */
 void RTC_init(void);
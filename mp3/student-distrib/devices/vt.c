@@ -3,13 +3,23 @@
 
 #include "vt.h"
 #include "../signal.h"
+#include "../scheduler.h"
 
 static int32_t VIDEO = 0xB8000;
 #define FOUR_KB     0x1000
-#define VID_BUF_SIZE (80 * 25 * 2)
 #define NUM_COLS    80
 #define NUM_ROWS    25
 #define ATTRIB      0x7
+#define ROW_SIZE    (NUM_COLS * 2)
+/* every terminal owns a text surface taller than the screen, the screen is a window sliding down it */
+#define SURFACE_SIZE (2 * FOUR_KB)
+#define SURFACE_ROWS (SURFACE_SIZE / ROW_SIZE)
+/* the page after the surfaces shows a terminal scrolled back into its history */
+#define SCROLL_VIEW ((char*)VIDEO + NUM_TERMS * SURFACE_SIZE)
+#define CRTC_ADDR_PORT  0x3D4
+#define CRTC_DATA_PORT  0x3D5
+#define CRTC_START_HIGH 0x0C
+#define CRTC_START_LOW  0x0D
 
 static int32_t gui_activated = 0;
 
@@ -55,6 +65,39 @@ int cur_vt = 0;
 int foreground_vt = 0;
 
 static void redraw_cursor(int term_idx);
+static void set_display_start(int term_idx);
+static void print_newline(int term_idx);
+static void print_backspace(int term_idx);
+static void shift_rows_up(int term_idx, int top, int bottom, int n);
+static inline int is_printable(char c);
+static void write_run(int term_idx, const char* run, int n);
+static void escape_feed(int term_idx, char c);
+
+/* vt_mark_dirty (PRIVATE)
+ *   DESCRIPTION: tell the GUI compositor that a row of a terminal changed,
+ *                only the foreground terminal is on the screen
+ *   INPUTS: term_idx -- the terminal written
+ *           row -- the row written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static inline void vt_mark_dirty(int term_idx, int row) {
+    if (gui_activated && term_idx == foreground_vt)
+        gui_mark_row_dirty(row);
+}
+
+/* vt_mark_screen_dirty (PRIVATE)
+ *   DESCRIPTION: tell the GUI compositor that every row of a terminal changed
+ *   INPUTS: term_idx -- the terminal written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static inline void vt_mark_screen_dirty(int term_idx) {
+    if (gui_activated && term_idx == foreground_vt)
+        gui_mark_all_dirty();
+}
 
 /* vt_init
  *   DESCRIPTION: Initialize virtual terminal.
@@ -69,21 +112,47 @@ void vt_init(void) {
     for (i = 0; i < NUM_TERMS; i++) {
         vt_state[i].screen_x = 0;
         vt_state[i].screen_y = 0;
-        vt_state[i].video_mem = (char*)(VIDEO + (i + 1) * FOUR_KB);
+        vt_state[i].surface = (char*)(VIDEO + i * SURFACE_SIZE);
+        vt_state[i].video_mem = vt_state[i].surface;
+        vt_state[i].top_row = 0;
+        vt_state[i].vidmap_users = 0;
+        vt_state[i].scrollback = NULL;
+        vt_state[i].sb_head = 0;
+        vt_state[i].sb_count = 0;
+        vt_state[i].scroll_offset = 0;
+        vt_state[i].esc_state = ESC_NONE;
+        vt_state[i].scroll_top = 0;
+        vt_state[i].scroll_bottom = NUM_ROWS - 1;
         vt_state[i].kbd.shift = 0;
         vt_state[i].kbd.caps = 0;
         vt_state[i].kbd.ctrl = 0;
         vt_state[i].kbd.alt = 0;
         vt_state[i].input_buf_ptr = 0;
-        vt_state[i].enter_pressed = 0;
+        vt_state[i].kbd_head = 0;
+        vt_state[i].kbd_tail = 0;
+        vt_state[i].lines_in = 0;
+        vt_state[i].lines_out = 0;
         vt_state[i].active_pid = -1;
-        vt_state[i].halt_pending = 0;
         vt_state[i].raw = 0;
         vt_state[i].attrib = ATTRIB;
         vt_state[i].cur_cmd_idx = 0;
         vt_state[i].cur_cmd_cnt = 0;
     }
-    vt_state[0].video_mem = (char*)VIDEO;
+    set_display_start(foreground_vt);
+}
+
+/* vt_scrollback_init
+ *   DESCRIPTION: give every terminal its scrollback ring, called once the kernel heap works
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: a terminal without memory for the ring keeps no history
+ */
+void vt_scrollback_init(void) {
+    int i;
+    for (i = 0; i < NUM_TERMS; i++) {
+        vt_state[i].scrollback = malloc(SCROLLBACK_LINES * sizeof(scrollback_line_t));
+    }
 }
 
 /* vt_open
@@ -110,27 +179,80 @@ int32_t vt_close(int32_t id) {                              // return 0 as requi
     return 0;
 }
 
-static int32_t vt_read_raw(void* buf, int32_t nbytes) {
-    while (vt_state[cur_vt].input_buf_ptr == 0);
-    cli();
+/* kbd_ring_put (PRIVATE)
+ *   DESCRIPTION: append bytes to the input ring of a terminal, called by the keyboard handler only
+ *   INPUTS: term_idx -- the terminal typed on
+ *           data -- bytes to append
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the bytes were added, 0 if they do not all fit and nothing was added
+ *   SIDE EFFECTS: publishes the bytes to the reader only after they are stored
+ */
+static int kbd_ring_put(int term_idx, const char* data, int n) {
+    vt_state_t* vt = &vt_state[term_idx];
+    uint32_t head = vt->kbd_head;
     int i;
-    for (i = 0; i < nbytes && i < vt_state[cur_vt].input_buf_ptr; i++) {
-        ((char*)buf)[i] = vt_state[cur_vt].input_buf[i];
+    if (KBD_RING_SIZE - (head - vt->kbd_tail) < (uint32_t)n)
+        return 0;
+    for (i = 0; i < n; i++) {
+        vt->kbd_ring[(head + i) & KBD_RING_MASK] = data[i];
     }
-    memcpy(vt_state[cur_vt].input_buf, &vt_state[cur_vt].input_buf[i], vt_state[cur_vt].input_buf_ptr - i);
-    vt_state[cur_vt].input_buf_ptr -= i;
+    asm volatile("" ::: "memory"); // the bytes have to be in the ring before the reader can see the new head
+    vt->kbd_head = head + n;
+    return 1;
+}
+
+/* vt_reader_waits (PRIVATE)
+ *   DESCRIPTION: Check if the running process has to keep sleeping in a read of its terminal,
+ *                only the foreground process takes input, background jobs wait until they are the active pid
+ *   INPUTS: vt -- the terminal of the running process
+ *           ready -- 1 if the terminal has input the read could return
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the caller should sleep on the terminal, 0 if it may take the input
+ *   SIDE EFFECTS: none
+ */
+static int32_t vt_reader_waits(vt_state_t* vt, int32_t ready) {
+    return !ready || vt->active_pid != get_current_pcb()->pid;
+}
+
+/* vt_read_raw (PRIVATE)
+ *   DESCRIPTION: Read keycodes in raw mode, sleeps until there is at least one
+ *   INPUTS: buf -- buffer to read into
+ *           nbytes -- number of bytes to read
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of keycodes read, every key buffered so far up to nbytes
+ *   SIDE EFFECTS: none
+ */
+static int32_t vt_read_raw(void* buf, int32_t nbytes) {
+    vt_state_t* vt = &vt_state[cur_vt];
+    uint32_t head, tail;
+    int i;
+
+    // interrupts stay off only while checking, so the wake up cannot come between the check and the sleep
+    cli();
+    while (vt_reader_waits(vt, vt->kbd_head != vt->kbd_tail))
+        sched_sleep(vt); // woken by the next key event or a new active pid
     sti();
+
+    head = vt->kbd_head;
+    tail = vt->kbd_tail;
+    for (i = 0; i < nbytes && tail != head; i++, tail++) {
+        ((char*)buf)[i] = vt->kbd_ring[tail & KBD_RING_MASK];
+    }
+    asm volatile("" ::: "memory"); // done with the slots before handing them back to the keyboard handler
+    vt->kbd_tail = tail;
     return i;
 }
 
 /* vt_read
  *   DESCRIPTION: Read from virtual terminal.
+ *                Returns one line at most, lines typed ahead wait in the ring for the next calls.
  *   INPUTS: fd -- should be 0, which is stdin
  *           buf -- buffer to read into
  *           nbytes -- number of bytes to read
  *   OUTPUTS: none
  *   RETURN VALUE: number of bytes read
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: sleeps until a whole line is typed, and as long as the caller runs in the background
  */
 int32_t vt_read(int32_t fd, void* buf, int32_t nbytes) {
     if (buf == NULL || nbytes < 0 || fd != 0)
@@ -138,24 +260,31 @@ int32_t vt_read(int32_t fd, void* buf, int32_t nbytes) {
 
     if (vt_state[cur_vt].raw)
         return vt_read_raw(buf, nbytes);
-    cli();
-    vt_state[cur_vt].input_buf_ptr = 0;
-    sti();
-    // Wait for enter key
-    while (!vt_state[cur_vt].enter_pressed);
-
-    // Critical section should be enforced to prevent interrupt from modifying user_buf
-    // This is highly unlikely (since human input is pretty slow) but still possible
-    cli();
-    vt_state[cur_vt].enter_pressed = 0;
 
-    // Copy user buffer to buf
+    vt_state_t* vt = &vt_state[cur_vt];
+    uint32_t tail;
     int i;
-    for (i = 0; i < nbytes && i < vt_state[cur_vt].nbytes_read; i++) {
-        ((char*)buf)[i] = vt_state[cur_vt].user_buf[i];
-    }
+    char c;
+
+    cli();
+    while (vt_reader_waits(vt, vt->lines_in != vt->lines_out))
+        sched_sleep(vt); // woken by the enter key or a new active pid
     sti();
 
+    // there is a '\n' before the head, the rest of a line longer than nbytes is left for the next read
+    tail = vt->kbd_tail;
+    for (i = 0; i < nbytes; i++, tail++) {
+        c = vt->kbd_ring[tail & KBD_RING_MASK];
+        ((char*)buf)[i] = c;
+        if (c == '\n') {
+            i++;
+            tail++;
+            vt->lines_out++;
+            break;
+        }
+    }
+    asm volatile("" ::: "memory");
+    vt->kbd_tail = tail;
     return i;
 }
 
@@ -173,89 +302,447 @@ int32_t vt_read(int32_t fd, void* buf, int32_t nbytes) {
 int32_t vt_write(int32_t fd, const void* buf, int32_t nbytes) {
     if (buf == NULL || nbytes < 0 || fd != 1)
         return -1;
-    int i;
+    int i, run;
+    char c;
+    unsigned long flags;
     for (i = 0; i < nbytes; i++) {
-        if (vt_state[cur_vt].raw && ((char*)buf)[i] == '\x1b' && ((char*)buf)[i+1] == '[') {
-            char * video_mem = vt_state[cur_vt].video_mem;
-            char attrib = vt_state[cur_vt].attrib;
-            if (strncmp(((char*)buf) + i, "\x1b[2J", 4) == 0) {
-                int x, y;
-                for (y = 0; y < NUM_ROWS; y++) {
-                    for (x = 0; x < NUM_COLS; x++) {
-                        *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1)) = ' ';
-                        *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1) + 1) = attrib;
-                    }
-                }
-                i += 3;
-                continue;
-            }
-            if (strncmp(((char*)buf) + i, "\x1b[H", 3) == 0) {
-                vt_state[cur_vt].screen_x = 0;
-                vt_state[cur_vt].screen_y = 0;
-                redraw_cursor(cur_vt);
-                i += 2;
-                continue;
-            }
-            if (strncmp(((char*)buf) + i, "\x1b[K", 3) == 0) {
-                int x;
-                for (x = vt_state[cur_vt].screen_x; x < NUM_COLS; x++) {
-                    *(uint8_t *)(video_mem + ((NUM_COLS * vt_state[cur_vt].screen_y + x) << 1)) = ' ';
-                    *(uint8_t *)(video_mem + ((NUM_COLS * vt_state[cur_vt].screen_y + x) << 1) + 1) = attrib;
-                }
-                i += 2;
-                continue;
-            }
-            if (((char*)buf)[i+7] == 'H' && ((char*)buf)[i+4] == ';') {
-                int screen_y = atoi(((char*)buf)[i+2]) * 10 + atoi(((char*)buf)[i+3]);
-                int screen_x = atoi(((char*)buf)[i+5]) * 10 + atoi(((char*)buf)[i+6]);
-                if (screen_y >= 0 && screen_y < NUM_ROWS && screen_x >= 0 && screen_x < NUM_COLS) {
-                    vt_state[cur_vt].screen_y = screen_y;
-                    vt_state[cur_vt].screen_x = screen_x;
-                }
-                redraw_cursor(cur_vt);
-                i += 7;
-                continue;
-            }
-            if (((char *)buf)[i+7] == 'M' && ((char *)buf)[i+4] == ';') {
-                char foreground, background;
-                if (((char *)buf)[i+2] == '3') {
-                    foreground = atoi(((char *)buf)[i+3]);
-                } else {
-                    foreground = atoi(((char *)buf)[i+3]) + 8;
-                }
-                if (((char *)buf)[i+5] == '4') {
-                    background = atoi(((char *)buf)[i+6]);
-                } else {
-                    background = atoi(((char *)buf)[i+6]) + 8;
-                }
-                vt_state[cur_vt].attrib = (background << 4) | foreground;
-                i += 7;
-                continue;
-            }
+        // escape sequences are interpreted in raw mode, they may be split across writes
+        if (vt_state[cur_vt].esc_state != ESC_NONE || (vt_state[cur_vt].raw && ((char*)buf)[i] == '\x1b')) {
+            cli_and_save(flags);
+            escape_feed(cur_vt, ((char*)buf)[i]);
+            restore_flags(flags);
+            continue;
+        }
+        c = ((char*)buf)[i];
+        cli_and_save(flags);
+        if (c == '\n' || c == '\r') {
+            print_newline(cur_vt);
+        } else if (c == '\b') {
+            print_backspace(cur_vt);
+        } else if (c != '\0') {
+            // copy everything up to the next control character in one go
+            for (run = i + 1; run < nbytes && is_printable(((char*)buf)[run]); run++);
+            write_run(cur_vt, ((char*)buf) + i, run - i);
+            i = run - 1;
         }
-        vt_putc(((char*)buf)[i], 0);
+        restore_flags(flags);
     }
+    redraw_cursor(cur_vt);
     return i;
 }
 
+/* is_printable (PRIVATE)
+ *   DESCRIPTION: tell whether vt_write copies a character to the screen as it is
+ *   INPUTS: c -- the character
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 for the characters vt_write has to interpret, 1 otherwise
+ *   SIDE EFFECTS: none
+ */
+static inline int is_printable(char c) {
+    return c != '\0' && c != '\n' && c != '\r' && c != '\b' && c != '\x1b';
+}
+
+/* write_run (PRIVATE)
+ *   DESCRIPTION: copy a run of printable characters to the screen, wrapping and scrolling
+ *                once per row instead of once per character
+ *   INPUTS: term_idx -- the terminal to write
+ *           run -- the characters
+ *           n -- number of characters
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: video memory is modified, must be called with interrupts disabled,
+ *                 the cursor is left for the caller to redraw
+ */
+static void write_run(int term_idx, const char* run, int n) {
+    char attrib = vt_state[term_idx].attrib;
+    char * cell;
+    int count, i;
+    while (n > 0) {
+        count = NUM_COLS - vt_state[term_idx].screen_x;
+        if (count > n)
+            count = n;
+        cell = vt_state[term_idx].video_mem + ((NUM_COLS * vt_state[term_idx].screen_y + vt_state[term_idx].screen_x) << 1);
+        for (i = 0; i < count; i++) {
+            cell[i << 1] = run[i];
+            cell[(i << 1) + 1] = attrib;
+        }
+        vt_mark_dirty(term_idx, vt_state[term_idx].screen_y);
+        vt_state[term_idx].screen_x += count;
+        run += count;
+        n -= count;
+        if (vt_state[term_idx].screen_x >= NUM_COLS)
+            print_newline(term_idx);
+    }
+}
+
+/* scrollback_push (PRIVATE)
+ *   DESCRIPTION: save the top row of the screen to the scrollback ring before it scrolls off
+ *   INPUTS: term_idx -- the terminal about to scroll
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the oldest line is dropped once the ring is full
+ */
+static void scrollback_push(int term_idx) {
+    scrollback_line_t* line;
+    char * video_mem = vt_state[term_idx].video_mem;
+    uint8_t attrib;
+    int x;
+    if (vt_state[term_idx].scrollback == NULL)
+        return;
+    line = &vt_state[term_idx].scrollback[vt_state[term_idx].sb_head];
+    line->run_num = 0;
+    for (x = 0; x < NUM_COLS; x++) {
+        line->text[x] = video_mem[x << 1];
+        attrib = video_mem[(x << 1) + 1];
+        if (line->run_num == 0 || (attrib != line->run_attrib[line->run_num - 1] && line->run_num < SCROLLBACK_RUNS)) {
+            line->run_attrib[line->run_num++] = attrib;
+        }
+        line->run_end[line->run_num - 1] = x + 1;
+    }
+    vt_state[term_idx].sb_head = (vt_state[term_idx].sb_head + 1) % SCROLLBACK_LINES;
+    if (vt_state[term_idx].sb_count < SCROLLBACK_LINES)
+        vt_state[term_idx].sb_count++;
+    // a view scrolled back keeps showing the same lines
+    if (vt_state[term_idx].scroll_offset != 0 && vt_state[term_idx].scroll_offset < vt_state[term_idx].sb_count)
+        vt_state[term_idx].scroll_offset++;
+}
+
+/* scrollback_render (PRIVATE)
+ *   DESCRIPTION: draw the screen as it was scroll_offset lines ago into the view page,
+ *                lines still on the screen are copied a row at a time
+ *   INPUTS: term_idx -- the terminal scrolled back
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the view page is modified
+ */
+static void scrollback_render(int term_idx) {
+    char * view = SCROLL_VIEW;
+    int offset = vt_state[term_idx].scroll_offset;
+    scrollback_line_t* line;
+    int x, y, run;
+    for (y = 0; y < NUM_ROWS; y++) {
+        if (y >= offset) {
+            memcpy(view + ROW_SIZE * y, vt_state[term_idx].video_mem + ROW_SIZE * (y - offset), ROW_SIZE);
+            continue;
+        }
+        line = &vt_state[term_idx].scrollback[(vt_state[term_idx].sb_head - offset + y + SCROLLBACK_LINES) % SCROLLBACK_LINES];
+        x = 0;
+        for (run = 0; run < line->run_num; run++) {
+            for (; x < line->run_end[run]; x++) {
+                view[ROW_SIZE * y + (x << 1)] = line->text[x];
+                view[ROW_SIZE * y + (x << 1) + 1] = line->run_attrib[run];
+            }
+        }
+    }
+}
+
+/* scroll_view (PRIVATE)
+ *   DESCRIPTION: move the view of a terminal through its history
+ *   INPUTS: term_idx -- the terminal
+ *           lines -- how many lines further back to look, negative to come forward
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the live screen is shown again once the offset is back at 0
+ */
+static void scroll_view(int term_idx, int lines) {
+    int offset = vt_state[term_idx].scroll_offset + lines;
+    if (offset < 0)
+        offset = 0;
+    if (offset > vt_state[term_idx].sb_count)
+        offset = vt_state[term_idx].sb_count;
+    if (offset == vt_state[term_idx].scroll_offset)
+        return;
+    vt_state[term_idx].scroll_offset = offset;
+    if (offset != 0)
+        scrollback_render(term_idx);
+    set_display_start(term_idx);
+    vt_mark_screen_dirty(term_idx);
+}
+
 /* scroll_page (PRIVATE)
- *   DESCRIPTION: Scroll the screen up by one line.
- *   INPUTS: none
+ *   DESCRIPTION: Scroll the screen up by one line. The screen window moves one row down
+ *                its surface, rows are only copied when the window reaches the end of the
+ *                surface, or while a program maps the screen and needs it at the top.
+ *   INPUTS: term_idx -- the terminal to scroll
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: video memory is modified
+ *   SIDE EFFECTS: video memory is modified, the foreground terminal moves the CRTC start address
  */
 static void scroll_page(int term_idx) {
-    char * video_mem = vt_state[term_idx].video_mem;
+    char * surface = vt_state[term_idx].surface;
     char attrib = vt_state[term_idx].attrib;
     int i;
-    for (i = 0; i < NUM_ROWS - 1; i++) {
-        memcpy(video_mem + ((NUM_COLS * i) * 2), video_mem + ((NUM_COLS * (i + 1)) * 2), NUM_COLS * 2 * sizeof(char));
+    scrollback_push(term_idx);
+    if (vt_state[term_idx].vidmap_users == 0 && vt_state[term_idx].top_row + NUM_ROWS < SURFACE_ROWS) {
+        vt_state[term_idx].top_row++;
+    } else {
+        for (i = 0; i < NUM_ROWS - 1; i++) {
+            memcpy(surface + ROW_SIZE * i, vt_state[term_idx].video_mem + ROW_SIZE * (i + 1), ROW_SIZE);
+        }
+        vt_state[term_idx].top_row = 0;
     }
+    vt_state[term_idx].video_mem = surface + ROW_SIZE * vt_state[term_idx].top_row;
+    char * video_mem = vt_state[term_idx].video_mem;
     for (i = 0; i < NUM_COLS; i++) {
         *(uint8_t *)(video_mem + ((NUM_COLS * (NUM_ROWS - 1) + i) << 1)) = ' ';
         *(uint8_t *)(video_mem + ((NUM_COLS * (NUM_ROWS - 1) + i) << 1) + 1) = attrib;
     }
+    set_display_start(term_idx);
+    vt_mark_screen_dirty(term_idx);
+}
+
+/* clear_cells (PRIVATE)
+ *   DESCRIPTION: blank part of a row with the current attribute
+ *   INPUTS: term_idx -- the terminal to write
+ *           y -- the row
+ *           x0, x1 -- first and last column to blank
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: video memory is modified
+ */
+static void clear_cells(int term_idx, int y, int x0, int x1) {
+    char * video_mem = vt_state[term_idx].video_mem;
+    char attrib = vt_state[term_idx].attrib;
+    int x;
+    for (x = x0; x <= x1; x++) {
+        *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1)) = ' ';
+        *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1) + 1) = attrib;
+    }
+    vt_mark_dirty(term_idx, y);
+}
+
+/* shift_rows_up (PRIVATE)
+ *   DESCRIPTION: move rows top + n to bottom up by n rows and blank the n rows left at the bottom,
+ *                used for scroll regions and deleting lines
+ *   INPUTS: term_idx -- the terminal to write
+ *           top, bottom -- first and last row of the region
+ *           n -- number of rows
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: video memory is modified
+ */
+static void shift_rows_up(int term_idx, int top, int bottom, int n) {
+    char * video_mem = vt_state[term_idx].video_mem;
+    int y;
+    if (n > bottom - top + 1)
+        n = bottom - top + 1;
+    for (y = top; y + n <= bottom; y++) {
+        memcpy(video_mem + ROW_SIZE * y, video_mem + ROW_SIZE * (y + n), ROW_SIZE);
+        vt_mark_dirty(term_idx, y);
+    }
+    for (; y <= bottom; y++)
+        clear_cells(term_idx, y, 0, NUM_COLS - 1);
+}
+
+/* shift_rows_down (PRIVATE)
+ *   DESCRIPTION: move rows top to bottom - n down by n rows and blank the n rows left at the top,
+ *                used for inserting lines
+ *   INPUTS: term_idx -- the terminal to write
+ *           top, bottom -- first and last row of the region
+ *           n -- number of rows
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: video memory is modified
+ */
+static void shift_rows_down(int term_idx, int top, int bottom, int n) {
+    char * video_mem = vt_state[term_idx].video_mem;
+    int y;
+    if (n > bottom - top + 1)
+        n = bottom - top + 1;
+    for (y = bottom; y - n >= top; y--) {
+        memcpy(video_mem + ROW_SIZE * y, video_mem + ROW_SIZE * (y - n), ROW_SIZE);
+        vt_mark_dirty(term_idx, y);
+    }
+    for (; y >= top; y--)
+        clear_cells(term_idx, y, 0, NUM_COLS - 1);
+}
+
+/* escape_param (PRIVATE)
+ *   DESCRIPTION: get a parameter of the escape sequence being parsed
+ *   INPUTS: term_idx -- the terminal
+ *           k -- index of the parameter
+ *           def -- value of a missing parameter
+ *   OUTPUTS: none
+ *   RETURN VALUE: the parameter
+ *   SIDE EFFECTS: none
+ */
+static int escape_param(int term_idx, int k, int def) {
+    if (k >= vt_state[term_idx].esc_param_num)
+        return def;
+    return vt_state[term_idx].esc_params[k];
+}
+
+/* escape_count (PRIVATE)
+ *   DESCRIPTION: get a count parameter, a missing or 0 count means 1
+ */
+static int escape_count(int term_idx, int k) {
+    int n = escape_param(term_idx, k, 1);
+    return (n == 0) ? 1 : n;
+}
+
+/* escape_color (PRIVATE)
+ *   DESCRIPTION: apply one select graphic rendition parameter, the digit is the VGA color,
+ *                30-37/40-47 pick a normal foreground/background, 90-97/100-107 a bright one
+ *   INPUTS: term_idx -- the terminal
+ *           p -- the parameter
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the attribute of the following characters
+ */
+static void escape_color(int term_idx, int p) {
+    int8_t attrib = vt_state[term_idx].attrib;
+    if (p == 0)
+        attrib = ATTRIB;
+    else if (p >= 30 && p <= 37)
+        attrib = (attrib & 0xF0) | (p - 30);
+    else if (p >= 90 && p <= 97)
+        attrib = (attrib & 0xF0) | (p - 90 + 8);
+    else if (p >= 40 && p <= 47)
+        attrib = (attrib & 0x0F) | ((p - 40) << 4);
+    else if (p >= 100 && p <= 107)
+        attrib = (attrib & 0x0F) | ((p - 100 + 8) << 4);
+    vt_state[term_idx].attrib = attrib;
+}
+
+/* escape_execute (PRIVATE)
+ *   DESCRIPTION: run a complete control sequence. Rows and columns are counted from 0.
+ *                ESC[<r>;<c>H  move the cursor          ESC[<n>A/B/C/D  move up/down/right/left
+ *                ESC[<m>J      erase in display, m = 0 to the end, 1 from the start, 2 all
+ *                ESC[<m>K      erase in line, same m    ESC[<t>;<b>r    set the scroll region
+ *                ESC[<n>L      insert lines             ESC[<n>M        delete lines
+ *                ESC[<p>;..m   set colors, ESC[<fg>;<bg>M with two parameters as well
+ *   INPUTS: term_idx -- the terminal
+ *           final -- the character ending the sequence
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: video memory may be modified
+ */
+static void escape_execute(int term_idx, char final) {
+    vt_state_t* vt = &vt_state[term_idx];
+    int k, y, mode;
+    switch (final) {
+        case 'A':
+            vt->screen_y -= escape_count(term_idx, 0);
+            break;
+        case 'B':
+            vt->screen_y += escape_count(term_idx, 0);
+            break;
+        case 'C':
+            vt->screen_x += escape_count(term_idx, 0);
+            break;
+        case 'D':
+            vt->screen_x -= escape_count(term_idx, 0);
+            break;
+        case 'H':
+        case 'f':
+            vt->screen_y = escape_param(term_idx, 0, 0);
+            vt->screen_x = escape_param(term_idx, 1, 0);
+            break;
+        case 'J':
+            mode = escape_param(term_idx, 0, 0);
+            for (y = 0; y < NUM_ROWS; y++) {
+                if ((mode == 0 && y > vt->screen_y) || (mode == 1 && y < vt->screen_y) || mode == 2)
+                    clear_cells(term_idx, y, 0, NUM_COLS - 1);
+            }
+            if (mode == 0)
+                clear_cells(term_idx, vt->screen_y, vt->screen_x, NUM_COLS - 1);
+            else if (mode == 1)
+                clear_cells(term_idx, vt->screen_y, 0, vt->screen_x);
+            break;
+        case 'K':
+            mode = escape_param(term_idx, 0, 0);
+            if (mode == 0)
+                clear_cells(term_idx, vt->screen_y, vt->screen_x, NUM_COLS - 1);
+            else if (mode == 1)
+                clear_cells(term_idx, vt->screen_y, 0, vt->screen_x);
+            else if (mode == 2)
+                clear_cells(term_idx, vt->screen_y, 0, NUM_COLS - 1);
+            break;
+        case 'r':
+            vt->scroll_top = escape_param(term_idx, 0, 0);
+            vt->scroll_bottom = escape_param(term_idx, 1, NUM_ROWS - 1);
+            if (vt->scroll_top < 0 || vt->scroll_bottom >= NUM_ROWS || vt->scroll_top >= vt->scroll_bottom) {
+                vt->scroll_top = 0;
+                vt->scroll_bottom = NUM_ROWS - 1;
+            }
+            vt->screen_x = 0;
+            vt->screen_y = vt->scroll_top;
+            break;
+        case 'L':
+            if (vt->screen_y >= vt->scroll_top && vt->screen_y <= vt->scroll_bottom)
+                shift_rows_down(term_idx, vt->screen_y, vt->scroll_bottom, escape_count(term_idx, 0));
+            break;
+        case 'M':
+            // two parameters is the color form programs of this kernel use
+            if (vt->esc_param_num == 2) {
+                escape_color(term_idx, escape_param(term_idx, 0, 0));
+                escape_color(term_idx, escape_param(term_idx, 1, 0));
+            } else if (vt->screen_y >= vt->scroll_top && vt->screen_y <= vt->scroll_bottom) {
+                shift_rows_up(term_idx, vt->screen_y, vt->scroll_bottom, escape_count(term_idx, 0));
+            }
+            break;
+        case 'm':
+            if (vt->esc_param_num == 0)
+                escape_color(term_idx, 0);
+            for (k = 0; k < vt->esc_param_num; k++)
+                escape_color(term_idx, vt->esc_params[k]);
+            break;
+        default:
+            break;
+    }
+    // keep the cursor on the screen
+    if (vt->screen_y < 0)
+        vt->screen_y = 0;
+    if (vt->screen_y >= NUM_ROWS)
+        vt->screen_y = NUM_ROWS - 1;
+    if (vt->screen_x < 0)
+        vt->screen_x = 0;
+    if (vt->screen_x >= NUM_COLS)
+        vt->screen_x = NUM_COLS - 1;
+}
+
+/* escape_feed (PRIVATE)
+ *   DESCRIPTION: run one character through the escape sequence parser of a terminal,
+ *                the parser state lives in the terminal so a sequence may end in a later write
+ *   INPUTS: term_idx -- the terminal
+ *           c -- the character
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+static void escape_feed(int term_idx, char c) {
+    vt_state_t* vt = &vt_state[term_idx];
+    switch (vt->esc_state) {
+        case ESC_NONE:
+            if (c == '\x1b')
+                vt->esc_state = ESC_SEEN;
+            break;
+        case ESC_SEEN:
+            // only control sequences are supported, anything else after ESC is dropped
+            vt->esc_state = (c == '[') ? ESC_CSI : ESC_NONE;
+            vt->esc_param_num = 0;
+            memset(vt->esc_params, 0, sizeof(vt->esc_params));
+            break;
+        case ESC_CSI:
+            if (c >= '0' && c <= '9') {
+                if (vt->esc_param_num == 0)
+                    vt->esc_param_num = 1;
+                if (vt->esc_params[vt->esc_param_num - 1] < ESC_PARAM_MAX)
+                    vt->esc_params[vt->esc_param_num - 1] = vt->esc_params[vt->esc_param_num - 1] * 10 + (c - '0');
+            } else if (c == ';') {
+                if (vt->esc_param_num == 0)
+                    vt->esc_param_num = 1;
+                if (vt->esc_param_num < ESC_PARAM_NUM)
+                    vt->esc_param_num++;
+            } else if (c >= 0x40 && c <= 0x7E) {
+                vt->esc_state = ESC_NONE;
+                escape_execute(term_idx, c);
+            } else if (c < 0x20 || c > 0x7E) {
+                vt->esc_state = ESC_NONE;   // broken sequence
+            }
+            // private markers and intermediate characters are ignored
+            break;
+    }
 }
 
 /* print_newline (PRIVATE)
@@ -266,11 +753,15 @@ static void scroll_page(int term_idx) {
  *   SIDE EFFECTS: video memory is modified if scrooling happens
  */
 static void print_newline(int term_idx) {
-    vt_state[term_idx].screen_y++;
     vt_state[term_idx].screen_x = 0;
-    if (vt_state[term_idx].screen_y >= NUM_ROWS) {
-        scroll_page(term_idx);
-        vt_state[term_idx].screen_y = NUM_ROWS - 1;
+    if (vt_state[term_idx].screen_y == vt_state[term_idx].scroll_bottom) {
+        // only a scroll of the whole screen slides the window and goes to the history
+        if (vt_state[term_idx].scroll_top == 0 && vt_state[term_idx].scroll_bottom == NUM_ROWS - 1)
+            scroll_page(term_idx);
+        else
+            shift_rows_up(term_idx, vt_state[term_idx].scroll_top, vt_state[term_idx].scroll_bottom, 1);
+    } else if (vt_state[term_idx].screen_y < NUM_ROWS - 1) {
+        vt_state[term_idx].screen_y++;
     }
 }
 
@@ -295,6 +786,7 @@ static void print_backspace(int term_idx) {
     }
     *(uint8_t *)(video_mem + ((NUM_COLS * vt_state[term_idx].screen_y + vt_state[term_idx].screen_x) << 1)) = ' ';
     *(uint8_t *)(video_mem + ((NUM_COLS * vt_state[term_idx].screen_y + vt_state[term_idx].screen_x) << 1) + 1) = attrib;
+    vt_mark_dirty(term_idx, vt_state[term_idx].screen_y);
 }
 
 /* redraw_cursor (PRIVATE)
@@ -308,7 +800,8 @@ static void redraw_cursor(int term_idx) {
     if (term_idx != foreground_vt) {
         return;
     }
-    uint16_t pos = vt_state[term_idx].screen_y * NUM_COLS + vt_state[term_idx].screen_x;
+    // the cursor location counts from the start of video memory, not from the start of the screen
+    uint16_t pos = (vt_state[term_idx].video_mem - (char*)VIDEO) / 2 + vt_state[term_idx].screen_y * NUM_COLS + vt_state[term_idx].screen_x;
 
 	outb(0x0F, 0x3D4);
 	outb((uint8_t) (pos & 0xFF), 0x3D5);
@@ -317,26 +810,98 @@ static void redraw_cursor(int term_idx) {
 }
 
 
+/* set_display_start (PRIVATE)
+ *   DESCRIPTION: point the VGA CRTC at the screen window of the foreground terminal
+ *   INPUTS: term_idx -- the terminal whose window moved
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none for a background terminal or once the GUI draws the screen
+ */
+static void set_display_start(int term_idx) {
+    if (term_idx != foreground_vt || gui_activated) {
+        return;
+    }
+    char * shown = vt_state[term_idx].scroll_offset ? SCROLL_VIEW : vt_state[term_idx].video_mem;
+    uint16_t start = (shown - (char*)VIDEO) / 2;
+
+    outb(CRTC_START_HIGH, CRTC_ADDR_PORT);
+    outb((uint8_t) ((start >> 8) & 0xFF), CRTC_DATA_PORT);
+    outb(CRTC_START_LOW, CRTC_ADDR_PORT);
+    outb((uint8_t) (start & 0xFF), CRTC_DATA_PORT);
+}
+
+/* vt_switch_term
+ *   DESCRIPTION: show another terminal, every terminal keeps its own surface in video memory
+ *                so only the display start address changes
+ *   INPUTS: term_idx -- the terminal to show
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
 void vt_switch_term(int32_t term_idx)
 {
-    memcpy((char *)(VIDEO + (foreground_vt + 1) * FOUR_KB), (char *)(VIDEO), VID_BUF_SIZE);
-    clear();
-    memcpy((char *)(VIDEO), (char *)(VIDEO + (term_idx + 1) * FOUR_KB), VID_BUF_SIZE);
-    vt_state[foreground_vt].video_mem = (char *)(VIDEO + (foreground_vt + 1) * FOUR_KB);
-    if (cur_vt == foreground_vt) {
-        vidmap_table[0].ADDR = (uint32_t)vt_state[cur_vt].video_mem >> 12; // Update the current vt vidmem 
-    }
-    vt_state[term_idx].video_mem = (char *)(VIDEO);
-    if (cur_vt == term_idx) {
-        vidmap_table[0].ADDR = (uint32_t)vt_state[cur_vt].video_mem >> 12; // Update the current vt vidmem 
-    }
+    vt_state[foreground_vt].scroll_offset = 0; // the view page is only used by the foreground terminal
     foreground_vt = term_idx;
+    set_display_start(term_idx);
+    vt_mark_screen_dirty(term_idx);
     redraw_cursor(term_idx);
 }
 
+/* vt_vidmap_acquire
+ *   DESCRIPTION: a program maps the screen of a terminal, it expects the screen at the
+ *                start of the mapped page, so move the window to the top and keep it there
+ *   INPUTS: term_idx -- the terminal mapped
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: video memory is modified
+ */
+void vt_vidmap_acquire(int32_t term_idx)
+{
+    int i;
+    unsigned long flags;
+    cli_and_save(flags);
+    if (vt_state[term_idx].vidmap_users++ == 0 && vt_state[term_idx].top_row != 0) {
+        for (i = 0; i < NUM_ROWS; i++) {
+            memcpy(vt_state[term_idx].surface + ROW_SIZE * i, vt_state[term_idx].video_mem + ROW_SIZE * i, ROW_SIZE);
+        }
+        vt_state[term_idx].top_row = 0;
+        vt_state[term_idx].video_mem = vt_state[term_idx].surface;
+        set_display_start(term_idx);
+        redraw_cursor(term_idx);
+    }
+    restore_flags(flags);
+}
+
+/* vt_vidmap_release
+ *   DESCRIPTION: a program that mapped the screen of a terminal halted
+ *   INPUTS: term_idx -- the terminal mapped
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the window may slide again once nobody maps the screen
+ */
+void vt_vidmap_release(int32_t term_idx)
+{
+    if (vt_state[term_idx].vidmap_users > 0)
+        vt_state[term_idx].vidmap_users--;
+}
+
+/* vt_get_screen
+ *   DESCRIPTION: get the screen window of the foreground terminal, read by the GUI compositor
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the first cell of the top row on the screen
+ *   SIDE EFFECTS: none
+ */
+char* vt_get_screen(void)
+{
+    if (vt_state[foreground_vt].scroll_offset)
+        return SCROLL_VIEW;
+    return vt_state[foreground_vt].video_mem;
+}
+
 uint32_t vt_get_cur_vidmem(void)
 {
-    return (uint32_t)vt_state[cur_vt].video_mem;
+    return (uint32_t)vt_state[cur_vt].surface;
 }
 
 /* process_default (PRIVATE)
@@ -375,12 +940,16 @@ static void process_default(keycode_t keycode, int release) {
 
     if (vt_state[foreground_vt].kbd.ctrl && keycode == KEY_G) { // Ctrl + G
         if (gui_activated) return;
+        if (gui_init() == -1) return;   // no memory for the 32-bpp skin, stay in text mode
+        /* move every surface out of the VGA memory the BGA takes over */
         VIDEO = 0xE0000;
-        vt_state[foreground_vt].video_mem = (char *)VIDEO;
-        memcpy((void *)VIDEO, (void *)0xB8000, VID_BUF_SIZE);
-        memcpy((void *)(VIDEO + FOUR_KB), (void *)(0xB8000 + FOUR_KB), VID_BUF_SIZE);
-        memcpy((void *)(VIDEO + 2 * FOUR_KB), (void *)(0xB8000 + 2 * FOUR_KB), VID_BUF_SIZE);
-        memcpy((void *)(VIDEO + 3 * FOUR_KB), (void *)(0xB8000 + 3 * FOUR_KB), VID_BUF_SIZE);
+        memcpy((void *)VIDEO, (void *)0xB8000, NUM_TERMS * SURFACE_SIZE + FOUR_KB);
+        int i;
+        for (i = 0; i < NUM_TERMS; i++) {
+            vt_state[i].surface = (char *)(VIDEO + i * SURFACE_SIZE);
+            vt_state[i].video_mem = vt_state[i].surface + ROW_SIZE * vt_state[i].top_row;
+        }
+        vidmap_table[0].ADDR = (uint32_t)vt_state[cur_vt].surface >> 12;
         program_bga(X_RESOLUTION, Y_RESOLUTION, BITS_PER_PIXEL);
         gui_set_up();
         gui_activated = 1;
@@ -408,13 +977,9 @@ static void process_default(keycode_t keycode, int release) {
 }
 
 static inline void vt_keyboard_raw(keycode_t keycode, int release) {
-    if (vt_state[foreground_vt].input_buf_ptr >= INPUT_BUF_SIZE)
-        return;
-    if (release) {
-        keycode |= 0x80;
-    }
-    vt_state[foreground_vt].input_buf[vt_state[foreground_vt].input_buf_ptr] = keycode;
-    vt_state[foreground_vt].input_buf_ptr++;
+    char c = release ? (keycode | 0x80) : keycode;
+    if (kbd_ring_put(foreground_vt, &c, 1))
+        sched_wake(&vt_state[foreground_vt]);
 }
 
 /* vt_keyboard
@@ -428,6 +993,10 @@ static inline void vt_keyboard_raw(keycode_t keycode, int release) {
 void vt_keyboard(keycode_t keycode, int release) {
     if (vt_state[foreground_vt].raw)
         return vt_keyboard_raw(keycode, release);
+    // typing anything else brings the live screen back
+    if (!release && vt_state[foreground_vt].scroll_offset && keycode != KEY_PAGE_UP && keycode != KEY_PAGE_DOWN
+        && keycode != KEY_LEFTSHIFT && keycode != KEY_RIGHTSHIFT)
+        scroll_view(foreground_vt, -vt_state[foreground_vt].scroll_offset);
     switch (keycode) {
         case KEY_LEFTSHIFT:
         case KEY_RIGHTSHIFT:
@@ -460,10 +1029,12 @@ void vt_keyboard(keycode_t keycode, int release) {
                 vt_putc('\n', 1);
                 vt_state[foreground_vt].input_buf[vt_state[foreground_vt].input_buf_ptr] = '\n';
                 vt_state[foreground_vt].input_buf_ptr++;
-                vt_state[foreground_vt].nbytes_read = vt_state[foreground_vt].input_buf_ptr; // Store number of bytes read
-                memcpy(vt_state[foreground_vt].user_buf, vt_state[foreground_vt].input_buf, vt_state[foreground_vt].nbytes_read * sizeof(char)); // Copy input buffer to user buffer
+                // hand the line to read(), it is dropped if the reader is too far behind to take it
+                if (kbd_ring_put(foreground_vt, vt_state[foreground_vt].input_buf, vt_state[foreground_vt].input_buf_ptr)) {
+                    vt_state[foreground_vt].lines_in++;
+                    sched_wake(&vt_state[foreground_vt]);
+                }
                 vt_state[foreground_vt].input_buf_ptr = 0; // Reset input buffer pointer
-                vt_state[foreground_vt].enter_pressed = 1; // Signal read() that enter is pressed
             }
             break;
         case KEY_BACKSPACE:
@@ -497,6 +1068,16 @@ void vt_keyboard(keycode_t keycode, int release) {
                 command_history(2);
             }
             break;
+        case KEY_PAGE_UP:
+            if (!release && vt_state[foreground_vt].kbd.shift){
+                scroll_view(foreground_vt, NUM_ROWS - 1);
+            }
+            break;
+        case KEY_PAGE_DOWN:
+            if (!release && vt_state[foreground_vt].kbd.shift){
+                scroll_view(foreground_vt, -(NUM_ROWS - 1));
+            }
+            break;
         default:
             process_default(keycode, release);
             break;
@@ -529,6 +1110,7 @@ void vt_putc(char c, int kbd) {
         char attrib = vt_state[term_idx].attrib;
         *(uint8_t *)(video_mem + ((NUM_COLS * vt_state[term_idx].screen_y + vt_state[term_idx].screen_x) << 1)) = c;
         *(uint8_t *)(video_mem + ((NUM_COLS * vt_state[term_idx].screen_y + vt_state[term_idx].screen_x) << 1) + 1) = attrib;
+        vt_mark_dirty(term_idx, vt_state[term_idx].screen_y);
         vt_state[term_idx].screen_x++;
         if (vt_state[term_idx].screen_x >= NUM_COLS)
             print_newline(term_idx);
@@ -538,47 +1120,27 @@ void vt_putc(char c, int kbd) {
 }
 
 /* vt_set_active_term
- *   DESCRIPTION:
- *   INPUTS: the idx of the terminal to switch to
+ *   DESCRIPTION: make the terminal of the process picked by the scheduler the one
+ *                that reads, writes and vidmap refer to
+ *   INPUTS: next_vt -- the idx of the terminal to switch to
  *   OUTPUTS: none
- *   RETURN VALUE: the next pid
- *   SIDE EFFECTS: switch to another virtual terminal 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switch to another virtual terminal, the caller reloads CR3
  */
-int32_t vt_set_active_term(uint32_t cur_esp, uint32_t cur_ebp)
+void vt_set_active_term(int32_t next_vt)
 {
-    if (vt_state[cur_vt].halt_pending) {
-        vt_state[cur_vt].halt_pending = 0;
-        __syscall_halt(0);
-    }
-
-    /* save esp and pid of current process on the current terminal */
-    vt_state[cur_vt].esp = cur_esp;
-    vt_state[cur_vt].ebp = cur_ebp;
-
-    cur_vt = (cur_vt +1) % NUM_TERMS; // get the idx of next terminal
-    uint32_t nxt_pid = vt_state[cur_vt].active_pid;
-
-    if(nxt_pid == -1) { // there's no process running on the nxt terminal
-        __syscall_execute((uint8_t*)"shell"); // execute a shell then
-    }
+    cur_vt = next_vt;
 
     /* remap video memory */
-    vidmap_table[0].ADDR = (uint32_t)vt_state[cur_vt].video_mem >> 12;
-
-    // flushing TLB by reloading CR3 register
-    asm volatile (
-        "movl %%cr3, %%eax;"  // Move the value of CR3 into EBX
-        "movl %%eax, %%cr3;"  // Move the value from EBX back to CR3
-        : : : "eax", "memory"
-    );
-    return nxt_pid;
+    vidmap_table[0].ADDR = (uint32_t)vt_state[cur_vt].surface >> 12;
 }
 
-/* set the active_pid of a vt*/
+/* set the active_pid of a vt, the vt of the process is recorded in its pcb,
+   a reader sleeping in the background may have just become the one taking input */
 void vt_set_active_pid(int pid) {
-    vt_state[cur_vt].active_pid = pid;
     pcb_t* cur_pcb = get_pcb_by_pid(pid);
-    cur_pcb->vt = cur_vt; 
+    vt_state[cur_pcb->vt].active_pid = pid;
+    sched_wake(&vt_state[cur_pcb->vt]);
 }
 
 int32_t vt_check_active_pid(int vt_id) {
@@ -586,11 +1148,6 @@ int32_t vt_check_active_pid(int vt_id) {
     return vt_state[vt_id].active_pid;
 }
 
-void vt_get_ebp_esp(uint32_t *esp, uint32_t *ebp) {
-    *esp = vt_state[cur_vt].esp;
-    *ebp = vt_state[cur_vt].ebp;
-}
-
 /* bad_read_call
  *   DESCRIPTION: return -1 as this function should not be called
  *   INPUTS: all meaningless
@@ -650,10 +1207,19 @@ void command_completion(){
 }
 
 int32_t vt_ioctl(int32_t flag) {
+    // keycodes are no use to a line reader and lines are no use to a raw one, head and line count move together
+    cli();
+    vt_state[cur_vt].kbd_tail = vt_state[cur_vt].kbd_head;
+    vt_state[cur_vt].lines_out = vt_state[cur_vt].lines_in;
+    sti();
     if (flag == 1) {
         vt_state[cur_vt].raw = 1;
     } else {
         vt_state[cur_vt].raw = 0;
+        // forget what the program left behind
+        vt_state[cur_vt].esc_state = ESC_NONE;
+        vt_state[cur_vt].scroll_top = 0;
+        vt_state[cur_vt].scroll_bottom = NUM_ROWS - 1;
     }
     return 0;
 }
@@ -679,7 +1245,21 @@ int32_t vt_write_foreground(int32_t fd, const void* buf, int32_t nbytes) {
     return i;
 }
 
-/* show_memory_usage - display the memory usage for all the pcb
+/* show_memory_stat - write one labelled number of the memory statistics line
+ * Inputs: label - text before the number, value - the number, unit - text after the number
+ * Outputs: the label, number and unit on the foreground terminal
+ * Return: None
+ */
+static void show_memory_stat(const int8_t* label, uint32_t value, const int8_t* unit){
+    int8_t buf[11];     // enough for a 32-bit decimal number
+
+    vt_write_foreground(1, label, strlen(label));
+    itoa(value, buf, 10);
+    vt_write_foreground(1, buf, strlen(buf));
+    vt_write_foreground(1, unit, strlen(unit));
+}
+
+/* show_memory_usage - display the heap usage of the foreground process
  * Inputs: None
  * Outputs: the memory usage
  * Return: 0 if show successfully, -1 otherwise
@@ -687,12 +1267,17 @@ int32_t vt_write_foreground(int32_t fd, const void* buf, int32_t nbytes) {
 int32_t show_memory_usage(void){
     int32_t i, j, counter, usage;
     uint8_t buf[4];
+    dynamic_memory_stats_t stats;
+    dynamic_heap_t* heap = get_pcb_by_pid(vt_state[foreground_vt].active_pid)->heap;
+
+    /* the table shows the heap of the process running on the foreground terminal */
+    if(heap == NULL) return -1;
     vt_write_foreground(1, "\n+--------------+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+", 81);
     vt_write_foreground(1, "| Memory Usage |", 16);
     for(i = 0; i < 16; i++){
         counter = 0;
         for(j = 0; j < 64; j++){
-            if(dynamic_tables[i * 64 + j].P == 1){
+            if(heap->tables[i * 64 + j].P == 1){
                 counter++;
             }
         }
@@ -711,6 +1296,14 @@ int32_t show_memory_usage(void){
         vt_write_foreground(1, buf, 4);
     }
     vt_write_foreground(1, "+--------------+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+", 80);
+
+    /* then one line of allocator statistics */
+    dynamic_memory_stats(heap, &stats);
+    show_memory_stat("free ", stats.total_free_bytes, " B, ");
+    show_memory_stat("largest ", stats.largest_free_block, " B, ");
+    show_memory_stat("", stats.free_fragments, " fragments, ");
+    show_memory_stat("", stats.mapped_pages, " mapped / ");
+    show_memory_stat("", stats.touched_pages, " touched pages\n");
     return 0;
 }
 
@@ -13,6 +13,18 @@
 #define NUM_TERMS 3
 #define NUM_CMDS 11
 #define NUM_HIST 10
+#define SCROLLBACK_LINES 2048
+#define SCROLLBACK_COLS 80
+#define SCROLLBACK_RUNS 3
+#define ESC_PARAM_NUM 4
+#define ESC_PARAM_MAX 999
+#define KBD_RING_SIZE 1024 // power of two, the indices wrap with KBD_RING_MASK
+#define KBD_RING_MASK (KBD_RING_SIZE - 1)
+
+/* states of the escape sequence parser */
+#define ESC_NONE 0 // plain text
+#define ESC_SEEN 1 // got ESC
+#define ESC_CSI  2 // got ESC [, reading parameters
 
 extern void vt_init();
 extern int32_t vt_open(const uint8_t* id);
@@ -23,10 +35,12 @@ extern void vt_keyboard(keycode_t keycode, int release);
 void vt_putc(char c, int kdb);
 extern int32_t bad_read_call(int32_t fd, void* buf, int32_t nbytes);
 extern int32_t bad_write_call(int32_t fd, const void* buf, int32_t nbytes);
-extern int32_t vt_set_active_term(uint32_t cur_esp, uint32_t cur_ebp);
+extern void vt_set_active_term(int32_t next_vt);
 extern void vt_set_active_pid(int pid);
-void vt_get_ebp_esp(uint32_t *esp, uint32_t *ebp);
 uint32_t vt_get_cur_vidmem(void);
+void vt_vidmap_acquire(int32_t term_idx);
+void vt_vidmap_release(int32_t term_idx);
+char* vt_get_screen(void);
 void command_completion();
 int32_t vt_ioctl(int32_t flag);
 int32_t vt_check_active_pid(int vt_id);
@@ -37,26 +51,50 @@ void command_history();
 extern operation_table_t stdin_operation_table;
 extern operation_table_t stdout_operation_table;
 
+void vt_scrollback_init(void);
+
+/* a line that scrolled off the screen, the attributes are kept as runs of equal attributes,
+   once SCROLLBACK_RUNS runs are used the last one takes the rest of the line */
+typedef struct {
+    char text[SCROLLBACK_COLS];
+    uint8_t run_num;
+    uint8_t run_attrib[SCROLLBACK_RUNS];
+    uint8_t run_end[SCROLLBACK_RUNS]; // column after the last cell of the run
+} scrollback_line_t;
 
 typedef struct {
     int screen_x;
     int screen_y;
-    char* video_mem;
+    char* surface; // SURFACE_ROWS rows of text, the screen is a window of it
+    char* video_mem; // first cell of the screen window
+    int top_row; // row of the surface shown at the top of the screen
+    int vidmap_users; // processes mapping the screen, the window stays at the top while there are any
     keyboard_state_t kbd;
     char input_buf[INPUT_BUF_SIZE]; // Temporary buffer for storing user input
     volatile int input_buf_ptr;
-    volatile int enter_pressed;
-    char user_buf[INPUT_BUF_SIZE]; // Buffer for storing user input after enter is pressed
+    /* input waiting for read(), keycodes in raw mode or finished lines otherwise. The keyboard
+       handler only moves kbd_head and lines_in, the reading process only kbd_tail and lines_out,
+       all four count up forever and wrap around together */
+    char kbd_ring[KBD_RING_SIZE];
+    volatile uint32_t kbd_head;
+    volatile uint32_t kbd_tail;
+    volatile uint32_t lines_in;
+    volatile uint32_t lines_out;
     char buf_history[NUM_HIST][INPUT_BUF_SIZE];
     int cur_cmd_idx;
     int cur_cmd_cnt;
-    int nbytes_read;
-    uint32_t active_pid; // default as -1
-    uint32_t esp;
-    uint32_t ebp;
-    uint32_t halt_pending;
+    uint32_t active_pid; // foreground process reading the keyboard, default as -1
     int32_t raw;
     int8_t attrib;
+    scrollback_line_t* scrollback; // ring of SCROLLBACK_LINES lines, NULL if there was no memory for it
+    int sb_head; // slot the next line goes to
+    int sb_count; // lines in the ring
+    int scroll_offset; // lines the view is scrolled back, 0 shows the live screen
+    int esc_state; // ESC_NONE, ESC_SEEN or ESC_CSI
+    int esc_params[ESC_PARAM_NUM]; // parameters of the control sequence being parsed
+    int esc_param_num;
+    int scroll_top; // rows scrolled by a newline at scroll_bottom, the whole screen by default
+    int scroll_bottom;
 } vt_state_t;
 
 extern vt_state_t vt_state[NUM_TERMS];
@@ -5,122 +5,619 @@
 #include "dynamic_alloc.h"
 #include "lib.h"
 
-static dynamic_allocation_node_t DA_head_node;
-uint32_t block_used[PAGE_TBL_SIZE];         // used to record the corresponding PTE has now been used by how many allocation
+#define DA_LINKS(node) ((dynamic_free_links_t*)((node) + 1))
+#define DA_FREE_HEAD_SIZE (sizeof(dynamic_allocation_node_t) + sizeof(dynamic_free_links_t))
+#define DA_END(heap) ((heap)->start + DYNAMIC_MEMORY_SIZE)
+#define DA_WALK_LIMIT (DYNAMIC_MEMORY_SIZE / DA_SLAB_MAX_SIZE)   // more large blocks than this cannot fit in a heap
 
-/* dynamic_allocation_init - initialize the dynamic memory allocation structure for the specific pcd
- * Inputs: pid - the given pid to mark the specific pcd to initialize
+static dynamic_heap_t kernel_heap;                  // used by the kernel itself, e.g. the executable cache
+static dynamic_heap_t process_heaps[MAX_PID_NUM];   // one per pid, given back in bulk when the process halts
+
+/* DA_bsr / DA_bsf - index of the highest / lowest set bit, value must not be 0 */
+static inline uint32_t DA_bsr(uint32_t value){
+    uint32_t index;
+    asm volatile("bsrl %1, %0" : "=r"(index) : "rm"(value) : "cc");
+    return index;
+}
+
+static inline uint32_t DA_bsf(uint32_t value){
+    uint32_t index;
+    asm volatile("bsfl %1, %0" : "=r"(index) : "rm"(value) : "cc");
+    return index;
+}
+
+/* DA_mapping - get the two level list a large block of the given size belongs to
+ * Inputs: size - size of the whole block including its header, larger than DA_SLAB_MAX_SIZE
+ *         fl, sl - filled with the first and second level index
+ * Outputs: None
+ * Return: None
+ */
+static void DA_mapping(uint32_t size, uint32_t* fl, uint32_t* sl){
+    uint32_t msb = DA_bsr(size);
+    *fl = msb - DA_SLAB_MAX_SHIFT;
+    *sl = (size >> (msb - DA_SL_SHIFT)) - DA_SL_NUM;
+}
+
+/* DA_head_ok - check a header address read from heap memory before the kernel follows it,
+ *              a process can rewrite every header and link of its own heap
+ * Inputs: heap - the heap, node - the header address
+ *         magic - DA_USED_MAGIC or DA_FREE_MAGIC the header must carry, 0 to accept both
+ * Outputs: None
+ * Return: 1 if the header is aligned, inside the area, on wired pages and carries the magic, 0 otherwise
+ */
+static int32_t DA_head_ok(dynamic_heap_t* heap, dynamic_allocation_node_t* node, uint32_t magic){
+    uint32_t start = (uint32_t)node;
+    uint32_t end = start + (magic == DA_FREE_MAGIC ? DA_FREE_HEAD_SIZE : sizeof(dynamic_allocation_node_t));
+
+    if((start & (DA_ALIGN - 1)) || start < heap->start || start >= DA_END(heap) || end > DA_END(heap)) return 0;
+    if(heap->block_used[(start - heap->start) / PAGE_SIZE] == 0) return 0;
+    if(heap->block_used[(end - 1 - heap->start) / PAGE_SIZE] == 0) return 0;
+    if(magic == 0) return node->magic == DA_USED_MAGIC || node->magic == DA_FREE_MAGIC;
+    return node->magic == magic;
+}
+
+/* DA_size_ok - check the size of a large block before it is used to map a list or walk the pages
+ * Inputs: heap - the heap, node - header of the block, size - the size it claims
+ * Outputs: None
+ * Return: 1 if the block is large, aligned and ends inside the area, 0 otherwise
+ */
+static int32_t DA_size_ok(dynamic_heap_t* heap, dynamic_allocation_node_t* node, uint32_t size){
+    return size > DA_SLAB_MAX_SIZE && (size & (DA_ALIGN - 1)) == 0 && size <= DA_END(heap) - (uint32_t)node;
+}
+
+/* DA_large_ok - check an allocated large block against its neighbours before it is given back
+ * Inputs: heap - the heap, node - header of the block, already checked by DA_head_ok
+ * Outputs: None
+ * Return: 1 if the size fits and both neighbours point back at the block, 0 otherwise
+ */
+static int32_t DA_large_ok(dynamic_heap_t* heap, dynamic_allocation_node_t* node){
+    dynamic_allocation_node_t* prev = node->prev_phys;
+    dynamic_allocation_node_t* next = (dynamic_allocation_node_t*)((uint32_t)node + node->size);
+
+    if(!DA_size_ok(heap, node, node->size)) return 0;
+    if(prev == NULL){
+        if((uint32_t)node != heap->start) return 0;
+    } else if(!DA_head_ok(heap, prev, 0) || !DA_size_ok(heap, prev, prev->size) ||
+              (uint32_t)prev + prev->size != (uint32_t)node){
+        return 0;
+    }
+    if((uint32_t)next < DA_END(heap) && (!DA_head_ok(heap, next, 0) || next->prev_phys != node)) return 0;
+    return 1;
+}
+
+/* DA_links_ok - check the free list links of a block before it is unlinked
+ * Inputs: heap - the heap, node - the free block, head - head of the list it should be in
+ * Outputs: None
+ * Return: 1 if both neighbours are free blocks linking back to it, 0 otherwise
+ */
+static int32_t DA_links_ok(dynamic_heap_t* heap, dynamic_allocation_node_t* node, dynamic_allocation_node_t* head){
+    dynamic_free_links_t* links = DA_LINKS(node);
+
+    if(links->prev == NULL){
+        if(head != node) return 0;
+    } else if(!DA_head_ok(heap, links->prev, DA_FREE_MAGIC) || DA_LINKS(links->prev)->next != node){
+        return 0;
+    }
+    if(links->next != NULL && (!DA_head_ok(heap, links->next, DA_FREE_MAGIC) || DA_LINKS(links->next)->prev != node)) return 0;
+    return 1;
+}
+
+/* DA_pages_missing - count the pages overlapping [start, end) that no block uses yet
+ * Inputs: heap - the heap, start - first byte address, end - one past the last byte address
+ * Outputs: None
+ * Return: the number of frames DA_pages_hold would take for the range
+ */
+static uint32_t DA_pages_missing(dynamic_heap_t* heap, uint32_t start, uint32_t end){
+    uint32_t i, missing = 0;
+    for(i = (start - heap->start) / PAGE_SIZE; i <= (end - 1 - heap->start) / PAGE_SIZE; i++){
+        if(heap->block_used[i] == 0) missing++;
+    }
+    return missing;
+}
+
+/* DA_pages_hold - mark every heap page overlapping [start, end) as used once more
+ * Inputs: heap - the heap, start - first byte address, end - one past the last byte address
+ * Outputs: None
+ * Side Effects: wires a zeroed frame under pages that were not used before,
+ *               the caller checks with DA_pages_missing that enough frames are left
+ */
+static void DA_pages_hold(dynamic_heap_t* heap, uint32_t start, uint32_t end){
+    uint32_t i;
+    PTE_t* pte;
+    for(i = (start - heap->start) / PAGE_SIZE; i <= (end - 1 - heap->start) / PAGE_SIZE; i++){
+        if(heap->block_used[i]++ != 0) continue;
+        pte = &heap->tables[i];
+        pte->ADDR = page_frame_alloc() >> 12;
+        pte->RW = 1;
+        pte->US = heap->user;
+        pte->P = 1;
+        /* frames move between processes, never hand out someone else's data */
+        memset((void*)(heap->start + i * PAGE_SIZE), 0, PAGE_SIZE);
+        /* the clearing above does not count as a touch */
+        pte->A = 0;
+        asm volatile("invlpg (%0)" : : "r"(heap->start + i * PAGE_SIZE) : "memory");
+    }
+}
+
+/* DA_pages_release - drop one use of every heap page overlapping [start, end)
+ * Inputs: heap - the heap, start - first byte address, end - one past the last byte address
+ * Outputs: None
+ * Side Effects: unmaps and frees the frame of pages no block uses anymore
+ */
+static void DA_pages_release(dynamic_heap_t* heap, uint32_t start, uint32_t end){
+    uint32_t i;
+    for(i = (start - heap->start) / PAGE_SIZE; i <= (end - 1 - heap->start) / PAGE_SIZE; i++){
+        /* a page is never dropped twice, even if forged sizes made the counts disagree */
+        if(heap->block_used[i] == 0 || --heap->block_used[i] != 0) continue;
+        heap->tables[i].P = 0;
+        asm volatile("invlpg (%0)" : : "r"(heap->start + i * PAGE_SIZE) : "memory");
+        page_frame_free(heap->tables[i].ADDR << 12);
+    }
+}
+
+/* DA_list_push - put a free large block at the head of its list
+ * Inputs: heap - the heap, node - the free block, its size field must be set and its header pages held
+ * Outputs: None
+ * Side Effects: None
+ */
+static void DA_list_push(dynamic_heap_t* heap, dynamic_allocation_node_t* node){
+    uint32_t fl, sl;
+    dynamic_allocation_node_t* head;
+
+    DA_mapping(node->size, &fl, &sl);
+    head = heap->free_lists[fl][sl];
+    /* a head whose header got overwritten cannot be linked to, the rest of that list is lost */
+    if(head != NULL && !DA_head_ok(heap, head, DA_FREE_MAGIC)) head = NULL;
+    node->magic = DA_FREE_MAGIC;
+    DA_LINKS(node)->prev = NULL;
+    DA_LINKS(node)->next = head;
+    if(head != NULL) DA_LINKS(head)->prev = node;
+    heap->free_lists[fl][sl] = node;
+    heap->sl_map[fl] |= 1 << sl;
+    heap->fl_map |= 1 << fl;
+}
+
+/* DA_list_remove - take a free large block out of its list
+ * Inputs: heap - the heap, node - the free block, already checked by DA_head_ok
+ * Outputs: None
+ * Return: 0 on success, -1 if the size or the links of the block are broken, nothing is changed then
+ */
+static int32_t DA_list_remove(dynamic_heap_t* heap, dynamic_allocation_node_t* node){
+    uint32_t fl, sl;
+    dynamic_free_links_t* links = DA_LINKS(node);
+
+    if(!DA_size_ok(heap, node, node->size)) return -1;
+    DA_mapping(node->size, &fl, &sl);
+    if(!DA_links_ok(heap, node, heap->free_lists[fl][sl])) return -1;
+    if(links->prev != NULL) DA_LINKS(links->prev)->next = links->next;
+    else heap->free_lists[fl][sl] = links->next;
+    if(links->next != NULL) DA_LINKS(links->next)->prev = links->prev;
+    if(heap->free_lists[fl][sl] == NULL){
+        heap->sl_map[fl] &= ~(1 << sl);
+        if(heap->sl_map[fl] == 0) heap->fl_map &= ~(1 << fl);
+    }
+    return 0;
+}
+
+/* DA_find_free - find a free large block of at least need bytes
+ * Inputs: heap - the heap, need - size of the whole block including its header
+ * Outputs: None
+ * Return: the free block, NULL if no block is large enough
+ */
+static dynamic_allocation_node_t* DA_find_free(dynamic_heap_t* heap, uint32_t need){
+    dynamic_allocation_node_t* node;
+    dynamic_allocation_node_t* best = NULL;
+    uint32_t fl, sl, map, walked;
+
+    /* round the request up to the next second level range, so the head of any list from there on fits */
+    DA_mapping(need + (1 << (DA_bsr(need) - DA_SL_SHIFT)) - 1, &fl, &sl);
+    if(fl < DA_CLASS_NUM){
+        map = heap->sl_map[fl] & (~0U << sl);
+        if(map == 0){
+            map = heap->fl_map & (~0U << (fl + 1));
+            if(map != 0){
+                fl = DA_bsf(map);
+                map = heap->sl_map[fl];
+            }
+        }
+        if(map != 0){
+            node = heap->free_lists[fl][DA_bsf(map)];
+            return DA_head_ok(heap, node, DA_FREE_MAGIC) ? node : NULL;
+        }
+    }
+
+    /* blocks sharing the request's own list may still fit, take the best of them,
+       the walk stops at a broken link and cannot go around a forged loop forever */
+    DA_mapping(need, &fl, &sl);
+    node = heap->free_lists[fl][sl];
+    for(walked = 0; node != NULL && walked < DA_WALK_LIMIT && DA_head_ok(heap, node, DA_FREE_MAGIC); walked++){
+        if(node->size >= need && (best == NULL || node->size < best->size)) best = node;
+        node = DA_LINKS(node)->next;
+    }
+    return best;
+}
+
+/* DA_large_alloc - split a large block off the free lists
+ * Inputs: heap - the heap, need - size of the whole block including its header, multiple of DA_ALIGN
+ * Outputs: None
+ * Return: header of the allocated block, NULL if no free block is large enough or no frame is left
+ * Side Effects: wires the pages the block covers
+ */
+static dynamic_allocation_node_t* DA_large_alloc(dynamic_heap_t* heap, uint32_t need){
+    dynamic_allocation_node_t* node = DA_find_free(heap, need);
+    dynamic_allocation_node_t* rest;
+    dynamic_allocation_node_t* after;
+    uint32_t split, end;
+
+    if(node == NULL || !DA_size_ok(heap, node, node->size) || node->size < need) return NULL;
+
+    /* a rest too small to be a large block stays inside the allocation */
+    split = (node->size - need > DA_SLAB_MAX_SIZE);
+    end = split ? (uint32_t)node + need + DA_FREE_HEAD_SIZE : (uint32_t)node + node->size;
+    if(DA_pages_missing(heap, (uint32_t)node, end) > page_frame_available()) return NULL;
+    if(DA_list_remove(heap, node)) return NULL;
+
+    if(split){
+        rest = (dynamic_allocation_node_t*)((uint32_t)node + need);
+        after = (dynamic_allocation_node_t*)((uint32_t)node + node->size);
+        DA_pages_hold(heap, (uint32_t)rest, (uint32_t)rest + DA_FREE_HEAD_SIZE);
+        rest->prev_phys = node;
+        rest->size = node->size - need;
+        rest->used_num = 0;
+        if((uint32_t)after < DA_END(heap) && DA_head_ok(heap, after, 0)) after->prev_phys = rest;
+        DA_list_push(heap, rest);
+        node->size = need;
+    }
+
+    /* hold the block before dropping the free header so shared pages never flip off */
+    DA_pages_hold(heap, (uint32_t)node, (uint32_t)node + node->size);
+    DA_pages_release(heap, (uint32_t)node, (uint32_t)node + DA_FREE_HEAD_SIZE);
+    node->magic = DA_USED_MAGIC;
+    node->used_num = 0;
+    return node;
+}
+
+/* DA_large_free - give a large block back, merging it with free neighbours on both sides
+ * Inputs: heap - the heap, node - header of the allocated block, already checked by DA_large_ok
+ * Outputs: None
+ * Side Effects: unmaps the pages nothing else uses anymore
+ */
+static void DA_large_free(dynamic_heap_t* heap, dynamic_allocation_node_t* node){
+    dynamic_allocation_node_t* start = node;
+    dynamic_allocation_node_t* next = (dynamic_allocation_node_t*)((uint32_t)node + node->size);
+    dynamic_allocation_node_t* prev = node->prev_phys;
+    dynamic_allocation_node_t* after;
+    uint32_t old_size = node->size;
+    uint32_t size = node->size;
+    int32_t next_merged = 0;
+
+    if((uint32_t)next < DA_END(heap) && DA_head_ok(heap, next, DA_FREE_MAGIC) && DA_list_remove(heap, next) == 0){
+        size += next->size;
+        next->magic = 0;
+        next_merged = 1;
+    }
+    if(prev != NULL && DA_head_ok(heap, prev, DA_FREE_MAGIC) && DA_list_remove(heap, prev) == 0){
+        size += prev->size;
+        node->magic = 0;
+        start = prev;
+    } else {
+        DA_pages_hold(heap, (uint32_t)node, (uint32_t)node + DA_FREE_HEAD_SIZE);
+    }
+
+    start->size = size;
+    after = (dynamic_allocation_node_t*)((uint32_t)start + size);
+    if((uint32_t)after < DA_END(heap) && DA_head_ok(heap, after, 0)) after->prev_phys = start;
+    DA_list_push(heap, start);
+
+    DA_pages_release(heap, (uint32_t)node, (uint32_t)node + old_size);
+    if(next_merged) DA_pages_release(heap, (uint32_t)next, (uint32_t)next + DA_FREE_HEAD_SIZE);
+}
+
+/* DA_slab_push / DA_slab_remove - link a slab block in or out of its class list,
+ * removing returns -1 and changes nothing if the links of the block are broken */
+static void DA_slab_push(dynamic_heap_t* heap, int32_t class_index, dynamic_allocation_node_t* node){
+    dynamic_allocation_node_t* head = heap->slab_lists[class_index];
+
+    if(head != NULL && !DA_head_ok(heap, head, DA_FREE_MAGIC)) head = NULL;
+    node->magic = DA_FREE_MAGIC;
+    DA_LINKS(node)->prev = NULL;
+    DA_LINKS(node)->next = head;
+    if(head != NULL) DA_LINKS(head)->prev = node;
+    heap->slab_lists[class_index] = node;
+    heap->slab_free_num[class_index]++;
+}
+
+static int32_t DA_slab_remove(dynamic_heap_t* heap, int32_t class_index, dynamic_allocation_node_t* node){
+    dynamic_free_links_t* links = DA_LINKS(node);
+
+    if(!DA_links_ok(heap, node, heap->slab_lists[class_index])) return -1;
+    if(links->prev != NULL) DA_LINKS(links->prev)->next = links->next;
+    else heap->slab_lists[class_index] = links->next;
+    if(links->next != NULL) DA_LINKS(links->next)->prev = links->prev;
+    heap->slab_free_num[class_index]--;
+    return 0;
+}
+
+/* DA_slab_block_ok - check a slab block and the slab it claims to come from
+ * Inputs: heap - the heap, class_index - the slab class, node - header of the block
+ *         magic - DA_USED_MAGIC or DA_FREE_MAGIC the block must carry
+ * Outputs: None
+ * Return: 1 if the block has the class size and sits on a block boundary inside a live slab, 0 otherwise
+ */
+static int32_t DA_slab_block_ok(dynamic_heap_t* heap, int32_t class_index, dynamic_allocation_node_t* node, uint32_t magic){
+    dynamic_allocation_node_t* slab;
+    uint32_t block_size = 1 << (class_index + DA_SLAB_MIN_SHIFT);
+    uint32_t offset;
+
+    if(!DA_head_ok(heap, node, magic) || node->size != block_size) return 0;
+    slab = node->prev_phys;
+    if(!DA_head_ok(heap, slab, DA_USED_MAGIC) || !DA_size_ok(heap, slab, slab->size)) return 0;
+    if(slab->size < sizeof(dynamic_allocation_node_t) + DA_SLAB_SIZE) return 0;
+    offset = (uint32_t)node - (uint32_t)(slab + 1);
+    return offset < DA_SLAB_SIZE && (offset & (block_size - 1)) == 0;
+}
+
+/* DA_slab_refill - carve one slab of blocks for a slab class
+ * Inputs: heap - the heap, class_index - the slab class whose list is empty
+ * Outputs: None
+ * Return: 0 if the list got refilled, -1 if no memory is left
+ * Side Effects: None
+ */
+static int32_t DA_slab_refill(dynamic_heap_t* heap, int32_t class_index){
+    dynamic_allocation_node_t* slab = DA_large_alloc(heap, sizeof(dynamic_allocation_node_t) + DA_SLAB_SIZE);
+    dynamic_allocation_node_t* node;
+    uint32_t block_size = 1 << (class_index + DA_SLAB_MIN_SHIFT);
+    uint32_t offset;
+
+    if(slab == NULL) return -1;
+    for(offset = 0; offset < DA_SLAB_SIZE; offset += block_size){
+        node = (dynamic_allocation_node_t*)((uint32_t)(slab + 1) + offset);
+        node->prev_phys = slab;
+        node->size = block_size;
+        DA_slab_push(heap, class_index, node);
+    }
+    return 0;
+}
+
+/* DA_slab_free - give a slab block back to its class
+ * Inputs: heap - the heap, class_index - the slab class, node - header of the block, already checked by DA_slab_block_ok
+ * Outputs: None
+ * Side Effects: an empty slab goes back to the large lists once its class has another slab worth of free blocks
+ */
+static void DA_slab_free(dynamic_heap_t* heap, int32_t class_index, dynamic_allocation_node_t* node){
+    dynamic_allocation_node_t* slab = node->prev_phys;
+    uint32_t block_size = node->size;
+    uint32_t offset;
+
+    DA_slab_push(heap, class_index, node);
+    if(--slab->used_num != 0 || heap->slab_free_num[class_index] <= DA_SLAB_SIZE / block_size) return;
+
+    /* every block must really be free before the slab goes, a broken one keeps the slab where it is */
+    if(!DA_large_ok(heap, slab)) return;
+    for(offset = 0; offset < DA_SLAB_SIZE; offset += block_size){
+        if(!DA_slab_block_ok(heap, class_index, (dynamic_allocation_node_t*)((uint32_t)(slab + 1) + offset), DA_FREE_MAGIC)) return;
+    }
+    for(offset = 0; offset < DA_SLAB_SIZE; offset += block_size){
+        if(DA_slab_remove(heap, class_index, (dynamic_allocation_node_t*)((uint32_t)(slab + 1) + offset))) return;
+    }
+    DA_large_free(heap, slab);
+}
+
+/* DA_heap_init - reset a heap to empty, no page is wired until the first malloc
+ * Inputs: heap - the heap, start - virtual address of the area, tables - page table mapping the area,
+ *         user - 1 if user programs may touch the pages
+ * Outputs: None
+ * Return: None
+ */
+static void DA_heap_init(dynamic_heap_t* heap, uint32_t start, PTE_t* tables, uint32_t user){
+    memset(heap, 0, sizeof(dynamic_heap_t));
+    heap->start = start;
+    heap->tables = tables;
+    heap->user = user;
+}
+
+/* dynamic_allocation_init - initialize the kernel heap
+ * Inputs: None
  * Outputs: None
  * Return: None
  */
 void dynamic_allocation_init(void){
-    /* initialize the fields of dynamic_allocation_node_t */
-    DA_head_node.prev = NULL;
-    DA_head_node.next = NULL;
-    DA_head_node.start_index = 0;
-    DA_head_node.end_index = 0;
-    DA_head_node.used_bytes_num = 0;
-    DA_head_node.available_bytes_num = DYNAMIC_MEMORY_SIZE;
-    DA_head_node.ptr = (uint8_t*)DYNAMIC_MEMORY_START;
+    DA_heap_init(&kernel_heap, KERNEL_HEAP_START, kernel_heap_table, 0);
+}
 
-    memset(block_used, 0, PAGE_TBL_SIZE);
+/* process_heap_init - give a newly executed process an empty heap
+ * Inputs: pid - the pid of the process
+ * Outputs: None
+ * Return: the heap of the process
+ */
+dynamic_heap_t* process_heap_init(uint32_t pid){
+    DA_heap_init(&process_heaps[pid], DYNAMIC_MEMORY_START, heap_tables[pid], 1);
+    return &process_heaps[pid];
 }
 
-/* malloc - dynamic allocate one memory area with input size
- * Inputs: size - the size of the dynamic allocate area
+/* dynamic_heap_malloc - dynamic allocate one memory area with input size from a heap
+ * Inputs: heap - the heap, it must be mapped in the current address space
+ *         size - the size of the dynamic allocate area
  * Outputs: None
  * Return: the pointer pointing to the target area if successfully
  *         NULL if allocate fails
  */
-void* malloc(int32_t size){
-    dynamic_allocation_node_t target_DA_node;
-    dynamic_allocation_node_t* cur_DA_node = &DA_head_node;
-    int32_t i;
-    int32_t start_index = 0, end_index;
+void* dynamic_heap_malloc(dynamic_heap_t* heap, int32_t size){
+    dynamic_allocation_node_t* node = NULL;
+    dynamic_allocation_node_t* whole_area = (dynamic_allocation_node_t*)heap->start;
+    uint32_t need, flags;
+    int32_t class_index;
 
     /* if size is invalid, allocate fails */
-    if(size <= 0) return NULL;
-
-    while(cur_DA_node != NULL){
-        /* check if current node has enough space, which includes size itself and the corresponding DA_node */
-        if(cur_DA_node->available_bytes_num >= (size + sizeof(dynamic_allocation_node_t))){
-            /* if has enough space, first turn on relevant paging structure */
-            start_index += cur_DA_node->used_bytes_num + cur_DA_node->available_bytes_num - size - sizeof(dynamic_allocation_node_t);
-            end_index = (start_index + size + sizeof(dynamic_allocation_node_t) - 1) / PAGE_SIZE;
-            start_index = start_index / PAGE_SIZE;
-            for(i = (start_index > 1 ? start_index - 1 : start_index) ; i <= (end_index <= 1022 ? end_index + 1 : end_index) ; i++){
-                dynamic_tables[i].P = 1;
-                block_used[i]++;
+    if(size <= 0 || size > DYNAMIC_MEMORY_SIZE - sizeof(dynamic_allocation_node_t)) return NULL;
+    need = (size + sizeof(dynamic_allocation_node_t) + DA_ALIGN - 1) & ~(DA_ALIGN - 1);
+
+    cli_and_save(flags);
+
+    /* the whole area becomes one free block the first time the heap is used */
+    if(!heap->ready){
+        if(page_frame_available() == 0){
+            restore_flags(flags);
+            return NULL;
+        }
+        DA_pages_hold(heap, (uint32_t)whole_area, (uint32_t)whole_area + DA_FREE_HEAD_SIZE);
+        whole_area->prev_phys = NULL;
+        whole_area->size = DYNAMIC_MEMORY_SIZE;
+        whole_area->used_num = 0;
+        DA_list_push(heap, whole_area);
+        heap->ready = 1;
+    }
+
+    if(need > DA_SLAB_MAX_SIZE){
+        node = DA_large_alloc(heap, need);
+    } else {
+        /* round up to the power-of-two class and pop its list, carving a new slab if it is empty */
+        class_index = DA_bsr(need - 1) + 1 - DA_SLAB_MIN_SHIFT;
+        if(class_index < 0) class_index = 0;
+        if(heap->slab_lists[class_index] != NULL || DA_slab_refill(heap, class_index) == 0){
+            node = heap->slab_lists[class_index];
+            if(DA_slab_block_ok(heap, class_index, node, DA_FREE_MAGIC) && DA_slab_remove(heap, class_index, node) == 0){
+                node->magic = DA_USED_MAGIC;
+                node->prev_phys->used_num++;
+            } else {
+                node = NULL;
             }
+        }
+    }
+    restore_flags(flags);
+
+    return node == NULL ? NULL : node + 1;
+}
 
-            /* then update the target dynamic allocation node */
-            target_DA_node.prev = cur_DA_node;
-            target_DA_node.next = cur_DA_node->next;
-            target_DA_node.start_index = start_index;
-            target_DA_node.end_index = end_index;
-            target_DA_node.used_bytes_num = size;
-            target_DA_node.available_bytes_num = 0;
-            target_DA_node.ptr = cur_DA_node->ptr + cur_DA_node->used_bytes_num + cur_DA_node->available_bytes_num - size;
-
-            /* finally allocate the target space at the end of the available area inside cur_DA_node */
-            memcpy(target_DA_node.ptr - sizeof(dynamic_allocation_node_t), &target_DA_node, sizeof(dynamic_allocation_node_t));
-
-            /* update the current dynamic allocation node and linked list*/
-            if(cur_DA_node->next != NULL) cur_DA_node->next->prev = (dynamic_allocation_node_t*)(target_DA_node.ptr - sizeof(dynamic_allocation_node_t));
-            cur_DA_node->next = (dynamic_allocation_node_t*)(target_DA_node.ptr - sizeof(dynamic_allocation_node_t));
-            cur_DA_node->available_bytes_num -= size + sizeof(dynamic_allocation_node_t);
-
-            return target_DA_node.ptr;
-        } else {
-            if(cur_DA_node == &DA_head_node)    start_index += cur_DA_node->used_bytes_num + cur_DA_node->available_bytes_num;
-            else    start_index += cur_DA_node->used_bytes_num + cur_DA_node->available_bytes_num + sizeof(dynamic_allocation_node_t);
-            cur_DA_node = cur_DA_node->next;
+/* dynamic_heap_free - free the given area specified by the input ptr
+ * Inputs: heap - the heap, it must be mapped in the current address space
+ *         ptr - the size of the dynamic allocate area
+ * Outputs: None
+ * Return: 0 if free successfully, -1 otherwise
+ */
+int32_t dynamic_heap_free(dynamic_heap_t* heap, void* ptr){
+    dynamic_allocation_node_t* node = (dynamic_allocation_node_t*)ptr - 1;
+    uint32_t flags, size;
+    int32_t class_index, result = -1;
+
+    /* the header right before ptr tells everything, but a process may have rewritten it,
+       so check it against the heap before trusting the size or any neighbour it names */
+    cli_and_save(flags);
+    if(DA_head_ok(heap, node, DA_USED_MAGIC)){
+        size = node->size;
+        if(size > DA_SLAB_MAX_SIZE){
+            if(DA_large_ok(heap, node)){
+                DA_large_free(heap, node);
+                result = 0;
+            }
+        } else if(size >= (1 << DA_SLAB_MIN_SHIFT)){
+            class_index = DA_bsr(size) - DA_SLAB_MIN_SHIFT;
+            if(DA_slab_block_ok(heap, class_index, node, DA_USED_MAGIC) && node->prev_phys->used_num != 0){
+                DA_slab_free(heap, class_index, node);
+                result = 0;
+            }
         }
     }
+    restore_flags(flags);
+    return result;
+}
 
-    /* if no node has enough space, allocate fails */
-    return NULL;
+/* dynamic_heap_release - give every page of a heap back at once, used when its process halts
+ * Inputs: heap - the heap
+ * Outputs: None
+ * Return: None
+ * Side Effects: flushes the TLB
+ */
+void dynamic_heap_release(dynamic_heap_t* heap){
+    uint32_t i, flags;
+
+    if(heap == NULL) return;
+    cli_and_save(flags);
+    for(i = 0; i < PAGE_TBL_SIZE; i++){
+        if(heap->tables[i].P == 0) continue;
+        heap->tables[i].P = 0;
+        page_frame_free(heap->tables[i].ADDR << 12);
+    }
+    DA_heap_init(heap, heap->start, heap->tables, heap->user);
+    asm volatile(
+        "movl %%cr3, %%eax;"
+        "movl %%eax, %%cr3;"
+        : : : "eax", "memory"
+    );
+    restore_flags(flags);
 }
 
-/* free - free the given area specified by the input ptr
+/* malloc - dynamic allocate one memory area with input size from the kernel heap
+ * Inputs: size - the size of the dynamic allocate area
+ * Outputs: None
+ * Return: the pointer pointing to the target area if successfully
+ *         NULL if allocate fails
+ */
+void* malloc(int32_t size){
+    return dynamic_heap_malloc(&kernel_heap, size);
+}
+
+/* free - free the given area of the kernel heap specified by the input ptr
  * Inputs: ptr - the size of the dynamic allocate area
  * Outputs: None
  * Return: 0 if free successfully, -1 otherwise
  */
 int32_t free(void* ptr){
-    dynamic_allocation_node_t* cur_DA_node = DA_head_node.next;
-    dynamic_allocation_node_t* prev_node;
-    dynamic_allocation_node_t* next_node;
-    int32_t i, start_index, end_index;
-    
-    /* if ptr is invalid or only has head node (nothing has been allocated yet), free fails */
-    if(ptr == NULL || cur_DA_node == NULL) return -1;
-
-    while(cur_DA_node != NULL){
-        /* find the area associated with the input ptr */
-        if(cur_DA_node->ptr == ptr){
-            /* once find it, first update previous node */
-            cur_DA_node->prev->available_bytes_num += cur_DA_node->used_bytes_num + cur_DA_node->available_bytes_num + sizeof(dynamic_allocation_node_t);
-
-            /* then remove the node from the linked list */
-            prev_node = cur_DA_node->prev;
-            next_node = cur_DA_node->next;
-            prev_node->next = next_node;
-            if(next_node != NULL) next_node->prev = prev_node;
-
-            /* finally, turn off the relevant page structure */
-            start_index = cur_DA_node->start_index;
-            end_index = cur_DA_node->end_index;
-            for(i = (start_index > 1 ? start_index - 1 : start_index) ; i <= (end_index <= 1022 ? end_index + 1 : end_index) ; i++){
-                block_used[i]--;
-                /* if no other allocation in this PTE, turn it off */
-                if(block_used[i] == 0) dynamic_tables[i].P = 0;
-            }
+    return dynamic_heap_free(&kernel_heap, ptr);
+}
 
-            return 0;
-        } else {
-            cur_DA_node = cur_DA_node->next;
-        }
+/* dynamic_memory_stats - collect the free space and paging statistics of a heap
+ * Inputs: heap - the heap, a process heap does not need to be the running one
+ *         stats - filled with the snapshot
+ * Outputs: None
+ * Return: None
+ */
+void dynamic_memory_stats(dynamic_heap_t* heap, dynamic_memory_stats_t* stats){
+    dynamic_allocation_node_t* node;
+    uint32_t i, flags, largest = 0;
+    PDE_t* heap_PDE = &page_directory[heap->start >> 22];
+    uint32_t saved_table = heap_PDE->ADDR;
+
+    memset(stats, 0, sizeof(dynamic_memory_stats_t));
+    cli_and_save(flags);
+
+    /* borrow the heap window for the walk in case heap belongs to another process */
+    if(saved_table != (uint32_t)heap->tables >> 12){
+        heap_PDE->ADDR = (uint32_t)heap->tables >> 12;
+        asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3;" : : : "eax", "memory");
+    }
+
+    /* walk every large block in address order, the header of each one is always present */
+    for(node = (dynamic_allocation_node_t*)heap->start; heap->ready && (uint32_t)node < DA_END(heap) &&
+        DA_head_ok(heap, node, 0) && DA_size_ok(heap, node, node->size);
+        node = (dynamic_allocation_node_t*)((uint32_t)node + node->size)){
+        if(node->magic != DA_FREE_MAGIC) continue;
+        stats->total_free_bytes += node->size - sizeof(dynamic_allocation_node_t);
+        stats->free_fragments++;
+        if(node->size > largest) largest = node->size;
+    }
+    for(i = 0; i < DA_SLAB_CLASS_NUM; i++){
+        stats->total_free_bytes += heap->slab_free_num[i] * ((1 << (i + DA_SLAB_MIN_SHIFT)) - sizeof(dynamic_allocation_node_t));
+    }
+    if(largest > 0) stats->largest_free_block = largest - sizeof(dynamic_allocation_node_t);
+    else if(heap->slab_lists[DA_SLAB_CLASS_NUM - 1] != NULL) stats->largest_free_block = DA_SLAB_MAX_SIZE - sizeof(dynamic_allocation_node_t);
+
+    /* an unused heap still has its whole area to give */
+    if(!heap->ready){
+        stats->total_free_bytes = DYNAMIC_MEMORY_SIZE - sizeof(dynamic_allocation_node_t);
+        stats->largest_free_block = stats->total_free_bytes;
+        stats->free_fragments = 1;
+    }
+
+    for(i = 0; i < PAGE_TBL_SIZE; i++){
+        if(heap->tables[i].P == 0) continue;
+        stats->mapped_pages++;
+        if(heap->tables[i].A == 1) stats->touched_pages++;
+    }
+
+    if(saved_table != (uint32_t)heap->tables >> 12){
+        heap_PDE->ADDR = saved_table;
+        asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3;" : : : "eax", "memory");
     }
-    return -1;
+    restore_flags(flags);
 }
@@ -6,26 +6,77 @@
 #define _DYNAMIC_ALLOC_H
 
 #include "types.h"
+#include "paging.h"
 
 /* define basic constant for the dynamic allocation system */
-#define DYNAMIC_MEMORY_START (_128_MB + FOUR_MB * 3)    // start at 140 MB
+#define KERNEL_HEAP_START (_128_MB + FOUR_MB * 2)       // kernel heap starts at 136 MB
+#define DYNAMIC_MEMORY_START (_128_MB + FOUR_MB * 3)    // heap of the running process starts at 140 MB
 #define DYNAMIC_MEMORY_BLOCK_SIZE 4096                  // 4kB per dynamic block
-#define DYNAMIC_MEMORY_SIZE FOUR_MB                     // has total 4 MB size
+#define DYNAMIC_MEMORY_SIZE FOUR_MB                     // each heap has total 4 MB size
 
-/* define the dynamic memory node structure */
+/* small requests come from power-of-two slab classes, class i holds blocks of exactly 2^(i+5) bytes */
+#define DA_ALIGN 16                                     // every block size is a multiple of 16 bytes
+#define DA_SLAB_MIN_SHIFT 5                             // smallest slab block is 32 bytes, 16 of them usable
+#define DA_SLAB_MAX_SHIFT 11                            // largest slab block is 2 kB
+#define DA_SLAB_MAX_SIZE (1 << DA_SLAB_MAX_SHIFT)
+#define DA_SLAB_CLASS_NUM (DA_SLAB_MAX_SHIFT - DA_SLAB_MIN_SHIFT + 1)
+#define DA_SLAB_SIZE PAGE_SIZE                          // slab blocks are carved one page at a time
+
+/* large requests use TLSF-style two level lists, first level i holds blocks of size [2^(i+11), 2^(i+12)),
+   each first level is cut into DA_SL_NUM equal second level ranges */
+#define DA_MAX_SHIFT 22                                 // largest block is the whole 4 MB area
+#define DA_CLASS_NUM (DA_MAX_SHIFT - DA_SLAB_MAX_SHIFT + 1)
+#define DA_SL_SHIFT 3
+#define DA_SL_NUM (1 << DA_SL_SHIFT)
+#define DA_USED_MAGIC 0xA110CA7E                        // marks a block handed out by malloc
+#define DA_FREE_MAGIC 0xF2EEB10C                        // marks a block sitting in a free list
+
+/* define the dynamic memory node structure, stored right before the pointer returned by malloc */
 typedef struct dynamic_allocation_node {
-    struct dynamic_allocation_node* prev;
-    struct dynamic_allocation_node* next;
-    int32_t start_index;                // mark the corresponding start index of the PTE index
-    int32_t end_index;                  // mark the corresponding end index of the PTE index
-    uint32_t used_bytes_num;
-    uint32_t available_bytes_num;
-    uint8_t* ptr;
+    struct dynamic_allocation_node* prev_phys;  // large block right before this one in memory, NULL for the first one,
+                                                // or the slab a slab block was carved from
+    uint32_t size;                              // size of the whole block including this header
+    uint32_t magic;                             // DA_USED_MAGIC or DA_FREE_MAGIC
+    uint32_t used_num;                          // number of blocks handed out from a slab, unused otherwise
 } dynamic_allocation_node_t;
 
+/* free list links, kept in the first bytes after the header while a block is free */
+typedef struct dynamic_free_links {
+    dynamic_allocation_node_t* prev;
+    dynamic_allocation_node_t* next;
+} dynamic_free_links_t;
+
+/* one heap, the kernel has one and every process gets its own, pages are backed only while blocks use them */
+typedef struct dynamic_heap {
+    uint32_t start;                                             // virtual address of the heap area
+    PTE_t* tables;                                              // page table mapping the heap area
+    uint32_t user;                                              // 1 if user programs may touch the heap pages
+    uint32_t ready;                                             // 0 until the first malloc builds the first free block
+    dynamic_allocation_node_t* slab_lists[DA_SLAB_CLASS_NUM];   // free blocks of each power-of-two slab class
+    uint32_t slab_free_num[DA_SLAB_CLASS_NUM];                  // number of blocks in each slab list
+    dynamic_allocation_node_t* free_lists[DA_CLASS_NUM][DA_SL_NUM]; // two level segregated lists of large blocks
+    uint32_t fl_map;                                            // bit i set iff sl_map[i] is non-zero
+    uint32_t sl_map[DA_CLASS_NUM];                              // bit j set iff free_lists[i][j] is non-empty
+    uint32_t block_used[PAGE_TBL_SIZE];                         // number of blocks using each page of the area
+} dynamic_heap_t;
+
+/* snapshot of the dynamic memory region reported by show_memory_usage and the memstat system call */
+typedef struct dynamic_memory_stats {
+    uint32_t total_free_bytes;      // free bytes in large blocks and in slab free lists
+    uint32_t largest_free_block;    // largest request a single malloc can still satisfy
+    uint32_t free_fragments;        // number of free large blocks
+    uint32_t mapped_pages;          // dynamic pages with the present bit on
+    uint32_t touched_pages;         // mapped pages accessed since they got mapped
+} dynamic_memory_stats_t;
+
 /* functoins used by dynamic allocation system */
 void dynamic_allocation_init(void);
 void* malloc(int32_t size);
 int32_t free(void* ptr);
+dynamic_heap_t* process_heap_init(uint32_t pid);
+void* dynamic_heap_malloc(dynamic_heap_t* heap, int32_t size);
+int32_t dynamic_heap_free(dynamic_heap_t* heap, void* ptr);
+void dynamic_heap_release(dynamic_heap_t* heap);
+void dynamic_memory_stats(dynamic_heap_t* heap, dynamic_memory_stats_t* stats);
 
 #endif /* _DYNAMIC_ALLOC_H */
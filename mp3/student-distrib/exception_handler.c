@@ -18,6 +18,11 @@ extern void __exc_divide_error()
 
 extern void __exc_page_fault()
 {
+    uint32_t fault_addr;
+    asm volatile("movl %%cr2, %0" : "=r"(fault_addr));
+    // pages of the user program are loaded the first time they are touched
+    if (program_page_fault(fault_addr) == 0)
+        return;
     printf("Exception 0x%x: " "page fault" "\n" , 0);
     send_signal(SIGNUM_SEGFAULT);
 }
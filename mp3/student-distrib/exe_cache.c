@@ -0,0 +1,171 @@
+/* exe_cache.c - cache validated executable images across execute calls
+ * vim:ts=4 noexpandtab
+ */
+
+#include "exe_cache.h"
+#include "filesys.h"
+#include "dynamic_alloc.h"
+#include "lib.h"
+#include "scheduler.h"
+
+static exe_cache_entry_t exe_cache[EXE_CACHE_SIZE];
+static uint32_t exe_cache_clock = 0;    // increase on every hit or fill, used as LRU timestamp
+uint32_t exe_cache_hit_num = 0;
+uint32_t exe_cache_miss_num = 0;
+
+/* exe_cache_drop (PRIVATE)
+ *
+ * give the image of an entry back to the kernel heap and empty the slot
+ * Inputs: entry - the entry to be dropped, must not be referenced
+ * Outputs: None
+ * Side Effects: free the image
+ */
+static void exe_cache_drop(exe_cache_entry_t* entry){
+    free(entry->image);
+    entry->image = NULL;
+    entry->valid = 0;
+    entry->stale = 0;
+}
+
+/* exe_cache_victim (PRIVATE)
+ *
+ * find a slot to hold a new image, prefer an empty slot, otherwise the least recently used unreferenced one
+ * Inputs: None
+ * Outputs: the slot, NULL if every slot is used by a running process or being loaded
+ * Side Effects: the victim image is freed, must be called with interrupts disabled
+ */
+static exe_cache_entry_t* exe_cache_victim(void){
+    int32_t i;
+    exe_cache_entry_t* victim = NULL;
+    for(i = 0; i < EXE_CACHE_SIZE; i++){
+        if(!exe_cache[i].valid) return &exe_cache[i];
+        if(exe_cache[i].ref_count == 0 && (victim == NULL || exe_cache[i].last_used < victim->last_used)){
+            victim = &exe_cache[i];
+        }
+    }
+    if(victim != NULL) exe_cache_drop(victim);
+    return victim;
+}
+
+/* exe_cache_load (PRIVATE)
+ *
+ * validate the header of an executable and read the whole file into a claimed slot
+ * Inputs: entry - the slot, marked loading so nobody else touches it
+ * Outputs: 0 on success, -1 if the file is not an executable or the image cannot be read
+ * Side Effects: reads the file system, called with interrupts enabled
+ */
+static int32_t exe_cache_load(exe_cache_entry_t* entry){
+    int32_t length = read_file_length(entry->inode_index);
+
+    if(length < ELF_HEADER_SIZE || read_data(entry->inode_index, 0, entry->header, ELF_HEADER_SIZE) != ELF_HEADER_SIZE ||
+       entry->header[0] != MAGIC_NUM_1 || entry->header[1] != MAGIC_NUM_2 ||
+       entry->header[2] != MAGIC_NUM_3 || entry->header[3] != MAGIC_NUM_4){
+        return -1;
+    }
+
+    /* then keep a pristine copy of the whole image, malloc takes it from the kernel heap whose pages are
+       supervisor only, a user program must never reach an image other processes are loaded from */
+    entry->image = malloc(length);
+    if(entry->image == NULL || read_data(entry->inode_index, 0, entry->image, length) != length) return -1;
+    entry->length = length;
+    entry->entry_point = *((uint32_t*)(entry->header + ELF_ENTRY_OFFSET));
+    return 0;
+}
+
+/* exe_cache_get
+ *
+ * find the cached image of an executable, validate and cache it on a miss
+ * Inputs: inode_index - the inode of the executable
+ * Outputs: the entry with one more reference, NULL if the file is not an executable
+ *          or the image cannot be cached, caller should then load it from the file system
+ * Side Effects: may read the whole file into the kernel heap, interrupts are only disabled
+ *               to look the slot up and claim it, the file is read with them enabled
+ */
+exe_cache_entry_t* exe_cache_get(uint32_t inode_index){
+    int32_t i, result;
+    unsigned long flags;
+    exe_cache_entry_t* entry;
+
+    cli_and_save(flags);
+    /* hit, no file system access at all, wait for an image someone else is still reading */
+    for(i = 0; i < EXE_CACHE_SIZE; i++){
+        if(!exe_cache[i].valid || exe_cache[i].stale || exe_cache[i].inode_index != inode_index) continue;
+        if(exe_cache[i].loading && sched_running != -1){
+            sched_sleep(&exe_cache[i]);
+            i = -1; // the slot may have been dropped or reused meanwhile, look again
+            continue;
+        }
+        if(exe_cache[i].loading) break;
+        exe_cache_hit_num++;
+        exe_cache[i].ref_count++;
+        exe_cache[i].last_used = ++exe_cache_clock;
+        restore_flags(flags);
+        return &exe_cache[i];
+    }
+    exe_cache_miss_num++;
+
+    /* miss, claim a slot so the image is read only once */
+    entry = exe_cache_victim();
+    if(entry == NULL){
+        restore_flags(flags);
+        return NULL;
+    }
+    entry->valid = 1;
+    entry->stale = 0;
+    entry->loading = 1;
+    entry->inode_index = inode_index;
+    entry->image = NULL;
+    entry->ref_count = 1;
+    entry->last_used = ++exe_cache_clock;
+    restore_flags(flags);
+
+    result = exe_cache_load(entry);
+
+    cli_and_save(flags);
+    entry->loading = 0;
+    sched_wake(entry);
+    /* a file written while it was read may have left a torn image, let the caller read it again */
+    if(result == -1 || entry->stale){
+        entry->ref_count = 0;
+        exe_cache_drop(entry);
+        entry = NULL;
+    }
+    restore_flags(flags);
+    return entry;
+}
+
+/* exe_cache_put
+ *
+ * drop the reference a process holds on a cached image
+ * Inputs: entry - the entry returned by exe_cache_get
+ * Outputs: None
+ * Side Effects: a stale image is freed once nobody uses it
+ */
+void exe_cache_put(exe_cache_entry_t* entry){
+    unsigned long flags;
+    if(entry == NULL) return;
+    cli_and_save(flags);
+    if(entry->ref_count > 0) entry->ref_count--;
+    if(entry->ref_count == 0 && entry->stale) exe_cache_drop(entry);
+    restore_flags(flags);
+}
+
+/* exe_cache_invalidate
+ *
+ * forget the cached image of a file that has been written
+ * Inputs: inode_index - the inode that has been changed
+ * Outputs: None
+ * Side Effects: the image is freed now, or when the last process using it halts
+ */
+void exe_cache_invalidate(uint32_t inode_index){
+    int32_t i;
+    unsigned long flags;
+    cli_and_save(flags);
+    for(i = 0; i < EXE_CACHE_SIZE; i++){
+        if(exe_cache[i].valid && exe_cache[i].inode_index == inode_index){
+            if(exe_cache[i].ref_count == 0) exe_cache_drop(&exe_cache[i]);
+            else exe_cache[i].stale = 1;
+        }
+    }
+    restore_flags(flags);
+}
@@ -0,0 +1,36 @@
+/* exe_cache.h - Defines the executable image cache
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _EXE_CACHE_H
+#define _EXE_CACHE_H
+
+#include "types.h"
+#include "syscall_task.h"
+
+/* define basic constant for the executable image cache */
+#define EXE_CACHE_SIZE 8        // max number of executable images kept at the same time
+
+/* one cached executable, the image lives in the kernel heap, never in a heap user programs can touch */
+typedef struct exe_cache_entry {
+    uint32_t valid;             // 1 if this slot holds an image
+    uint32_t stale;             // 1 if the file has been written since, no new process may use it
+    uint32_t loading;           // 1 while the image is read in, other callers sleep on the entry
+    uint32_t inode_index;       // the cache is keyed by inode
+    uint32_t length;            // length of the image in bytes
+    uint32_t entry_point;       // entry point read from the validated header
+    uint8_t header[ELF_HEADER_SIZE];
+    uint8_t* image;             // pristine copy of the whole file
+    uint32_t ref_count;         // number of running processes loading pages from this image
+    uint32_t last_used;         // used to pick the least recently used victim
+} exe_cache_entry_t;
+
+/* functions used by the executable image cache */
+exe_cache_entry_t* exe_cache_get(uint32_t inode_index);
+void exe_cache_put(exe_cache_entry_t* entry);
+void exe_cache_invalidate(uint32_t inode_index);
+
+extern uint32_t exe_cache_hit_num;
+extern uint32_t exe_cache_miss_num;
+
+#endif /* _EXE_CACHE_H */
@@ -6,15 +6,36 @@
 #include "x86_desc.h"
 #include "filesys.h"
 #include "pcb.h"
+#include "exe_cache.h"
+#include "bcache.h"
+#include "dcache.h"
+#include "dynamic_alloc.h"
+#include "scheduler.h"
 
 
 /* global variables for file system */
 boot_block_t* boot_block;
 dentry_t* dentries;
 inode_t* inodes;
-data_block_t* datablocks;
-int num_db;
-int occupy_db[64];
+block_dev_t* fs_dev;                // the device the image lives on
+static uint32_t fs_data_start;      // device block of data block 0, right after the inodes
+static uint8_t fs_zero_block[BLOCK_SIZE];
+
+/* free data block bitmap, bit i of word i / 32 is set iff data block i is used,
+   bits past the last data block are set as well so a search never returns them,
+   it is allocated at mount with one bit for each data block of the image */
+static uint32_t* db_bitmap = NULL;
+static uint32_t db_bitmap_words;    // words covering data_blocks_num
+uint32_t db_free_num;
+static void db_bitmap_init(void);
+static uint32_t fs_write_busy = 0;  // 1 while a write or truncate takes blocks and changes an inode
+
+/* root directory name index, each slot holds a dentry index or DENTRY_HASH_EMPTY */
+static uint8_t dentry_hash_table[DENTRY_HASH_SIZE];
+static uint32_t dentry_name_hash[MAX_FILE_NUM];     // precomputed name hash of each dentry
+uint32_t dentry_index_enabled = 1;
+uint32_t dentry_lookup_cmp_num = 0;
+static void dentry_index_build(void);
 
 operation_table_t file_operation_table = {
     .open_operation = fopen,
@@ -32,45 +53,372 @@ operation_table_t dir_operation_table = {
 
 /* filesys_init
  *
- * initialize the file system with given in memory boot block
- * Inputs: in_memory_boot_block - the given boot block
- * Outputs: none
- * Side Effects: None
+ * initialize the file system on a block device, the boot block and the inodes stay in memory
+ * and data blocks are read and written through the buffer cache
+ * Inputs: dev - the device holding the image
+ * Outputs: -1 if the device holds no valid image or there is no memory for it, 0 otherwise
+ * Side Effects: a device that is not memory gets its boot block and inodes read into the kernel heap,
+ *               the free data block bitmap of the image is allocated in the kernel heap
  */
-void filesys_init(boot_block_t* in_memory_boot_block){
-    boot_block = in_memory_boot_block;
+int32_t filesys_init(block_dev_t* dev){
+    boot_block_t* new_boot_block;
+    inode_t* new_inodes = NULL;
+    uint32_t* new_bitmap;
+    uint32_t i;
+
+    if(dev->block_num == 0) return -1;
+    if(dev->mem != NULL){
+        new_boot_block = (boot_block_t*)dev->mem;
+    } else {
+        if(NULL == (new_boot_block = malloc(BLOCK_SIZE))) return -1;
+        if(dev->read_block(dev, 0, (uint8_t*)new_boot_block) == -1) goto fail;
+    }
+    /* a blank disk has no root, and the inodes and data blocks it counts have to be on the device,
+       each count is checked on its own so garbage cannot wrap the sum around */
+    if(new_boot_block->dir_entry_num == 0 || new_boot_block->dir_entry_num > MAX_FILE_NUM ||
+       new_boot_block->inodes_num == 0 || new_boot_block->inodes_num >= dev->block_num ||
+       new_boot_block->data_blocks_num >= dev->block_num - new_boot_block->inodes_num) goto fail;
+    for(i = 0; i < new_boot_block->dir_entry_num; i++){
+        if(new_boot_block->dentries[i].file_type != RTC_FILE_TYPE &&
+           new_boot_block->dentries[i].inode_index >= new_boot_block->inodes_num) goto fail;
+    }
+
+    if(NULL == (new_bitmap = malloc((new_boot_block->data_blocks_num / 32 + 1) * 4))) goto fail;
+    if(dev->mem != NULL){
+        new_inodes = (inode_t*)(new_boot_block + 1);    // inodes following the boot_block
+    } else {
+        if(NULL == (new_inodes = malloc(new_boot_block->inodes_num * BLOCK_SIZE))) goto fail_bitmap;
+        for(i = 0; i < new_boot_block->inodes_num; i++){
+            if(dev->read_block(dev, i + 1, (uint8_t*)&new_inodes[i]) == -1) goto fail_bitmap;
+        }
+        bcache_init();
+    }
+
+    /* everything is loaded, only now the file system switches to the new image */
+    boot_block = new_boot_block;
     dentries = boot_block->dentries;
-    inodes = (inode_t*)(boot_block + 1);    // inodes following the boot_block
-    datablocks = (data_block_t*)(inodes + boot_block->inodes_num); // data blocks following the inodes
-    return;
+    inodes = new_inodes;
+    fs_dev = dev;
+    fs_data_start = 1 + boot_block->inodes_num;    // data blocks following the inodes
+    if(db_bitmap != NULL) free(db_bitmap);
+    db_bitmap = new_bitmap;
+    dentry_index_build();
+    dcache_init();
+    db_bitmap_init();
+    return 0;
+
+fail_bitmap:
+    free(new_bitmap);
+fail:
+    if(dev->mem == NULL){
+        if(new_inodes != NULL) free(new_inodes);
+        free(new_boot_block);
+    }
+    return -1;
+}
+
+/* fs_inode_sync (PRIVATE)
+ *
+ * store the in memory copy of an inode back to the device after it changed
+ * Inputs: inode - the inode index in the inodes
+ * Outputs: None
+ * Side Effects: only the length and the block indices in use are written
+ */
+static void fs_inode_sync(uint32_t inode){
+    uint32_t num = (inodes[inode].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bcache_write(fs_dev, 1 + inode, 0, (const uint8_t*)&inodes[inode], sizeof(uint32_t) * (1 + num));
+}
+
+/* db_bsf (PRIVATE) - index of the lowest set bit, value must not be 0 */
+static inline uint32_t db_bsf(uint32_t value){
+    uint32_t index;
+    asm volatile("bsfl %1, %0" : "=r"(index) : "rm"(value) : "cc");
+    return index;
+}
+
+/* db_is_free (PRIVATE) - 1 if the data block is not used by any file */
+static inline uint32_t db_is_free(uint32_t block){
+    return !(db_bitmap[block >> 5] & (1U << (block & 31)));
+}
+
+/* db_mark (PRIVATE)
+ *
+ * mark a data block used or free in the bitmap
+ * Inputs: block - the data block index, blocks past the image are ignored
+ *         used - 1 to mark it used, 0 to mark it free
+ * Outputs: None
+ * Side Effects: change the bitmap and db_free_num
+ */
+static void db_mark(uint32_t block, uint32_t used){
+    if(block >= boot_block->data_blocks_num) return;
+    if(used){
+        db_bitmap[block >> 5] |= 1U << (block & 31);
+        db_free_num--;
+    } else {
+        db_bitmap[block >> 5] &= ~(1U << (block & 31));
+        db_free_num++;
+    }
+}
+
+/* db_bitmap_init (PRIVATE)
+ *
+ * build the free data block bitmap by walking the blocks of every inode
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: change the bitmap and db_free_num
+ */
+static void db_bitmap_init(void){
+    uint32_t i, j, num, block, data_blocks_num;
+
+    data_blocks_num = boot_block->data_blocks_num;
+    db_bitmap_words = (data_blocks_num + 31) / 32;
+    memset(db_bitmap, 0, db_bitmap_words * 4);
+    if(data_blocks_num % 32 != 0){
+        db_bitmap[db_bitmap_words - 1] = 0xFFFFFFFF << (data_blocks_num % 32);
+    }
+    db_free_num = data_blocks_num;
+
+    for(i = 0; i < boot_block->inodes_num; i++){
+        num = (inodes[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        for(j = 0; j < num && j < MAX_FILE_BLOCK_NUM; j++){
+            block = inodes[i].data_block_index[j];
+            if(block < data_blocks_num && db_is_free(block)) db_mark(block, 1);
+        }
+    }
+}
+
+/* db_find_free (PRIVATE)
+ *
+ * find the first free data block at or after start, looking at 32 blocks per step
+ * Inputs: start - the data block index to start from
+ * Outputs: the index of the free block, -1 if there is none
+ * Side Effects: None
+ */
+static int32_t db_find_free(uint32_t start){
+    uint32_t word = start >> 5;
+    uint32_t free_bits;
+    if(word >= db_bitmap_words) return -1;
+    free_bits = ~db_bitmap[word] & (0xFFFFFFFF << (start & 31));
+    while(free_bits == 0){
+        if(++word >= db_bitmap_words) return -1;
+        free_bits = ~db_bitmap[word];
+    }
+    return (word << 5) + db_bsf(free_bits);
+}
+
+/* db_free_run (PRIVATE)
+ *
+ * count the free data blocks in a row starting from start
+ * Inputs: start - a free data block index
+ *         max - stop counting after this many blocks
+ * Outputs: length of the run, at most max
+ * Side Effects: None
+ */
+static uint32_t db_free_run(uint32_t start, uint32_t max){
+    uint32_t len = 0;
+    while(len < max && start + len < (db_bitmap_words << 5) && db_is_free(start + len)) len++;
+    return len;
+}
+
+/* db_alloc_extent (PRIVATE)
+ *
+ * take a run of contiguous free data blocks, right after hint if possible so the file stays contiguous,
+ * otherwise the first run of want blocks, otherwise the longest run found
+ * Inputs: hint - the block the run should start at, usually the one after the last block of the file
+ *         want - number of blocks needed, at least 1
+ *         len - filled with the length of the run taken, between 1 and want
+ * Outputs: first data block of the run, -1 if no block is free
+ * Side Effects: mark the run used
+ */
+static int32_t db_alloc_extent(uint32_t hint, uint32_t want, uint32_t* len){
+    int32_t start, best = -1;
+    uint32_t run, best_run = 0, i;
+
+    if(hint < (db_bitmap_words << 5) && db_is_free(hint)){
+        best = hint;
+        best_run = db_free_run(hint, want);
+    } else {
+        start = db_find_free(0);
+        while(start != -1){
+            run = db_free_run(start, want);
+            if(run > best_run){
+                best = start;
+                best_run = run;
+                if(run == want) break;
+            }
+            start = db_find_free(start + run);
+        }
+        if(best == -1) return -1;
+    }
+
+    for(i = 0; i < best_run; i++){
+        db_mark(best + i, 1);
+    }
+    *len = best_run;
+    return best;
+}
+
+/* dentry_name_hashing (PRIVATE)
+ *
+ * compute the FNV-1a hash of a file name, stop at '\0' or after MAX_FILE_NAME bytes
+ * Inputs: fname - the file name to be hashed
+ * Outputs: the hash value
+ * Side Effects: None
+ */
+static uint32_t dentry_name_hashing(const uint8_t* fname){
+    uint32_t i;
+    uint32_t hash = 2166136261U;    // FNV offset basis
+    for(i = 0; i < MAX_FILE_NAME && fname[i] != '\0'; i++){
+        hash ^= fname[i];
+        hash *= 16777619U;          // FNV prime
+    }
+    return hash;
+}
+
+/* dentry_index_build (PRIVATE)
+ *
+ * build the directory name index from all the dentries in the boot block, called when the file system is mounted
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: change the directory name index
+ */
+static void dentry_index_build(void){
+    uint32_t i, j, slot;
+    memset(dentry_hash_table, DENTRY_HASH_EMPTY, DENTRY_HASH_SIZE);
+    for(i = 0; i < boot_block->dir_entry_num && i < MAX_FILE_NUM; i++){
+        dentry_name_hash[i] = dentry_name_hashing(dentries[i].file_name);
+        slot = dentry_name_hash[i] & DENTRY_HASH_MASK;
+        /* linear probing until an empty slot is found, the table has room for every dentry */
+        for(j = 0; j < DENTRY_HASH_SIZE && dentry_hash_table[slot] != DENTRY_HASH_EMPTY; j++){
+            slot = (slot + 1) & DENTRY_HASH_MASK;
+        }
+        dentry_hash_table[slot] = i;
+    }
+}
+
+/* root_lookup (PRIVATE)
+ *
+ * find a file name in the root directory, whose dentries are all in the boot block
+ * Inputs: name - the file name, '\0' terminated unless it takes MAX_FILE_NAME bytes
+ *         dentry - the dentry to be filled with the found file's fields
+ * Outputs: -1 if the name is not in the root directory, 0 if found
+ * Side Effects: change the input dentry
+ */
+static int32_t root_lookup(const uint8_t* name, dentry_t* dentry){
+    uint32_t i, hash, slot;
+    if(dentry_index_enabled){
+        /* probe the name index, only compare names whose hash matches */
+        hash = dentry_name_hashing(name);
+        slot = hash & DENTRY_HASH_MASK;
+        while(dentry_hash_table[slot] != DENTRY_HASH_EMPTY){
+            i = dentry_hash_table[slot];
+            if(dentry_name_hash[i] == hash){
+                dentry_lookup_cmp_num++;
+                if(strncmp((const char*)name, (const char*)dentries[i].file_name, MAX_FILE_NAME) == 0){
+                    read_dentry_by_index(i, dentry);
+                    return 0;
+                }
+            }
+            slot = (slot + 1) & DENTRY_HASH_MASK;
+        }
+        return -1;
+    }
+
+    /* search for the target dentry with the same name */
+    for(i = 0; i < boot_block->dir_entry_num; i++){
+        dentry_lookup_cmp_num++;
+        if(strncmp((const char*)name, (const char*)dentries[i].file_name, MAX_FILE_NAME) == 0){
+            /* if found, call read_dentry_by_index to copy them */
+            read_dentry_by_index(i, dentry);
+            return 0;
+        }
+    }
+    return -1;      // if not found, return -1
+}
+
+/* subdir_lookup (PRIVATE)
+ *
+ * find a file name in a subdirectory, the dentry cache is asked first and
+ * the dentries of the directory are only read on a miss
+ * Inputs: dir - inode of the directory
+ *         name - the file name, '\0' terminated unless it takes MAX_FILE_NAME bytes
+ *         dentry - the dentry to be filled with the found file's fields
+ * Outputs: -1 if the name is not in the directory or the device fails, 0 if found
+ * Side Effects: change the input dentry, a name found by reading the directory is added to the dentry cache
+ */
+static int32_t subdir_lookup(uint32_t dir, const uint8_t* name, dentry_t* dentry){
+    dentry_t scan[DIR_SCAN_NUM];
+    uint32_t i, num, hash = dentry_name_hashing(name);
+    int32_t bytes_read;
+
+    if(dcache_lookup(dir, name, hash, dentry) == 0) return 0;
+
+    for(num = 0; (bytes_read = read_data(dir, num * DIR_ENTRY_SIZE, (uint8_t*)scan, sizeof(scan))) > 0; num += DIR_SCAN_NUM){
+        for(i = 0; i < bytes_read / DIR_ENTRY_SIZE; i++){
+            dentry_lookup_cmp_num++;
+            if(strncmp((const char*)name, (const char*)scan[i].file_name, MAX_FILE_NAME) == 0){
+                memcpy(dentry, &scan[i], sizeof(dentry_t));
+                dcache_insert(dir, hash, dentry);
+                return 0;
+            }
+        }
+    }
+    return -1;
 }
 
 /* read_dentry_by_name
  *
- * find the file by name and load that file into input dentry
- * Inputs: fname - the given file name to be found
+ * find the file by path and load that file into input dentry, the path is a list of file names
+ * separated by '/' walked down from the root directory, a leading '/' changes nothing
+ * Inputs: fname - the given path of the file to be found
  *         dentry - the dentry to be filled with the found file's fields
  * Outputs: -1 if file does not exist
  *          0 if file can be found
  * Side Effects: change the input dentry
  */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry){
-    uint32_t i;
+    uint8_t name[MAX_FILE_NAME + 1];
+    uint32_t len, dir;
+    int32_t found = -1;
     /* fail if fname invalid */
-    if(fname == NULL || strlen((int8_t*)fname) > MAX_FILE_NAME) return -1;      // suggested by checkpoint 2, fail if fname too large
+    if(fname == NULL || strlen((const int8_t*)fname) > MAX_PATH_LEN) return -1;
 
     /* fail if dentry is invalid */
     if(dentry == NULL) return -1;
 
-    /* search for the target dentry with the same name */
-    for(i = 0; i < boot_block->dir_entry_num; i++){
-        if(strncmp((const char*)fname, (const char*)dentries[i].file_name, MAX_FILE_NAME) == 0){
-            /* if found, call read_dentry_by_index to copy them */
-            read_dentry_by_index(i, dentry);
-            return 0;
+    /* start from the root directory */
+    dentry->file_type = DIR_FILE_TYPE;
+    dentry->inode_index = ROOT_DIR_INODE;
+    while(1){
+        while(*fname == '/') fname++;
+        if(*fname == '\0') return found;
+
+        /* take the next file name, suggested by checkpoint 2, fail if it is too large */
+        for(len = 0; fname[len] != '\0' && fname[len] != '/'; len++);
+        if(len > MAX_FILE_NAME) return -1;
+        memset(name, 0, sizeof(name));
+        memcpy(name, fname, len);
+
+        /* only a directory has entries to look in */
+        if(dentry->file_type != DIR_FILE_TYPE) return -1;
+        dir = dentry->inode_index;
+        if(dir == ROOT_DIR_INODE){
+            /* the root has no parent, its ".." is itself */
+            if(root_lookup(name, dentry) == -1){
+                if(strncmp((const char*)name, "..", MAX_FILE_NAME) != 0) return -1;
+                memcpy(dentry->file_name, name, MAX_FILE_NAME);
+                dentry->file_type = DIR_FILE_TYPE;
+                dentry->inode_index = ROOT_DIR_INODE;
+            }
+        } else if(subdir_lookup(dir, name, dentry) == -1){
+            return -1;
         }
+
+        fname += len;
+        /* a name followed by '/' has to be a directory */
+        if(*fname == '/' && dentry->file_type != DIR_FILE_TYPE) return -1;
+        found = 0;
     }
-    return -1;      // if not found, return -1
 }
 
 /* read_dentry_by_index
@@ -96,27 +444,25 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry){
     return 0;
 }
 
-/* read_dentry_by_index
+/* read_data
  *
- * read up to length bytes starting from position offset in the file with inode number inode
+ * read up to length bytes starting from position offset in the file with inode number inode,
+ * data blocks that are physically contiguous in the image are merged into one run and read with a single bcache_read
  * Inputs: inode- the inode index in the inodes
  *         offset - the offset position in the file to be read
  *         buf - the buffer the load the read data
  *         length - the length of bytes to be read
- * Outputs: -1 if input inode number is invalid
+ * Outputs: -1 if input inode number is invalid or the device fails
  *          0 if the end of the file has been reached
  *          number of bytes read if read successfully without reaching the end of the file
  * Side Effects: change the input buf
  */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length){
-    uint32_t i;
-    uint32_t j;
     uint32_t byte_read = 0;     // record the index to load
-    uint32_t start_datablock;
-    uint32_t end_datablock;     // closed interval
+    uint32_t cur_block;         // first data block of the current run
+    uint32_t run_end;           // last data block of the current run, closed interval
+    uint32_t run_bytes;         // number of bytes to copy in the current run
     uint32_t startbyte_index;
-    uint32_t endbyte_index;     // closed interval
-    data_block_t* cur_datablock;
     inode_t* cur_inode;
     /* fail if inode out of boundary */
     if(inode >= boot_block->inodes_num) return -1;
@@ -135,120 +481,280 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length
         length = inodes[inode].length - offset;
     }
 
-
-    /* calculate the starting and ending datablock reading byte index */
-    start_datablock = offset / BLOCK_SIZE;
-    end_datablock = (offset + length - 1) / BLOCK_SIZE;
+    /* calculate the starting datablock and byte index */
+    cur_block = offset / BLOCK_SIZE;
     startbyte_index = offset % BLOCK_SIZE;
-    endbyte_index = (offset + length - 1) % BLOCK_SIZE;
     cur_inode = &(inodes[inode]);
 
-
-    if(start_datablock == end_datablock){
-        /* if only involves single datablock, read it and return */
-        cur_datablock = &(datablocks[cur_inode->data_block_index[start_datablock]]);
-        for(i = 0; i < length; i++){
-            buf[i] = cur_datablock->data[startbyte_index + i];
+    while(byte_read < length){
+        /* extend the run as long as more bytes are needed and the next block directly follows the last one */
+        run_end = cur_block;
+        run_bytes = BLOCK_SIZE - startbyte_index;
+        while(run_bytes < length - byte_read &&
+              cur_inode->data_block_index[run_end + 1] == cur_inode->data_block_index[run_end] + 1){
+            run_end++;
+            run_bytes += BLOCK_SIZE;
         }
-        return length;
+        if(run_bytes > length - byte_read) run_bytes = length - byte_read;
+
+        /* copy the whole run at once */
+        if(bcache_read(fs_dev, fs_data_start + cur_inode->data_block_index[cur_block], startbyte_index, buf + byte_read, run_bytes) == -1) return -1;
+        byte_read += run_bytes;
+        cur_block = run_end + 1;
+        startbyte_index = 0;
     }
 
-    /* if involves multiple datablocks, read the rest of start block */
-    cur_datablock = &(datablocks[cur_inode->data_block_index[start_datablock]]);
-    for(i = startbyte_index; i < BLOCK_SIZE; i++){
-        buf[byte_read] = cur_datablock->data[i];
-        byte_read++;
+    return length;
+}
+
+/* read_file_length
+ *
+ * get the length in bytes of the file with inode number inode
+ * Inputs: inode- the inode index in the inodes
+ * Outputs: -1 if input inode number is invalid
+ *          the length of the file otherwise
+ * Side Effects: None
+ */
+int32_t read_file_length(uint32_t inode){
+    if(inode >= boot_block->inodes_num) return -1;
+    return inodes[inode].length;
+}
+
+
+/* fs_write_lock (PRIVATE)
+ *
+ * let one write or truncate at a time check and take data blocks and change an inode,
+ * the device is accessed in between so interrupts cannot stay disabled for the whole call
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: sleeps while another process holds the lock
+ */
+static void fs_write_lock(void){
+    unsigned long flags;
+    cli_and_save(flags);
+    while(fs_write_busy && sched_running != -1) sched_sleep(&fs_write_busy);
+    fs_write_busy = 1;
+    restore_flags(flags);
+}
+
+/* fs_write_unlock (PRIVATE)
+ *
+ * give the lock taken by fs_write_lock back
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: wakes the processes waiting for it
+ */
+static void fs_write_unlock(void){
+    unsigned long flags;
+    cli_and_save(flags);
+    fs_write_busy = 0;
+    sched_wake(&fs_write_busy);
+    restore_flags(flags);
+}
+
+/* fs_write_range (PRIVATE)
+ *
+ * copy bytes into the blocks a file already has, only the blocks whose content changes get dirty
+ * Inputs: cur_inode - the inode of the file
+ *         start - first position in the file to write
+ *         end - position after the last one to write
+ *         src - the bytes for start to end, NULL to write zeros
+ * Outputs: -1 if the device fails, 0 otherwise
+ * Side Effects: change the data blocks of the file
+ */
+static int32_t fs_write_range(inode_t* cur_inode, uint32_t start, uint32_t end, const uint8_t* src){
+    uint32_t pos, chunk, block_offset;
+    for(pos = start; pos < end; pos += chunk){
+        block_offset = pos % BLOCK_SIZE;
+        chunk = BLOCK_SIZE - block_offset;
+        if(chunk > end - pos) chunk = end - pos;
+        if(bcache_write(fs_dev, fs_data_start + cur_inode->data_block_index[pos / BLOCK_SIZE], block_offset,
+                        src == NULL ? fs_zero_block : src + (pos - start), chunk) == -1) return -1;
     }
+    return 0;
+}
+
+/* fs_write (PRIVATE)
+ *
+ * write_data with the write lock held
+ * Inputs: same as write_data
+ * Outputs: same as write_data
+ * Side Effects: same as write_data
+ */
+static int32_t fs_write(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length){
+    uint32_t i, j, run, start, end, split, taken;
+    int32_t block;
+    uint32_t old_length, old_num, new_num;
+    inode_t* cur_inode;
 
-    /* then read the middle blocks */
-    for(i = start_datablock + 1; i < end_datablock; i++){
-        cur_datablock = &(datablocks[cur_inode->data_block_index[i]]);
-        for(j = 0; j < BLOCK_SIZE; j++){
-            buf[byte_read] = cur_datablock->data[j];
-            byte_read++;
+    cur_inode = &(inodes[inode]);
+    end = offset + length;
+    if(end < offset || end > MAX_FILE_BLOCK_NUM * BLOCK_SIZE) return -1;
+    old_length = cur_inode->length;
+    old_num = (old_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    new_num = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if(new_num < old_num) new_num = old_num;
+    /* fail before touching anything if the new blocks cannot fit */
+    if(new_num - old_num > db_free_num) return -1;
+    split = old_num * BLOCK_SIZE;   // first position that goes into a new block
+    taken = old_num;
+
+    /* a cached executable image of this file is out of date from now on */
+    exe_cache_invalidate(inode);
+
+    /* take the missing blocks, the ones the write does not cover whole start as zeros,
+       which also fills the gap between the old end and offset */
+    for(i = old_num; i < new_num; i += run){
+        block = db_alloc_extent(i == 0 ? 0 : cur_inode->data_block_index[i - 1] + 1, new_num - i, &run);
+        for(j = 0; j < run; j++){
+            cur_inode->data_block_index[i + j] = block + j;
+            taken = i + j + 1;
+            if((i + j) * BLOCK_SIZE < offset || (i + j + 1) * BLOCK_SIZE > end){
+                if(bcache_zero(fs_dev, fs_data_start + block + j) == -1) goto fail;
+            }
         }
     }
 
-    /* finally read the end blocks */
-    cur_datablock = &(datablocks[cur_inode->data_block_index[end_datablock]]);
-    for(i = 0; i <= endbyte_index; i++){
-        buf[byte_read] = cur_datablock->data[i];
-        byte_read++;
+    /* the part of the range in new blocks goes first, until it is written the old blocks are untouched */
+    if(end > split){
+        start = offset > split ? offset : split;
+        if(fs_write_range(cur_inode, start, end, buf + (start - offset)) == -1) goto fail;
     }
 
+    /* zero the gap left in the old last block, then copy the part of the range in the old blocks */
+    if(offset > old_length && fs_write_range(cur_inode, old_length, offset < split ? offset : split, NULL) == -1) goto fail;
+    if(offset < split && fs_write_range(cur_inode, offset, end < split ? end : split, buf) == -1) goto fail;
+
+    if(end > old_length){
+        cur_inode->length = end;
+        fs_inode_sync(inode);
+    }
     return length;
-}
 
+fail:
+    /* the length did not change, give back the blocks taken for the write */
+    for(i = old_num; i < taken; i++){
+        db_mark(cur_inode->data_block_index[i], 0);
+    }
+    return -1;
+}
 
-int32_t write_data(uint32_t inode, const uint8_t* buf, uint32_t length){
-    uint32_t i;
-    uint32_t j;
-    uint32_t byte_written = 0;
-    data_block_t* cur_datablock;
-    inode_t* cur_inode = &(inodes[inode]);
+/* write_data
+ *
+ * write length bytes of buf at position offset of the file with inode number inode, the file grows
+ * if the range goes past its end. Only the blocks the range touches are looked at, blocks the file
+ * keeps are only copied into when their content changes, and missing blocks are taken in contiguous
+ * runs after the last one. A gap between the old end and offset reads back as zeros.
+ * Inputs: inode- the inode index in the inodes
+ *         offset - the position in the file to write at
+ *         buf - the bytes to write
+ *         length - the number of bytes to write
+ * Outputs: -1 if input inode number is invalid, there are not enough free data blocks or the device fails,
+ *          the length and the blocks of the file are left as they were, only a device error while
+ *          writing the part of the range inside the old length may leave that part partly written
+ *          the number of bytes written otherwise
+ * Side Effects: change the data blocks and the inode of the file, may sleep until another write is done
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length){
+    int32_t result;
     /* fail if inode out of boundary */
     if(inode >= boot_block->inodes_num) return -1;
     /* fail if buf is invalid */
     if(buf == NULL) return -1;
+    if(length == 0) return 0;
 
-    /* free up all the current occupied data blocks */
-    int32_t num_datablock = (cur_inode->length % BLOCK_SIZE == 0) ? cur_inode->length / BLOCK_SIZE : (cur_inode->length / BLOCK_SIZE + 1);
-    for (i = 0; i < num_datablock; i++) {
-        occupy_db[cur_inode->data_block_index[i]] = 0;
-    }
-    memset(cur_inode->data_block_index, 0, sizeof(uint32_t) * num_datablock);
-    cur_inode->length = 0;
-
-    /* allocate new data blocks */
-    num_datablock = (length % BLOCK_SIZE == 0) ? length / BLOCK_SIZE : (length / BLOCK_SIZE + 1);
-    for (i = 0; i < num_datablock; i++) {
-        for (j = 0; j < 64; j++) {
-            if (occupy_db[j] == 0) {
-                occupy_db[j] = 1;
-                cur_inode->data_block_index[i] = j;
-                break;
-            }
-        }
-        if (j == 64) {
-            return -1;
-        }
+    /* two writers must not both see the same free blocks */
+    fs_write_lock();
+    result = fs_write(inode, offset, buf, length);
+    fs_write_unlock();
+    return result;
+}
+
+/* truncate_data
+ *
+ * cut the file with inode number inode down to length bytes and give back the blocks past the new end
+ * Inputs: inode- the inode index in the inodes
+ *         length - the new length, nothing happens if the file is not longer
+ * Outputs: -1 if input inode number is invalid, 0 otherwise
+ * Side Effects: change the inode of the file and the free data block bitmap, may sleep until a write is done
+ */
+int32_t truncate_data(uint32_t inode, uint32_t length){
+    uint32_t i, old_num, new_num;
+    inode_t* cur_inode;
+    if(inode >= boot_block->inodes_num) return -1;
+
+    cur_inode = &(inodes[inode]);
+    fs_write_lock();
+    if(length >= cur_inode->length){
+        fs_write_unlock();
+        return 0;
     }
 
-    while (byte_written < length) {
-        cur_datablock = &(datablocks[cur_inode->data_block_index[byte_written / BLOCK_SIZE]]);
-        if (length - byte_written < BLOCK_SIZE) {
-            memcpy(cur_datablock->data, buf + byte_written, length - byte_written);
-            byte_written += length - byte_written;
-        } else {
-            memcpy(cur_datablock->data, buf + byte_written, BLOCK_SIZE);
-            byte_written += BLOCK_SIZE;
-        }
+    exe_cache_invalidate(inode);
+    old_num = (cur_inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    new_num = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for(i = new_num; i < old_num; i++){
+        db_mark(cur_inode->data_block_index[i], 0);
     }
+    cur_inode->length = length;
+    fs_inode_sync(inode);
+    fs_write_unlock();
+    return 0;
+}
 
-    cur_inode->length = byte_written;
 
-    return byte_written;
+/* dir_entry_num (PRIVATE)
+ *
+ * count the dentries of a directory
+ * Inputs: dir - inode of the directory, ROOT_DIR_INODE for the root
+ * Outputs: the number of dentries, 0 if the inode is invalid
+ * Side Effects: None
+ */
+static uint32_t dir_entry_num(uint32_t dir){
+    if(dir == ROOT_DIR_INODE) return boot_block->dir_entry_num;
+    if(dir >= boot_block->inodes_num) return 0;
+    return inodes[dir].length / DIR_ENTRY_SIZE;
 }
 
+/* dir_entry (PRIVATE)
+ *
+ * get a dentry of a directory, the ones of the root are used in place in the boot block
+ * Inputs: dir - inode of the directory, ROOT_DIR_INODE for the root
+ *         index - the index of the dentry, smaller than dir_entry_num(dir)
+ *         buf - filled with a dentry of a subdirectory
+ * Outputs: the dentry, NULL if the device fails
+ * Side Effects: change the input buf
+ */
+static const dentry_t* dir_entry(uint32_t dir, uint32_t index, dentry_t* buf){
+    if(dir == ROOT_DIR_INODE) return &dentries[index];
+    if(read_data(dir, index * DIR_ENTRY_SIZE, (uint8_t*)buf, DIR_ENTRY_SIZE) != DIR_ENTRY_SIZE) return NULL;
+    return buf;
+}
 
 /* dir_open
  *
  * open a directory if the fd_array has empty sapce and initialize it
- * Inputs: id - meaningless
+ * Inputs: dname - the path of the directory, NULL for the root
  * Outputs: none
  * Return: file descriptor if successfully, -1 if fail
  * Side Effects: None
  */
-int32_t dir_open(const uint8_t* id){
+int32_t dir_open(const uint8_t* dname){
     int32_t i;
     pcb_t* cur_pcb = get_current_pcb();
     file_descriptor_t* cur_fd;
+    dentry_t dentry;
+
+    /* check if the directory exists first */
+    dentry.inode_index = ROOT_DIR_INODE;
+    if(dname != NULL && (read_dentry_by_name(dname, &dentry) == -1 || dentry.file_type != DIR_FILE_TYPE)) return -1;
+
     for(i = 2; i < NUM_FILES; i++){     // 2 as stdin and stdout already been used
         cur_fd = &(cur_pcb->fd_array[i]);
         if(cur_fd->flags == READY_TO_BE_USED){
             /* if there exists empty file descriptor, assign it */
             cur_fd->operation_table = &dir_operation_table;
-            cur_fd->inode_index = 0;
+            cur_fd->inode_index = dentry.inode_index;
             cur_fd->file_position = 0;
             cur_fd->flags = IN_USE;
             return i;
@@ -273,7 +779,7 @@ int32_t dir_close(int32_t id){
 
     cur_fd = &(cur_pcb->fd_array[id]);
     /* if that id is invalid, close fail */
-    if(cur_fd->flags != IN_USE || cur_fd->inode_index != 0) return -1;
+    if(cur_fd->flags != IN_USE || cur_fd->operation_table != &dir_operation_table) return -1;
 
     /* free that file descriptor if every thing all right */
     cur_fd->flags = READY_TO_BE_USED;
@@ -292,32 +798,34 @@ int32_t dir_close(int32_t id){
  */
 int32_t dir_read(int32_t fd, void* buf, int32_t nbytes){
     int32_t i,j;
-    dentry_t dentry;
     int32_t length = nbytes;
     int32_t dentry_read_num = (nbytes % 32 == 0) ? nbytes / 32 : (nbytes / 32 + 1);     // this equal to the smallest integer that is larger or equal to bytes / 4
     int32_t bytes_read = 0;
+    uint32_t entry_num;
     pcb_t* cur_pcb = get_current_pcb();
     file_descriptor_t* cur_fd;
+    const dentry_t* cur_dentry;
+    dentry_t dentry_buf;
     /* if buf is null or fd is invalid, read fails */
     if(buf == NULL || fd < 2 || fd >= NUM_FILES || nbytes < 0) return -1;
 
     if(nbytes == 0) return 0;
 
     cur_fd = &(cur_pcb->fd_array[fd]);
+    entry_num = dir_entry_num(cur_fd->inode_index);
     /* if read reach end, return 0 directly */
-    if(cur_fd->file_position == boot_block->dir_entry_num) return 0;
+    if(cur_fd->file_position >= entry_num) return 0;
 
     for(i = 0; i < dentry_read_num; i++){
         /* check if reach the end */
-        if(cur_fd->file_position + i >= boot_block->dir_entry_num){
-            cur_fd->file_position = boot_block->dir_entry_num;
+        if(cur_fd->file_position + i >= entry_num){
+            cur_fd->file_position = entry_num;
             return bytes_read;
         }
-        /* read the dentry by index, index is recorded in file_position */
-        if(read_dentry_by_index(cur_fd->file_position + i, &dentry) == -1) return -1;
-        /* then copy the target dentry's file name into the buffer */
+        /* copy the file name of the dentry, index is recorded in file_position */
+        if(NULL == (cur_dentry = dir_entry(cur_fd->inode_index, cur_fd->file_position + i, &dentry_buf))) return -1;
         for(j = 0; j < 32 && j < length; j++){               // 32 as max file name 32 bytes
-            ((char*)buf)[bytes_read + j] = dentry.file_name[j];
+            ((char*)buf)[bytes_read + j] = cur_dentry->file_name[j];
         }
         length -= 32;
         bytes_read += j;
@@ -329,6 +837,40 @@ int32_t dir_read(int32_t fd, void* buf, int32_t nbytes){
     return bytes_read;
 }
 
+/* dir_getdents
+ *
+ * read as many directory entries as fit in the buffer, each one as a dirent_t record
+ * with the name, the type, the inode and the length of the file
+ * Inputs: fd - the file descriptor associated with the directory
+ *         buf - the buffer to fill with records
+ *         nbytes - size of the buffer, at least one record
+ * Outputs: None
+ * Return: number of bytes filled, a multiple of sizeof(dirent_t), 0 if reach the end, -1 if fails
+ * Side Effects: move the directory position past the entries read
+ */
+int32_t dir_getdents(int32_t fd, dirent_t* buf, int32_t nbytes){
+    uint32_t i, num, entry_num;
+    const dentry_t* cur_dentry;
+    dentry_t dentry_buf;
+    file_descriptor_t* cur_fd;
+    if(buf == NULL || fd < 2 || fd >= NUM_FILES || nbytes < (int32_t)sizeof(dirent_t)) return -1;
+
+    cur_fd = &(get_current_pcb()->fd_array[fd]);
+    if(cur_fd->flags != IN_USE || cur_fd->operation_table != &dir_operation_table) return -1;
+
+    num = nbytes / sizeof(dirent_t);
+    entry_num = dir_entry_num(cur_fd->inode_index);
+    for(i = 0; i < num && cur_fd->file_position < entry_num; i++, cur_fd->file_position++){
+        if(NULL == (cur_dentry = dir_entry(cur_fd->inode_index, cur_fd->file_position, &dentry_buf))) break;
+        memcpy(buf[i].file_name, cur_dentry->file_name, MAX_FILE_NAME);
+        buf[i].file_type = cur_dentry->file_type;
+        buf[i].inode_index = cur_dentry->inode_index;
+        buf[i].length = (cur_dentry->file_type == REGULAR_FILE_TYPE) ? inodes[cur_dentry->inode_index].length : 0;
+    }
+    if(i == 0 && cur_fd->file_position < entry_num) return -1;
+    return i * sizeof(dirent_t);
+}
+
 /* dir_write
  *
  * not been implemented yet
@@ -370,6 +912,7 @@ int32_t fopen(const uint8_t* fname){
             cur_fd->operation_table = &file_operation_table;
             cur_fd->inode_index = dentry.inode_index;
             cur_fd->file_position = 0;
+            cur_fd->open_flags = 0;
             cur_fd->flags = IN_USE;
             return i;
         }
@@ -411,7 +954,7 @@ int32_t fclose(int32_t fd){
  * Side Effects: None
  */
 int32_t fread(int32_t fd, void* buf, int32_t nbytes){
-    uint32_t bytes_read;
+    int32_t bytes_read;
     pcb_t* cur_pcb = get_current_pcb();
     file_descriptor_t* cur_fd;
     /* if buf is null or fd is invalid or nbytes is invalid, read fails */
@@ -421,6 +964,8 @@ int32_t fread(int32_t fd, void* buf, int32_t nbytes){
     /* read the file starting at the file_position */
     bytes_read = read_data(cur_fd->inode_index, cur_fd->file_position, buf, nbytes);
 
+    /* if the device fails, the file position stays where it was */
+    if(bytes_read == -1) return -1;
     /* if reach the end, return 0*/
     if(bytes_read == 0) return 0;
     
@@ -436,25 +981,29 @@ int32_t fread(int32_t fd, void* buf, int32_t nbytes){
 
 /* fwrite
  *
- * not been implemented yet
+ * write the file at the position of the file descriptor, or at its end if it was opened with O_APPEND,
+ * a file descriptor opened with O_REPLACE also cuts the file off where the write ends
  * Inputs: fd - file associated with file descriptor to be wrote
  *         buf - the buffer holding the content to write
  *         nbytes - the length of bytes to write
  * Outputs: None
- * Return: -1 as not implemented
- * Side Effects: None
+ * Return: number of bytes written if successful, -1 if fails
+ * Side Effects: move the file position past the written bytes
  */
 int32_t fwrite(int32_t fd, const void* buf, int32_t nbytes){
-    uint32_t bytes_written;
     pcb_t* cur_pcb = get_current_pcb();
     file_descriptor_t* cur_fd;
-    /* if buf is null or fd is invalid or nbytes is invalid, read fails */
-    if(buf == NULL || fd < 0 || fd >= NUM_FILES || nbytes < 0) return -1;    
+    /* if buf is null or fd is invalid or nbytes is invalid, write fails */
+    if(buf == NULL || fd < 0 || fd >= NUM_FILES || nbytes < 0) return -1;
     cur_fd = &(cur_pcb->fd_array[fd]);
-    /* read the file starting at 0 
-       this is mandatory as text editor requires to overwrite the entire file */
-    bytes_written = write_data(cur_fd->inode_index, buf, nbytes);
-    if(bytes_written == nbytes)
-        return bytes_written;
-    return -1;
+
+    if(cur_fd->open_flags & O_APPEND){
+        cur_fd->file_position = inodes[cur_fd->inode_index].length;
+    }
+    if(write_data(cur_fd->inode_index, cur_fd->file_position, buf, nbytes) != nbytes) return -1;
+    cur_fd->file_position += nbytes;
+    if(cur_fd->open_flags & O_REPLACE){
+        truncate_data(cur_fd->inode_index, cur_fd->file_position);
+    }
+    return nbytes;
 }
@@ -6,32 +6,54 @@
 #define _FILESYS_H
 
 #include "types.h"
+#include "blockdev.h"
 
 /* define basic constant for mp3 file system */
 #define BLOCK_SIZE 4096     // 4kB per block
 #define DIR_ENTRY_SIZE 64   // each directory entry takes 64 bytes
-#define MAX_FILE_NUM 63     // max number of files supported as (BLOCK_SIZE / DIR_ENTRY_SIZE) - 1(statistics) = 63
+#define MAX_FILE_NUM 63     // max number of files in the root directory as (BLOCK_SIZE / DIR_ENTRY_SIZE) - 1(statistics) = 63
+#define DIR_SCAN_NUM 8      // subdirectory dentries read at a time while looking for a name
+#define MAX_FILE_BLOCK_NUM ((BLOCK_SIZE - 4) / 4)   // data block indices an inode has room for
 
 
 /* define basic constant for directory entry */
 #define MAX_FILE_NAME 32    // max bytes number of file name supported
+#define MAX_PATH_LEN 128    // max bytes number of a path, file names separated by '/'
 #define RTC_FILE_TYPE 0     // unique number to represent RTC file type
-#define DIR_FILE_TYPE 1     // unique number to represent directory file type
-#define REGULAR_FILE_TYPE 2 // unique number to represent regular file type, only this type has meaningful index node (inode)
+#define DIR_FILE_TYPE 1     // unique number to represent directory file type, its inode holds its dentries
+#define ROOT_DIR_INODE 0    // inode index of a directory entry naming the root, whose dentries are in the boot block
+#define REGULAR_FILE_TYPE 2 // unique number to represent regular file type
 
 /* define basic constant for file descriptor */
 #define IN_USE 1            // mark the flag field in file descriptor as being used
 #define READY_TO_BE_USED 0  // mark the flag field in file descriptor as can be used
 
+/* define flags for opening a regular file, writes without any overwrite in place at the file position */
+#define O_APPEND 0x1        // every write goes to the end of the file
+#define O_REPLACE 0x2       // every write also ends the file, the plain open system call uses it so saving a whole file works
+
+/* define basic constant for the root directory name index */
+#define DENTRY_HASH_SIZE 128        // number of slots in the open addressing table, power of 2 and about twice MAX_FILE_NUM
+#define DENTRY_HASH_MASK (DENTRY_HASH_SIZE - 1)
+#define DENTRY_HASH_EMPTY 0xFF      // mark an empty slot, larger than any valid dentry index
+
 
 /* define data structure used by file system */
 typedef struct dentry {
     uint8_t file_name[MAX_FILE_NAME];
     uint32_t file_type;
-    uint32_t inode_index;   // only meaningful to regular file type
+    uint32_t inode_index;   // meaningful to regular file and directory types
     uint8_t reserved[24];   // 24 reserved bytes, DIR_ENTRY_SIZE - MAX_FILE_NAME - 4(file_type) - 4(inode_index) = 24
 } dentry_t;
 
+/* one record filled by dir_getdents */
+typedef struct dirent {
+    uint8_t file_name[MAX_FILE_NAME];   // not '\0' terminated when the name takes all 32 bytes
+    uint32_t file_type;
+    uint32_t inode_index;
+    uint32_t length;                    // length in bytes of a regular file, 0 for other types
+} dirent_t;
+
 typedef struct boot_block {
     uint32_t dir_entry_num;
     uint32_t inodes_num;
@@ -42,7 +64,7 @@ typedef struct boot_block {
 
 typedef struct inode {
     uint32_t length;
-    uint32_t data_block_index[(BLOCK_SIZE - 4) / 4];    // the rest of block all store data block index
+    uint32_t data_block_index[MAX_FILE_BLOCK_NUM];      // the rest of block all store data block index
 } inode_t;
 
 typedef struct data_block {
@@ -65,26 +87,36 @@ typedef struct operation_table {
 
 typedef struct file_descriptor {
     operation_table_t* operation_table; // file type-specific operation table
-    uint32_t inode_index;               // only meaningful to regular file type, 0 for other types
-    uint32_t file_position;             // keep track of where the user is currently reading from the file, updated each time after system call read
+    uint32_t inode_index;               // inode of a regular file or a directory, 0 for the root directory and other types
+    uint32_t file_position;             // keep track of where the user is currently reading from or writing to the file, updated by each read and write
     uint32_t flags;                     // set to indicate this file descriptor is "in use"
+    uint32_t open_flags;                // O_APPEND or O_REPLACE, only meaningful to regular file type
 } file_descriptor_t;
 
 
 /* functions used by file system */
 
-/* initialize the file system*/
-void filesys_init(boot_block_t* in_memory_boot_block);
+/* initialize the file system on a block device */
+int32_t filesys_init(block_dev_t* dev);
 
-/* find the file by name and load that file into input dentry */
+/* find the file by path and load that file into input dentry */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 
-/* find the file by index and load that file into input dentry */
+/* find the file by index in the root directory and load that file into input dentry */
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 
 /* read up to length bytes starting from position offset in the file with inode number inode */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
+/* get the length in bytes of the file with inode number inode */
+int32_t read_file_length(uint32_t inode);
+
+/* write length bytes of buf at position offset in the file with inode number inode */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
+
+/* cut the file with inode number inode down to length bytes */
+int32_t truncate_data(uint32_t inode, uint32_t length);
+
 
 /* type-specific operations used in jump table in file descriptor */
 
@@ -95,6 +127,7 @@ int32_t dir_open(const uint8_t* id);
 int32_t dir_close(int32_t id);
 int32_t dir_read(int32_t fd, void* buf, int32_t nbytes);
 int32_t dir_write(int32_t fd, const void* buf, int32_t nbytes);
+int32_t dir_getdents(int32_t fd, dirent_t* buf, int32_t nbytes);
 
 /* for regular file operations */
 int32_t fopen(const uint8_t* fd);
@@ -102,6 +135,15 @@ int32_t fclose(int32_t fd);
 int32_t fread(int32_t fd, void* buf, int32_t nbytes);
 int32_t fwrite(int32_t fd, const void* buf, int32_t nbytes);
 
+/* lookup statistics used to measure the cost of read_dentry_by_name */
+extern uint32_t dentry_index_enabled;       // 1 to look up through the name index, 0 to scan linearly
+extern uint32_t dentry_lookup_cmp_num;      // number of file name comparisons done by those calls
+
+/* number of data blocks no file uses */
+extern uint32_t db_free_num;
+
+extern block_dev_t* fs_dev;
+
 extern operation_table_t file_operation_table;
 extern operation_table_t dir_operation_table;
 
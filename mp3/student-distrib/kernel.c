@@ -19,6 +19,10 @@
 #include "dynamic_alloc.h"
 #include "GUI/gui.h"
 #include "GUI/bga.h"
+#include "softirq.h"
+#include "blockdev.h"
+#include "bcache.h"
+#include "devices/ata.h"
 
 #define RUN_TESTS
 
@@ -31,7 +35,9 @@
 void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
-    boot_block_t* in_memory_boot_block;
+    uint8_t* fs_module_start = NULL;
+    uint32_t fs_module_size = 0;
+    uint32_t vt_id;
 
     /* Clear the screen. */
     clear();
@@ -67,8 +73,9 @@ void entry(unsigned long magic, unsigned long addr) {
         int mod_count = 0;
         int i;
         module_t* mod = (module_t*)mbi->mods_addr;
-        /* get the in-memory boot block's address */
-        in_memory_boot_block = (boot_block_t*)(mod->mod_start);
+        /* the first module is the file system image */
+        fs_module_start = (uint8_t*)(mod->mod_start);
+        fs_module_size = mod->mod_end - mod->mod_start;
         while (mod_count < mbi->mods_count) {
             printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
             printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
@@ -159,15 +166,30 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
     idt_init();
+    softirq_register(SOFTIRQ_GUI, gui_compose);
+    softirq_register(SOFTIRQ_BCACHE, bcache_flush);
     RTC_init();
     pit_init();
     keyboard_init();
-    filesys_init(in_memory_boot_block);
 
     /* Initialize paging */
     paging_init();
     dynamic_allocation_init();
+    vt_scrollback_init();
 
+    /* the file system lives on the IDE slave disk if it has one, so writes survive a reboot,
+       otherwise on the image grub loaded as a module */
+    if ((ata_init() != 0 || filesys_init(&ata_dev) != 0) &&
+        filesys_init(memdisk_init(fs_module_start, fs_module_size)) != 0) {
+        printf("No valid file system on the disk or in the boot module\n");
+        return;
+    }
+
+
+    /* Start a shell on every terminal, the first PIT tick switches to them */
+    for (vt_id = 0; vt_id < NUM_TERMS; vt_id++) {
+        process_spawn((uint8_t*)"shell", vt_id, 1);
+    }
 
     /* Enable interrupts */
     /* Do not enable the following until after you have set up your
@@ -180,8 +202,6 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Run tests */
     launch_tests();
 #endif
-    /* Execute the first program ("shell") ... */
-    // __syscall_execute((uint8_t*)"shell");
 
     /* Spin (nicely, so we don't chew up cycles) */
     asm volatile (".1: hlt; jmp .1;");
@@ -25,6 +25,7 @@ void clear(void) {
         *(uint8_t *)(video_mem + (i << 1)) = ' ';
         *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
     }
+    gui_mark_all_dirty();
 }
 
 /* Standard printf().
@@ -7,12 +7,20 @@
 #include "lib.h"
 #include "GUI/bga.h"
 
+static uint32_t page_frame_map[PAGE_FRAME_NUM / 32];    // bit i set iff frame i is handed out
+static uint32_t page_frame_free_num;
+static uint32_t page_frame_hint;                        // word of page_frame_map to search first
+
 void paging_init(){
     
     memset(page_table, 0, sizeof(PTE_t) * DIR_TBL_SIZE);
     memset(page_directory, 0, sizeof(PDE_t) * DIR_TBL_SIZE);
     memset(vidmap_table, 0, sizeof(PDE_t) * DIR_TBL_SIZE);
-    memset(dynamic_tables, 0, sizeof(PTE_t) * MAX_PID_NUM);
+    memset(kernel_heap_table, 0, sizeof(kernel_heap_table));
+    memset(heap_tables, 0, sizeof(heap_tables));
+    memset(page_frame_map, 0, sizeof(page_frame_map));
+    page_frame_free_num = PAGE_FRAME_NUM;
+    page_frame_hint = 0;
 
     // Initialize the page table.
     int i;
@@ -43,24 +51,13 @@ void paging_init(){
         vidmap_table[i].ADDR = 0;
     }
 
-    // Set four video memory pages (1 for display, 3 for backup).
-    page_table[VID_MEM_POS].P    = 1;
-    page_table[VID_MEM_POS].ADDR = VID_MEM_POS;
-    page_table[VID_MEM_POS + 1].P = 1;
-    page_table[VID_MEM_POS + 1].ADDR = VID_MEM_POS + 1;
-    page_table[VID_MEM_POS + 2].P = 1;
-    page_table[VID_MEM_POS + 2].ADDR = VID_MEM_POS + 2;
-    page_table[VID_MEM_POS + 3].P = 1;
-    page_table[VID_MEM_POS + 3].ADDR = VID_MEM_POS + 3;
-
-    page_table[GUI_VID_MEM_POS].P    = 1;
-    page_table[GUI_VID_MEM_POS].ADDR = GUI_VID_MEM_POS;
-    page_table[GUI_VID_MEM_POS + 1].P = 1;
-    page_table[GUI_VID_MEM_POS + 1].ADDR = GUI_VID_MEM_POS + 1;
-    page_table[GUI_VID_MEM_POS + 2].P = 1;
-    page_table[GUI_VID_MEM_POS + 2].ADDR = GUI_VID_MEM_POS + 2;
-    page_table[GUI_VID_MEM_POS + 3].P = 1;
-    page_table[GUI_VID_MEM_POS + 3].ADDR = GUI_VID_MEM_POS + 3;
+    // Set the video memory pages, every terminal has a text surface of two pages
+    for (i = 0; i < VID_MEM_PAGE_NUM; i++) {
+        page_table[VID_MEM_POS + i].P    = 1;
+        page_table[VID_MEM_POS + i].ADDR = VID_MEM_POS + i;
+        page_table[GUI_VID_MEM_POS + i].P    = 1;
+        page_table[GUI_VID_MEM_POS + i].ADDR = GUI_VID_MEM_POS + i;
+    }
 
     // Initialize page directories
     for (i = 0; i < DIR_TBL_SIZE; i++) {
@@ -82,23 +79,14 @@ void paging_init(){
     page_directory[1].PS   = 1; // 4MB page
     page_directory[1].ADDR = KERNEL_ADDR >> 12;
 
-    // Set MAX_PID_NUM dynamic memory page
+    // Kernel heap, its pages are wired from the page frame pool when an allocation needs them
+    page_directory[KERNEL_HEAP_START >> 22].P = 1;
+    page_directory[KERNEL_HEAP_START >> 22].ADDR = (uint32_t)(kernel_heap_table) >> 12;
+
+    // Heap of the running process, switched by set_user_PDE
     page_directory[DYNAMIC_MEMORY_START >> 22].P = 1;
     page_directory[DYNAMIC_MEMORY_START >> 22].US = 1;
-    page_directory[DYNAMIC_MEMORY_START >> 22].ADDR = (uint32_t)(dynamic_tables) >> 12;
-    for (i = 0; i < PAGE_TBL_SIZE; i++) {
-        dynamic_tables[i].P    = 0;
-        dynamic_tables[i].RW   = 1;
-        dynamic_tables[i].US   = 1;
-        dynamic_tables[i].PWT  = 0;
-        dynamic_tables[i].PCD  = 0;
-        dynamic_tables[i].A    = 0;
-        dynamic_tables[i].D    = 0;
-        dynamic_tables[i].PAT  = 0;
-        dynamic_tables[i].G    = 0;
-        dynamic_tables[i].AVL  = 0;
-        dynamic_tables[i].ADDR = (DYNAMIC_MEMORY_START + i * PAGE_SIZE) >> 12;
-    }
+    page_directory[DYNAMIC_MEMORY_START >> 22].ADDR = (uint32_t)(heap_tables[0]) >> 12;
 
     // Initialize the page directory for 4kB page tables.
     page_directory[0].P    = 1;
@@ -129,6 +117,10 @@ void paging_init(){
     page_directory[vbe_index].P = 1;
     page_directory[vbe_index].PS = 1;
     page_directory[vbe_index].ADDR = QEMU_BASE_ADDR >> 12;
+    // the back page of the double buffered screen runs into the next 4 MB
+    page_directory[vbe_index + 1].P = 1;
+    page_directory[vbe_index + 1].PS = 1;
+    page_directory[vbe_index + 1].ADDR = (QEMU_BASE_ADDR + FOUR_MB) >> 12;
 
     // Code for manipulating control registers to enable paging.
     asm volatile(
@@ -145,3 +137,106 @@ void paging_init(){
         : "eax"
     );
 }
+
+/* user_table_reset - Reset the user page table of a process
+ *
+ * Mark every 4kB page of the process's user area as not present, so that
+ * a newly executed program is loaded page by page on first touch
+ *
+ * Inputs: pid: The pid whose page table is reset.
+ * Outputs: None
+ * Side Effects: Modifies user_tables[pid].
+ */
+void user_table_reset(uint32_t pid)
+{
+    int i;
+    for (i = 0; i < PAGE_TBL_SIZE; i++) {
+        user_tables[pid][i].P    = 0;
+        user_tables[pid][i].RW   = 1;
+        user_tables[pid][i].US   = 1;
+        user_tables[pid][i].PWT  = 0;
+        user_tables[pid][i].PCD  = 0;
+        user_tables[pid][i].A    = 0;
+        user_tables[pid][i].D    = 0;
+        user_tables[pid][i].PAT  = 0;
+        user_tables[pid][i].G    = 0;
+        user_tables[pid][i].AVL  = 0;
+        user_tables[pid][i].ADDR = (EIGHT_MB + pid * FOUR_MB + i * PAGE_SIZE) >> 12;
+    }
+}
+
+/* set_user_PDE - Set User-Level Page Directory Entry
+ *
+ * Updates the memory paging structure for the new process
+ *
+ * Inputs: pid: The pid for which the PDE is being set.
+ * Outputs: None
+ * Side Effects:
+ *   - Updates the page directory entry for the user process.
+ *   - Flushing the TLB.
+ */
+void set_user_PDE(uint32_t pid)
+{
+    int32_t PDE_index = _128_MB >> 22;
+    page_directory[PDE_index].P    = 1;
+    page_directory[PDE_index].PS   = 0; // 4kB pages, filled on demand by the page fault handler
+    page_directory[PDE_index].US   = 1;
+    page_directory[PDE_index].ADDR = ((uint32_t)user_tables[pid]) >> 12;
+    page_directory[DYNAMIC_MEMORY_START >> 22].ADDR = ((uint32_t)heap_tables[pid]) >> 12;
+
+    // flushing TLB by reloading CR3 register
+    asm volatile (
+        "movl %%cr3, %%eax;"  // Move the value of CR3 into EBX
+        "movl %%eax, %%cr3;"  // Move the value from EBX back to CR3
+        : : : "eax", "memory"
+    );
+}
+
+/* page_frame_alloc - Take one physical frame from the page frame pool
+ *
+ * Inputs: None
+ * Outputs: None
+ * Return: physical address of the frame, 0 if the pool is empty
+ * Side Effects: Marks the frame as used.
+ */
+uint32_t page_frame_alloc(void)
+{
+    uint32_t i, word, bit;
+    if (page_frame_free_num == 0) return 0;
+    for (i = 0; i < PAGE_FRAME_NUM / 32; i++) {
+        word = (page_frame_hint + i) % (PAGE_FRAME_NUM / 32);
+        if (page_frame_map[word] == 0xFFFFFFFF) continue;
+        asm volatile("bsfl %1, %0" : "=r"(bit) : "rm"(~page_frame_map[word]) : "cc");
+        page_frame_map[word] |= 1 << bit;
+        page_frame_free_num--;
+        page_frame_hint = word;
+        return PAGE_FRAME_START + (word * 32 + bit) * PAGE_SIZE;
+    }
+    return 0;
+}
+
+/* page_frame_free - Give one physical frame back to the page frame pool
+ *
+ * Inputs: addr: physical address returned by page_frame_alloc
+ * Outputs: None
+ * Side Effects: Marks the frame as free.
+ */
+void page_frame_free(uint32_t addr)
+{
+    uint32_t index = (addr - PAGE_FRAME_START) / PAGE_SIZE;
+    if (addr < PAGE_FRAME_START || index >= PAGE_FRAME_NUM) return;
+    if (!(page_frame_map[index / 32] & (1 << (index % 32)))) return;
+    page_frame_map[index / 32] &= ~(1 << (index % 32));
+    page_frame_free_num++;
+}
+
+/* page_frame_available - Number of frames left in the page frame pool
+ *
+ * Inputs: None
+ * Outputs: None
+ * Return: the number of free frames
+ */
+uint32_t page_frame_available(void)
+{
+    return page_frame_free_num;
+}
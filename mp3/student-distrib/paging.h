@@ -7,6 +7,7 @@
 #define _PAGING_H
 
 #include "types.h"
+#include "pcb.h"
 
 #define PAGE_SIZE 4096
 #define DIR_TBL_SIZE 1024
@@ -16,7 +17,10 @@
 #define KERNEL_ADDR 0x400000
 #define VID_MEM_POS (VID_MEM_ADDR >> 12)
 #define GUI_VID_MEM_POS (GUI_VID_MEM_ADDR >> 12)
+#define VID_MEM_PAGE_NUM 7             // 3 terminals with 2 pages of text each, 1 page for the scrollback view
 #define NANI_STATIC_BUF_ADDR 0x7000000 // 112 MB
+#define PAGE_FRAME_START 0x8000000     // 128 MB, physical frames backing the heap pages
+#define PAGE_FRAME_NUM 4096            // 16 MB of frames, up to 144 MB
 
 
 /*
@@ -56,8 +60,15 @@ typedef struct page_table_entry {
 PDE_t page_directory[DIR_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));
 PTE_t page_table[PAGE_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));
 PTE_t vidmap_table[PAGE_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));
-PTE_t dynamic_tables[PAGE_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));
+PTE_t kernel_heap_table[PAGE_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));             // 4kB pages of the kernel heap
+PTE_t heap_tables[MAX_PID_NUM][PAGE_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));       // 4kB pages of each process's heap
+PTE_t user_tables[MAX_PID_NUM][PAGE_TBL_SIZE] __attribute__((aligned(PAGE_SIZE)));   // 4kB pages of each process's 4MB user area
 
 void paging_init();
+void user_table_reset(uint32_t pid);
+void set_user_PDE(uint32_t pid);
+uint32_t page_frame_alloc(void);
+void page_frame_free(uint32_t addr);
+uint32_t page_frame_available(void);
 
 #endif /* _PAGING_H */
@@ -1,15 +1,38 @@
 #include "pcb.h"
 
 static int32_t pid_occupied[MAX_PID_NUM] = {0,};
+static pcb_t* pcb_table[MAX_PID_NUM];                       // pcb of each pid, NULL while the pid is free
+static int32_t kernel_stack_used[KERNEL_STACK_NUM] = {0,};  // slot i is the 8kB stack right below 8 MB - i * 8 kB
 
 /* get_pcb_by_pid - get the pcb by pid
  * Inputs: pid - the given pid
- * Outputs: the pcb with the given pid
+ * Outputs: the pcb with the given pid, NULL if the pid is not in use
  * Side Effects: None
  */
 pcb_t* get_pcb_by_pid(uint32_t pid)
 {
-    return (pcb_t *)(EIGHT_MB - (pid + 1) * EIGHT_KB);
+    if (pid >= MAX_PID_NUM) {
+        return NULL;
+    }
+    return pcb_table[pid];
+}
+
+/* pcb_alloc - give a pid a kernel stack from the pool, the pcb lives at its bottom
+ * Inputs: pid - a pid returned by get_available_pid
+ * Outputs: the pcb of the pid, NULL if every kernel stack is taken
+ * Side Effects: the stack goes back to the pool in free_pid
+ */
+pcb_t* pcb_alloc(uint32_t pid)
+{
+    int32_t i;
+    for (i = 0; i < KERNEL_STACK_NUM; i++) {
+        if (kernel_stack_used[i] == 0) {
+            kernel_stack_used[i] = 1;
+            pcb_table[pid] = (pcb_t *)(EIGHT_MB - (i + 1) * EIGHT_KB);
+            return pcb_table[pid];
+        }
+    }
+    return NULL;
 }
 
 /* get_current_pcb - get the current pcb
@@ -31,27 +54,30 @@ pcb_t* get_current_pcb()
  */
 int32_t get_current_pid()
 {
-    uint32_t esp;
-    asm volatile("movl %%esp, %0" : "=r"(esp));
-    return (EIGHT_MB - esp) / EIGHT_KB;
+    return get_current_pcb()->pid;
 }
 
 /* get_available_pid - get the available pid
- * Inputs: None
- * Outputs: the available pid
+ * Inputs: spare - 1 if the caller may take the last free pid, which is kept for the shell
+ *                 that replaces a dying one while the dying one still holds its pid
+ * Outputs: the available pid, -1 if there is none for the caller
  * Side Effects: None
  */
-int32_t get_available_pid()
+int32_t get_available_pid(int32_t spare)
 {
-    int32_t i;
+    int32_t i, pid = -1, free_num = 0;
     for (i = 0; i < MAX_PID_NUM; i++) {
         if (pid_occupied[i] == 0) {
-            pid_occupied[i] = 1;
-            return i;
+            if (pid == -1) pid = i;
+            free_num++;
         }
     }
     // No pid available
-    return -1;
+    if (free_num == 0 || (free_num == 1 && !spare)) {
+        return -1;
+    }
+    pid_occupied[pid] = 1;
+    return pid;
 }
 
 /* free_pid - free the pid
@@ -64,6 +90,11 @@ int32_t free_pid(int32_t pid)
     if (pid < 0 || pid >= MAX_PID_NUM) {
         return -1;
     }
+    if (pcb_table[pid] != NULL) {
+        // the caller may still be running on this stack, nobody takes it before the next execute
+        kernel_stack_used[(EIGHT_MB - (uint32_t)pcb_table[pid]) / EIGHT_KB - 1] = 0;
+        pcb_table[pid] = NULL;
+    }
     pid_occupied[pid] = 0;
     return 0;
 }
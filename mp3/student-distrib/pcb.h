@@ -5,11 +5,13 @@
 #include "signal.h"
 
 #define NUM_FILES 8
-#define MAX_PID_NUM 6
+#define MAX_PID_NUM 16
 #define FOUR_MB 0x400000
 #define EIGHT_MB 0x800000
 #define EIGHT_KB 0x2000
 #define EIGHT_KB_MASK 0xFFFFE000
+#define KERNEL_STACK_NUM MAX_PID_NUM            // 8kB kernel stacks in the pool right below 8 MB
+#define KERNEL_STACK_TOP(pcb) ((uint32_t)(pcb) + EIGHT_KB)  // the pcb sits at the bottom of its kernel stack
 #define _128_MB 0x8000000
 #define USER_STACK_START (_128_MB + FOUR_MB)
 #define EXECUTABLE_START 0x08048000
@@ -17,6 +19,8 @@
 #define USER_VIDMEM_START (_128_MB + FOUR_MB)
 
 typedef struct pcb_s pcb_t;
+struct exe_cache_entry;
+struct dynamic_heap;
 struct pcb_s {
     uint32_t pid;
     file_descriptor_t fd_array[NUM_FILES];
@@ -25,14 +29,21 @@ struct pcb_s {
     signal_t signals[SIG_NUM];
     uint32_t esp;
     uint32_t ebp;
+    uint32_t sched_esp; // kernel stack of the process while the scheduler runs someone else
+    uint32_t sched_ebp;
     uint32_t vt; // which terminal is executing this process
+    uint32_t vidmap; // 1 once the process writes the text buffer directly, the GUI has to rescan it
+    uint32_t exe_inode; // inode of the executable, used to load its pages on demand
+    struct exe_cache_entry* exe_entry; // cached image of the executable, NULL if pages come from the file system
+    struct dynamic_heap* heap; // heap served by malloc and free, released in bulk at halt
 };
 
 extern pcb_t* get_pcb_by_pid(uint32_t pid);
+extern pcb_t* pcb_alloc(uint32_t pid);
 extern pcb_t* get_current_pcb();
 
 extern int32_t get_current_pid();
-extern int32_t get_available_pid();
+extern int32_t get_available_pid(int32_t spare);
 extern int32_t free_pid(int32_t pid);
 extern int32_t check_pid_occupied(int32_t pid);
 
@@ -1,70 +1,254 @@
 #include "scheduler.h"
 
-/* set_user_PDE - Set User-Level Page Directory Entry
- *
- * Updates the memory paging structure for the new process
- *
- * Inputs: pid: The pid for which the PDE is being set.
+/* every pid has an entry, the run queue links the runnable pids that are waiting for the cpu,
+   the running pid is never in the queue */
+sched_entry_t sched_table[MAX_PID_NUM];
+int32_t sched_running = -1;         // pid owning the cpu, -1 until the first switch away from the boot stack
+
+extern void ret_from_syscall_handler(void);
+
+static int32_t run_queue_head = -1;
+static int32_t run_queue_tail = -1;
+
+/* sched_enqueue - append a runnable pid to the run queue
+ * Inputs: pid - the pid to append
  * Outputs: None
- * Side Effects:
- *   - Updates the page directory entry for the user process.
- *   - Flushing the TLB.
+ * Side Effects: must be called with interrupts disabled
  */
+static void sched_enqueue(int32_t pid)
+{
+    sched_table[pid].next = -1;
+    if (run_queue_tail == -1) {
+        run_queue_head = pid;
+    } else {
+        sched_table[run_queue_tail].next = pid;
+    }
+    run_queue_tail = pid;
+}
 
-static void set_user_PDE(uint32_t pid)
+/* sched_dequeue - take the pid at the head of the run queue
+ * Inputs: None
+ * Outputs: the pid, -1 if the queue is empty
+ * Side Effects: must be called with interrupts disabled
+ */
+static int32_t sched_dequeue(void)
 {
-    int32_t PDE_index = _128_MB >> 22;
-    page_directory[PDE_index].P    = 1;
-    page_directory[PDE_index].PS   = 1;
-    page_directory[PDE_index].US   = 1;
-    page_directory[PDE_index].ADDR = (EIGHT_MB + pid * FOUR_MB) >> 12;
-
-    // flushing TLB by reloading CR3 register
-    asm volatile (
-        "movl %%cr3, %%eax;"  // Move the value of CR3 into EBX
-        "movl %%eax, %%cr3;"  // Move the value from EBX back to CR3
-        : : : "eax", "memory"
-    );
+    int32_t pid = run_queue_head;
+    if (pid == -1) return -1;
+    run_queue_head = sched_table[pid].next;
+    if (run_queue_head == -1) run_queue_tail = -1;
+    return pid;
+}
+
+/* sched_entry_init - give a new process a fresh scheduler entry
+ * Inputs: pid - pid of the new process
+ * Outputs: None
+ * Side Effects: None
+ */
+static void sched_entry_init(int32_t pid)
+{
+    sched_table[pid].state = SCHED_RUNNABLE;
+    sched_table[pid].priority = SCHED_DEFAULT_PRIORITY;
+    sched_table[pid].slice_left = SCHED_DEFAULT_PRIORITY;
+    sched_table[pid].wait_channel = NULL;
+    sched_table[pid].cpu_ticks = 0;
+    sched_table[pid].next = -1;
+}
+
+/* sched_start - register a process created by execute, which starts running right away
+ * Inputs: pid - pid of the new process
+ *         parent_pid - pid of the process waiting for it in execute
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled, blocks the parent until sched_exit
+ */
+void sched_start(int32_t pid, int32_t parent_pid)
+{
+    sched_table[parent_pid].state = SCHED_BLOCKED;
+    sched_entry_init(pid);
+    sched_running = pid;
+}
+
+/* sched_spawn - queue a process nobody waits for, it enters user space the first time it is picked
+ * Inputs: pcb - pcb of the new process
+ *         entry_point - address the program starts at
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled. Builds on the new kernel stack the frame
+ *               syscall_handler would leave behind, so the first switch to the process "returns"
+ *               through ret_from_syscall_handler into user space
+ */
+void sched_spawn(pcb_t* pcb, uint32_t entry_point)
+{
+    uint32_t* frame = (uint32_t*)KERNEL_STACK_TOP(pcb);
+    int32_t i;
+
+    // iret frame
+    *(--frame) = USER_DS;
+    *(--frame) = USER_STACK_START;
+    *(--frame) = EFLAGS_INIT;
+    *(--frame) = USER_CS;
+    *(--frame) = entry_point;
+    // registers popped by ret_from_syscall_handler
+    *(--frame) = 0;             // padding
+    *(--frame) = USER_DS;       // fs
+    *(--frame) = USER_DS;       // es
+    *(--frame) = USER_DS;       // ds
+    for (i = 0; i < 7; i++) {
+        *(--frame) = 0;         // eax, ebp, edi, esi, edx, ecx, ebx
+    }
+    // what leave and ret in scheduler pop
+    *(--frame) = (uint32_t)ret_from_syscall_handler;
+    *(--frame) = 0;
+    pcb->sched_esp = (uint32_t)frame;
+    pcb->sched_ebp = (uint32_t)frame;
+
+    sched_entry_init(pcb->pid);
+    sched_enqueue(pcb->pid);
+}
+
+/* sched_exit - forget a halting process, its parent resumes running in its place
+ * Inputs: pid - pid of the halting process
+ *         parent_pid - pid of the parent waiting in execute, -1 if there is none
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled. Without a parent the caller
+ *               gives the cpu away by calling scheduler.
+ */
+void sched_exit(int32_t pid, int32_t parent_pid)
+{
+    sched_table[pid].state = SCHED_UNUSED;
+    if (parent_pid != -1) {
+        sched_table[parent_pid].state = SCHED_RUNNABLE;
+        sched_running = parent_pid;
+    }
+}
+
+/* sched_sleep - give up the cpu until sched_wake is called on the channel
+ * Inputs: channel - address identifying the event to wait for
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled, so the wake up cannot slip in between
+ *               the check of the caller and the sleep. Callers recheck their condition afterwards.
+ */
+void sched_sleep(void* channel)
+{
+    sched_table[sched_running].state = SCHED_SLEEPING;
+    sched_table[sched_running].wait_channel = channel;
+    scheduler();
+}
+
+/* sched_wake - put every pid sleeping on the channel back to the run queue
+ * Inputs: channel - address identifying the event that happened
+ * Outputs: None
+ * Side Effects: called from interrupt handlers, or with interrupts disabled
+ */
+void sched_wake(void* channel)
+{
+    int32_t pid;
+    for (pid = 0; pid < MAX_PID_NUM; pid++) {
+        if (sched_table[pid].state == SCHED_SLEEPING && sched_table[pid].wait_channel == channel) {
+            sched_table[pid].state = SCHED_RUNNABLE;
+            sched_table[pid].wait_channel = NULL;
+            sched_enqueue(pid);
+        }
+    }
+}
+
+/* sched_tick - charge a PIT tick to the running process and preempt it when its slice is used up
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: called from the PIT handler only, never while the cpu is idle
+ */
+void sched_tick(void)
+{
+    int32_t pid = sched_running;
+    if (pid != -1) {
+        sched_table[pid].cpu_ticks++;
+        if (sched_table[pid].slice_left > 1) {
+            sched_table[pid].slice_left--;
+            return;
+        }
+    }
+    scheduler();
+}
+
+/* sched_pick - choose the process to run next
+ * Inputs: None
+ * Outputs: pid of the process that runs next
+ * Side Effects: requeues the running process if it is still runnable,
+ *               halts the cpu without periodic ticks until an interrupt wakes someone if nothing is runnable
+ */
+static int32_t sched_pick(void)
+{
+    int32_t pid = sched_running;
+
+    if (pid != -1 && sched_table[pid].state == SCHED_RUNNABLE) {
+        sched_enqueue(pid);
+    }
+
+    if (-1 == (pid = sched_dequeue())) {
+        // every process is sleeping, stop the periodic tick and wait for an interrupt handler to wake one up
+        pit_idle_enter();
+        do {
+            asm volatile("sti; hlt; cli" ::: "memory");
+        } while (-1 == (pid = sched_dequeue()));
+        pit_idle_exit();
+    }
+
+    // processes on the terminal being looked at get longer slices
+    sched_table[pid].slice_left = sched_table[pid].priority;
+    if (get_pcb_by_pid(pid)->vt == foreground_vt) {
+        sched_table[pid].slice_left += SCHED_FOREGROUND_BONUS;
+    }
+    return pid;
 }
 
 /* scheduler - Context Switching Scheduler
  *
- * Switches execution from the current terminal and process to the next in a round-robin fashion.
+ * Switches execution from the current process to the next runnable one in the run queue,
+ * processes that are sleeping or blocked are skipped, whatever terminal they belong to.
  *
  * Inputs: None
  * Outputs: None (performs a context switch)
- * Side Effects: 
- *   - Changes the active terminal
+ * Side Effects:
+ *   - Changes the active terminal to the one of the next process
  *   - Switches the context to another process
  *   - Updates the memory paging structure for the new process
  *   - Modifies the TSS to point to the new process's kernel stack
  */
 void scheduler() {
-    
-    /* save ESP and EBP */
+
+    /* save ESP and EBP, a halting process has already given its pcb back */
     uint32_t cur_esp, cur_ebp;
     asm volatile("movl %%esp, %0":"=r" (cur_esp));
     asm volatile("movl %%ebp, %0":"=r" (cur_ebp));
+    pcb_t* cur_pcb = (sched_running == -1) ? NULL : get_pcb_by_pid(sched_running);
+    if (cur_pcb != NULL) {
+        cur_pcb->sched_esp = cur_esp;
+        cur_pcb->sched_ebp = cur_ebp;
+        /* the compositor only sees what the terminal driver writes, rescan after a slice of direct writes */
+        if (cur_pcb->vidmap && cur_pcb->vt == foreground_vt) {
+            gui_mark_all_dirty();
+        }
+    }
 
-    /*Switch to another terminal and corresponding process*/
-    int next_pid = vt_set_active_term(cur_esp, cur_ebp);
+    /* Switch to the next process and its terminal */
+    int next_pid = sched_pick();
+    pcb_t* next_pcb = get_pcb_by_pid(next_pid);
+    sched_running = next_pid;
+    vt_set_active_term(next_pcb->vt);
 
     /* Remap the user program */
     set_user_PDE(next_pid);
 
     /* Set tss */
     tss.ss0 = KERNEL_DS;
-    tss.esp0 = EIGHT_MB - next_pid * EIGHT_KB;
+    tss.esp0 = KERNEL_STACK_TOP(next_pcb);
 
-    uint32_t esp, ebp;
-    vt_get_ebp_esp(&esp, &ebp);
     asm volatile("movl %0, %%esp;"
                  "movl %1, %%ebp;"
                  // Same technique used in halt
                  "leave;"
                  "ret;"
-                :: "r"(esp),
-                   "r"(ebp)
+                :: "r"(next_pcb->sched_esp),
+                   "r"(next_pcb->sched_ebp)
                 : "esp", "ebp"
     );
 }
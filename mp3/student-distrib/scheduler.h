@@ -5,9 +5,38 @@
 #include "devices/vt.h"
 #include "pcb.h"
 #include "x86_desc.h"
+#include "devices/pit.h"
 #define EIGHT_MB 0x800000
 #define EIGHT_KB 0x2000
+#define EFLAGS_INIT 0x202       // eflags a new process starts with, only IF and the reserved bit set
 
+/* states of a pid in the scheduler table */
+#define SCHED_UNUSED 0          // pid not in use
+#define SCHED_RUNNABLE 1        // running, or waiting in the run queue for the cpu
+#define SCHED_SLEEPING 2        // waiting in sched_sleep until an interrupt handler wakes it
+#define SCHED_BLOCKED 3         // waiting in execute until its child halts
+
+#define SCHED_DEFAULT_PRIORITY 1    // time slice of a process in PIT ticks
+#define SCHED_FOREGROUND_BONUS 1    // extra ticks given to the process of the foreground terminal
+
+typedef struct sched_entry {
+    uint32_t state;             // one of the SCHED_* states above
+    uint32_t priority;          // length of a time slice in PIT ticks
+    uint32_t slice_left;        // PIT ticks left in the current time slice
+    void* wait_channel;         // what a sleeping pid waits for, NULL otherwise
+    uint32_t cpu_ticks;         // PIT ticks charged to the pid since it got executed
+    int32_t next;               // next pid in the run queue, -1 at the tail
+} sched_entry_t;
+
+extern sched_entry_t sched_table[MAX_PID_NUM];
+extern int32_t sched_running;
+
+extern void sched_start(int32_t pid, int32_t parent_pid);
+extern void sched_spawn(pcb_t* pcb, uint32_t entry_point);
+extern void sched_exit(int32_t pid, int32_t parent_pid);
+extern void sched_sleep(void* channel);
+extern void sched_wake(void* channel);
+extern void sched_tick(void);
 extern void scheduler();
 
 #endif
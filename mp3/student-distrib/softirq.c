@@ -0,0 +1,53 @@
+#include "softirq.h"
+#include "lib.h"
+
+static softirq_handler_t softirq_handlers[SOFTIRQ_NUM];
+static volatile uint32_t softirq_pending = 0;  // bit nr set iff softirq nr has been raised
+static volatile int32_t softirq_running = 0;   // do_softirq is already running further down the stack
+
+/* softirq_register - set the function run for a softirq
+ * Inputs: nr - the softirq number
+ *         handler - the function, run with interrupts enabled
+ * Outputs: None
+ * Side Effects: None
+ */
+void softirq_register(uint32_t nr, softirq_handler_t handler){
+    if(nr >= SOFTIRQ_NUM) return;
+    softirq_handlers[nr] = handler;
+}
+
+/* softirq_raise - ask for a softirq to run once the current interrupt is done
+ * Inputs: nr - the softirq number
+ * Outputs: None
+ * Side Effects: raising it again before it runs has no further effect
+ */
+void softirq_raise(uint32_t nr){
+    uint32_t flags;
+    if(nr >= SOFTIRQ_NUM) return;
+    cli_and_save(flags);
+    softirq_pending |= 1 << nr;
+    restore_flags(flags);
+}
+
+/* do_softirq - run every raised softirq, called at the end of interrupt handlers
+ * Inputs: None
+ * Outputs: None
+ * Side Effects: must be called with interrupts disabled and after the EOI, enables
+ *               interrupts while the handlers run and disables them again before returning.
+ *               An interrupt arriving meanwhile only raises, the outer call runs its work.
+ */
+void do_softirq(void){
+    uint32_t pending, nr;
+    if(softirq_running || softirq_pending == 0) return;
+    softirq_running = 1;
+    while((pending = softirq_pending) != 0){
+        softirq_pending = 0;
+        sti();
+        for(nr = 0; nr < SOFTIRQ_NUM; nr++){
+            if((pending & (1 << nr)) && softirq_handlers[nr] != NULL)
+                softirq_handlers[nr]();
+        }
+        cli();
+    }
+    softirq_running = 0;
+}
@@ -0,0 +1,31 @@
+/* softirq.h - Deferred work raised by interrupt handlers
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+
+/* 
+ *      work that is too slow for an interrupt handler is raised there and run right
+ *      after it, with interrupts enabled, by do_softirq
+ *      +---------------+---------------+---------------------------------------+
+ *      | Softirq Name  | Number        | Work                                  |
+ *      +---------------+---------------+---------------------------------------+
+ *      | GUI           | 0             | repaint dirty terminal rows and clock |
+ *      +---------------+---------------+---------------------------------------+
+ *      | BCACHE        | 1             | write dirty cached blocks back        |
+ *      +---------------+---------------+---------------------------------------+
+*/
+#define SOFTIRQ_NUM 2
+#define SOFTIRQ_GUI 0
+#define SOFTIRQ_BCACHE 1
+
+typedef void (*softirq_handler_t)(void);
+
+extern void softirq_register(uint32_t nr, softirq_handler_t handler);
+extern void softirq_raise(uint32_t nr);
+extern void do_softirq(void);
+
+#endif /* _SOFTIRQ_H */
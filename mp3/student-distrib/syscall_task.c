@@ -4,24 +4,8 @@
 #include "x86_desc.h"
 #include "signal.h"
 #include "dynamic_alloc.h"
-
-static void set_user_PDE(uint32_t pid)
-{
-    int32_t PDE_index = _128_MB >> 22;
-    page_directory[PDE_index].P    = 1;
-    page_directory[PDE_index].PS   = 1;
-    page_directory[PDE_index].US   = 1;
-    page_directory[PDE_index].ADDR = (EIGHT_MB + pid * FOUR_MB) >> 12;
-
-    // flushing TLB by reloading CR3 register
-    asm volatile (
-        "movl %%cr3, %%eax;"  // Move the value of CR3 into EBX
-        "movl %%eax, %%cr3;"  // Move the value from EBX back to CR3
-        : : : "eax", "memory"
-);
-
-
-}
+#include "exe_cache.h"
+#include "scheduler.h"
 
 static void set_vidmap_PDE(){
     int32_t vidmem_index = USER_VIDMEM_START >> 22;
@@ -72,7 +56,7 @@ static int32_t parse_args(const uint8_t* command, uint8_t* filename, uint8_t* ar
 
     // extracting the filename
     while (command[i] != ' ' && command[i] != '\0') {
-        if(name_len >= FILE_NAME_LEN) return INVALID_CMD; // filename too long (longer than 32 bytes
+        if(name_len >= FILE_NAME_LEN) return INVALID_CMD; // filename too long (longer than FILE_NAME_LEN bytes
         filename[j] = command[i];
         i++;
         j++;
@@ -107,18 +91,10 @@ static int32_t parse_args(const uint8_t* command, uint8_t* filename, uint8_t* ar
 }
 
 
-static int32_t executable_check(const uint8_t* name)
+static int32_t executable_check(uint32_t inode_index)
 {
-     // set a new dentry for the file
-    dentry_t cur_dentry;
-    
-    // find the dentry for the file according to its name
-    if (-1 == read_dentry_by_name(name, &cur_dentry)) {
-        return INVALID_CMD; // the filename is invalid
-    }
-
     uint8_t magic_num_buf[MAGIC_NUMBERS_NUM];
-    if (-1 == read_data(cur_dentry.inode_index, 0, magic_num_buf, MAGIC_NUMBERS_NUM)) {
+    if (-1 == read_data(inode_index, 0, magic_num_buf, MAGIC_NUMBERS_NUM)) {
         return INVALID_CMD; // read data fail
     }
 
@@ -130,20 +106,76 @@ static int32_t executable_check(const uint8_t* name)
     return 0; // file executable
 }
 
+/* program_loader - prepare a program to be loaded on demand
+ * Inputs: inode_index - the inode of the executable
+ *         program_entry_point - filled with the entry point in the ELF header
+ * Outputs: 0 if success, -1 if the header cannot be read
+ * Side Effects: None, the image itself is copied page by page in program_page_fault
+ */
 static int32_t program_loader(uint32_t inode_index, uint32_t* program_entry_point)
 {
-    if (-1 == read_data(inode_index, 0, (uint8_t *)EXECUTABLE_START, USER_STACK_START - EXECUTABLE_START)) // This is a little tricky, USER_STACK_START is the end of 4MB page, so we can use it as the end of the loaded program
+    uint8_t header[ELF_HEADER_SIZE];
+    if (ELF_HEADER_SIZE != read_data(inode_index, 0, header, ELF_HEADER_SIZE))
         return -1;
-    *program_entry_point = *((uint32_t *)(EXECUTABLE_START + 24)); // 24 is the offset of the entry point in the header
+    *program_entry_point = *((uint32_t *)(header + ELF_ENTRY_OFFSET));
     return 0;
 }
 
-static pcb_t* create_pcb(uint32_t pid, pcb_t *parent_pcb)
+/* program_page_fault - load one 4kB page of the current program on first touch
+ * Inputs: fault_addr - the linear address that caused the page fault
+ * Outputs: 0 if the page has been loaded, -1 if this is not a demand loading fault
+ * Side Effects: marks the page present, zeroes it and copies the part of the
+ *               executable image that falls inside the page
+ */
+int32_t program_page_fault(uint32_t fault_addr)
+{
+    pcb_t* cur_pcb = get_current_pcb();
+    uint32_t page_addr, dest, offset, length;
+    PTE_t* pte;
+
+    // only the user area of the current process is loaded on demand
+    if (fault_addr < _128_MB || fault_addr >= USER_STACK_START)
+        return -1;
+    page_addr = fault_addr & ~(PAGE_SIZE - 1);
+    pte = &user_tables[cur_pcb->pid][(page_addr - _128_MB) >> 12];
+    if (pte->P)
+        return -1; // the page is already there, this is a real protection fault
+
+    pte->P = 1;
+    asm volatile("invlpg (%0)" : : "r"(page_addr) : "memory");
+    memset((void *)page_addr, 0, PAGE_SIZE); // bss and stack start zeroed
+
+    // copy the part of the image [EXECUTABLE_START, EXECUTABLE_START + length) inside this page
+    if (page_addr + PAGE_SIZE > EXECUTABLE_START) {
+        dest = (page_addr < EXECUTABLE_START) ? EXECUTABLE_START : page_addr;
+        offset = dest - EXECUTABLE_START;
+        length = page_addr + PAGE_SIZE - dest;
+        if (cur_pcb->exe_entry != NULL) {
+            // copy from the cached pristine image
+            if (offset >= cur_pcb->exe_entry->length)
+                return 0;
+            if (length > cur_pcb->exe_entry->length - offset)
+                length = cur_pcb->exe_entry->length - offset;
+            memcpy((void *)dest, cur_pcb->exe_entry->image + offset, length);
+        } else {
+            // read_data stops at the end of the file by itself
+            if (-1 == read_data(cur_pcb->exe_inode, offset, (uint8_t *)dest, length))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static pcb_t* create_pcb(uint32_t pid, pcb_t *parent_pcb, uint32_t vt)
 {
-    pcb_t *pcb = get_pcb_by_pid(pid);
+    pcb_t *pcb = pcb_alloc(pid);
+    if (pcb == NULL) {
+        return NULL; // no kernel stack left
+    }
     memset(pcb, 0, sizeof(pcb_t)); // initialize the pcb to all 0
     pcb->pid = pid;
     pcb->parent_pcb = parent_pcb;
+    pcb->vt = vt;
 
     /* Set up FDs */
     // stdin
@@ -164,55 +196,88 @@ static pcb_t* create_pcb(uint32_t pid, pcb_t *parent_pcb)
     return pcb;
 }
 
-/* __syscall_execute - execute the given command
+/* process_find - parse a command and find the executable it names, shared by execute and spawn
  * Inputs: command - the given command to be executed
- * Outputs: -1 if the command cannot be executed,
- *          256 if the program dies by an exception
- *          0-255 if the program executes a halt system call
- * Side Effects: None
+ *         args - filled with the arguments of the command
+ *         inode_index - filled with the inode of the executable
+ *         exe_entry - filled with the cached image, NULL if the pages are loaded from the file system
+ *         program_entry_point - filled with the address the program starts at
+ * Outputs: 0 on success, -1 if the command cannot be executed
+ * Side Effects: reads the file system, called with interrupts enabled so other processes
+ *               keep running while the executable is read
  */
-int32_t __syscall_execute(const uint8_t* command) {
-    int32_t i;
+static int32_t process_find(const uint8_t* command, uint8_t* args, uint32_t* inode_index,
+                            exe_cache_entry_t** exe_entry, uint32_t* program_entry_point)
+{
     // Parse args
     if (command == NULL) {
-        return INVALID_CMD;
+        return -1;
     }
 
     uint8_t filename[FILE_NAME_LEN + 1];  // store  the file name
-    uint8_t args[ARG_LEN + 1];  // store args
 
     if (parse_args(command, filename, args)) {  // return value should be 0 upon success
-        return INVALID_CMD;
+        return -1;
     }
 
-    // Executable check
-    if (executable_check(filename)) {
-        return INVALID_CMD;
+    // Find the file, then the cached image of it
+    dentry_t cur_dentry;
+    if (-1 == read_dentry_by_name(filename, &cur_dentry) || cur_dentry.file_type != REGULAR_FILE_TYPE) {
+        return -1; // the filename is invalid, or names a directory or the rtc
     }
+    *inode_index = cur_dentry.inode_index;
+    *exe_entry = exe_cache_get(cur_dentry.inode_index);
 
-    // Set up program paging
-    cli();
-    int pid = get_available_pid();
-    if (pid == -1) {
-        sti();
-        return INVALID_CMD; // no available pid
+    // Executable check, the cache has already validated the header of a cached image
+    if (*exe_entry == NULL && executable_check(cur_dentry.inode_index)) {
+        return -1;
     }
-    set_user_PDE(pid);
 
     // User-level Program Loader
-    dentry_t cur_dentry;
-    read_dentry_by_name(filename, &cur_dentry);
-    uint32_t program_entry_point;
-    if (-1 == program_loader(cur_dentry.inode_index, &program_entry_point)) {
-        return INVALID_CMD; // program loader fail
+    if (*exe_entry != NULL) {
+        *program_entry_point = (*exe_entry)->entry_point;
+    } else if (-1 == program_loader(cur_dentry.inode_index, program_entry_point)) {
+        return -1; // program loader fail
     }
-    
+    return 0;
+}
+
+/* process_create - set up a process for an executable found by process_find
+ * Inputs: args - the arguments of the command
+ *         inode_index - the inode of the executable
+ *         exe_entry - the cached image of it, NULL if there is none
+ *         parent_pcb - the process waiting for it in execute, NULL if nobody waits
+ *         vt - the terminal the process reads from and writes to
+ *         spare - 1 if the process may take the pid kept for the shell of a terminal
+ * Outputs: the pcb of the new process, NULL if no pid or kernel stack is left
+ * Side Effects: must be called with interrupts disabled, does not touch the current address space.
+ *               The reference on exe_entry belongs to the new process, or is dropped on failure
+ */
+static pcb_t* process_create(const uint8_t* args, uint32_t inode_index, exe_cache_entry_t* exe_entry,
+                             pcb_t* parent_pcb, uint32_t vt, int32_t spare)
+{
+    int32_t i;
+
+    // Set up program paging
+    int pid = get_available_pid(spare);
+    if (pid == -1) {
+        exe_cache_put(exe_entry);
+        return NULL; // no available pid
+    }
+
     // Create PCB
-    pcb_t* parent_pcb = get_current_pcb();
-    pcb_t* cur_pcb = create_pcb(pid, parent_pcb);
+    pcb_t* cur_pcb = create_pcb(pid, parent_pcb, vt);
+    if (cur_pcb == NULL) {
+        free_pid(pid);
+        exe_cache_put(exe_entry);
+        return NULL;
+    }
+    user_table_reset(pid);
+    cur_pcb->exe_inode = inode_index; // pages of the image are loaded from this inode on demand
+    cur_pcb->exe_entry = exe_entry;
+    cur_pcb->heap = process_heap_init(pid);
     /* Write arguments in pcb */
     memcpy(cur_pcb->args, args, ARG_LEN + 1);
-    vt_set_active_pid(pid); // cp5, record the active process of a vt
 
     // initialize pcb's signal structure
     for(i = 0; i < SIG_NUM; i++){
@@ -222,9 +287,85 @@ int32_t __syscall_execute(const uint8_t* command) {
         cur_pcb->signals[i].sa_masked = SIG_UNMASK;
     }
 
+    return cur_pcb;
+}
+
+/* process_queue - queue a process nobody waits for, for an executable found by process_find
+ * Inputs: args, inode_index, exe_entry, program_entry_point - what process_find filled in
+ *         vt - the terminal of the new process
+ *         foreground - 1 if the process is the shell of the terminal and reads its keyboard,
+ *                      such a process may take the pid kept for it
+ * Outputs: the pid of the new process, -1 if no pid or kernel stack is left
+ * Side Effects: must be called with interrupts disabled
+ */
+static int32_t process_queue(const uint8_t* args, uint32_t inode_index, exe_cache_entry_t* exe_entry,
+                             uint32_t program_entry_point, uint32_t vt, int32_t foreground)
+{
+    pcb_t* cur_pcb = process_create(args, inode_index, exe_entry, NULL, vt, foreground);
+    if (cur_pcb == NULL) {
+        return INVALID_CMD;
+    }
+    if (foreground) {
+        vt_set_active_pid(cur_pcb->pid);
+    }
+    sched_spawn(cur_pcb, program_entry_point);
+    return cur_pcb->pid;
+}
+
+/* process_spawn - start a process nobody waits for, it runs side by side with the caller
+ * Inputs: command - the given command to be executed
+ *         vt - the terminal of the new process
+ *         foreground - 1 if the process is the shell of the terminal and reads its keyboard
+ * Outputs: the pid of the new process, -1 if the command cannot be executed
+ * Side Effects: the process enters user space the first time the scheduler picks it
+ */
+int32_t process_spawn(const uint8_t* command, uint32_t vt, int32_t foreground) {
+    uint32_t flags, inode_index, program_entry_point;
+    uint8_t args[ARG_LEN + 1];
+    exe_cache_entry_t* exe_entry;
+    int32_t pid;
+
+    if (process_find(command, args, &inode_index, &exe_entry, &program_entry_point)) {
+        return INVALID_CMD;
+    }
+    cli_and_save(flags);
+    pid = process_queue(args, inode_index, exe_entry, program_entry_point, vt, foreground);
+    restore_flags(flags);
+    return pid;
+}
+
+/* __syscall_execute - execute the given command
+ * Inputs: command - the given command to be executed
+ * Outputs: -1 if the command cannot be executed,
+ *          256 if the program dies by an exception
+ *          0-255 if the program executes a halt system call
+ * Side Effects: None
+ */
+int32_t __syscall_execute(const uint8_t* command) {
+    pcb_t* parent_pcb = get_current_pcb();
+    uint32_t inode_index, program_entry_point;
+    uint8_t args[ARG_LEN + 1];
+    exe_cache_entry_t* exe_entry;
+
+    if (process_find(command, args, &inode_index, &exe_entry, &program_entry_point)) {
+        return INVALID_CMD;
+    }
+    cli();
+    pcb_t* cur_pcb = process_create(args, inode_index, exe_entry, parent_pcb, parent_pcb->vt, 0);
+    if (cur_pcb == NULL) {
+        sti();
+        return INVALID_CMD;
+    }
+    // the child of the process reading the keyboard takes the keyboard over
+    if (vt_check_active_pid(parent_pcb->vt) == parent_pcb->pid) {
+        vt_set_active_pid(cur_pcb->pid); // cp5, record the active process of a vt
+    }
+    sched_start(cur_pcb->pid, parent_pcb->pid);
+    set_user_PDE(cur_pcb->pid);
+
     // set TSS
     tss.ss0 = KERNEL_DS;
-    tss.esp0 = EIGHT_MB - cur_pcb->pid * EIGHT_KB;
+    tss.esp0 = KERNEL_STACK_TOP(cur_pcb);
 
     asm volatile("movl %%esp, %0;"
                  "movl %%ebp, %1;"
@@ -249,7 +390,14 @@ int32_t __syscall_execute(const uint8_t* command) {
     return 0; // This return serves no purpose other than to silence the compiler
 }
 
-
+/* __syscall_spawn - start the given command in the background of the current terminal
+ * Inputs: command - the given command to be executed
+ * Outputs: the pid of the new process, -1 if the command cannot be executed
+ * Side Effects: the caller keeps running, the shell uses this for "cmd &"
+ */
+int32_t __syscall_spawn(const uint8_t* command) {
+    return process_spawn(command, get_current_pcb()->vt, 0);
+}
 
 /* __syscall_halt - halt the current process
  * Inputs: status - the given status to be returned to parent process
@@ -259,19 +407,30 @@ int32_t __syscall_execute(const uint8_t* command) {
 int32_t __syscall_halt(uint8_t status) {
     // Restore parent data
     pcb_t* cur_pcb = get_current_pcb();
-    if (cur_pcb->pid < NUM_TERMS) {
-        // If the current process is the first shell, then restart the shell
-        cli(); // prevent other processes from stealing the pid
-        free_pid(cur_pcb->pid);
-        __syscall_execute((uint8_t*)"shell"); // this call never returns anyway
-    }
     pcb_t* parent_pcb = cur_pcb->parent_pcb;
+    uint32_t inode_index, program_entry_point;
+    uint8_t args[ARG_LEN + 1];
+    exe_cache_entry_t* exe_entry;
+    exe_cache_put(cur_pcb->exe_entry); // the image is no longer needed by this process
+    cur_pcb->exe_entry = NULL;
+    dynamic_heap_release(cur_pcb->heap); // every heap page goes back to the frame pool at once
+    cur_pcb->heap = NULL;
+
+    // Nobody waits for a spawned process. If it was the shell of its terminal, the shell is restarted,
+    // its executable is read now while interrupts are still enabled
+    int32_t respawn = (parent_pcb == NULL && vt_check_active_pid(cur_pcb->vt) == cur_pcb->pid);
+    if (respawn && process_find((uint8_t*)"shell", args, &inode_index, &exe_entry, &program_entry_point)) {
+        respawn = 0;
+        printf("Cannot restart the shell of terminal %d\n", cur_pcb->vt);
+    }
 
     cli();
-    // Restore parent paging
-    set_user_PDE(parent_pcb->pid);
-    vt_set_active_pid(parent_pcb->pid);
-
+    if (cur_pcb->vidmap) {
+        vt_vidmap_release(cur_pcb->vt);
+        if (cur_pcb->vt == foreground_vt) {
+            gui_mark_all_dirty(); // the compositor only sees what the terminal driver writes
+        }
+    }
     // Close all FDs
     int i;
     for (i = 0; i < NUM_FILES; i++) {
@@ -280,9 +439,27 @@ int32_t __syscall_halt(uint8_t status) {
         cur_pcb->fd_array[i].operation_table->close_operation(i);
     }
 
+    if (parent_pcb == NULL) {
+        // the new shell gets another pid and kernel stack since these are still in use,
+        // the pid kept for it is there even when background processes hold all the others
+        if (respawn && process_queue(args, inode_index, exe_entry, program_entry_point, cur_pcb->vt, 1) == INVALID_CMD) {
+            printf("Cannot restart the shell of terminal %d\n", cur_pcb->vt);
+        }
+        sched_exit(cur_pcb->pid, -1);
+        free_pid(cur_pcb->pid);
+        scheduler(); // this call never returns anyway
+    }
+
+    // Restore parent paging
+    set_user_PDE(parent_pcb->pid);
+    if (vt_check_active_pid(cur_pcb->vt) == cur_pcb->pid) {
+        vt_set_active_pid(parent_pcb->pid);
+    }
+    sched_exit(cur_pcb->pid, parent_pcb->pid);
+
     // Write Parent process's info back to TSS
     tss.ss0 = KERNEL_DS;
-    tss.esp0 = EIGHT_MB - parent_pcb->pid * EIGHT_KB;
+    tss.esp0 = KERNEL_STACK_TOP(parent_pcb);
 
     free_pid(cur_pcb->pid);
     sti();
@@ -310,10 +487,24 @@ int32_t __syscall_halt(uint8_t status) {
  * Outputs: None
  * Return: file descriptor if successfully
  *        -1 if open fails
- * Side Effects: This call should never return to the caller
+ * Side Effects: writes to a regular file opened this way replace the whole file from the file position on
  */
 int32_t __syscall_open(const uint8_t* filename){
+    return __syscall_open_flags(filename, O_REPLACE);
+}
+
+/* __syscall_open_flags - open the file with the given flags
+ * Inputs: filename - the name of the file to be opened
+ *         open_flags - O_APPEND, O_REPLACE or 0, only used by regular files
+ * Outputs: None
+ * Return: file descriptor if successfully
+ *        -1 if open fails
+ * Side Effects: None
+ */
+int32_t __syscall_open_flags(const uint8_t* filename, uint32_t open_flags){
     dentry_t cur_dentry;
+    int32_t fd;
+    if(open_flags & ~(O_APPEND | O_REPLACE) || open_flags == (O_APPEND | O_REPLACE)) return -1;
     // find the dentry for the file according to its name
     // if the file does not exist, open fails
     if(0 != read_dentry_by_name(filename, &cur_dentry)) return -1;
@@ -321,14 +512,30 @@ int32_t __syscall_open(const uint8_t* filename){
         return RTC_open(filename);
     else if(cur_dentry.file_type == DIR_FILE_TYPE)
         return dir_open(filename);
-    else if(cur_dentry.file_type == REGULAR_FILE_TYPE)
-        return fopen(filename);
+    else if(cur_dentry.file_type == REGULAR_FILE_TYPE){
+        if(-1 != (fd = fopen(filename)))
+            get_current_pcb()->fd_array[fd].open_flags = open_flags;
+        return fd;
+    }
     else{
         return -1;
     }
     return 0;
 }
 
+/* __syscall_getdents - read the entries of an open directory in one go
+ * Inputs: fd - the file descriptor of the directory
+ *         buf - the user buffer to fill with dirent_t records
+ *         nbytes - size of the buffer
+ * Outputs: None
+ * Return: number of bytes filled, 0 at the end of the directory, -1 if fails
+ */
+int32_t __syscall_getdents(int32_t fd, dirent_t* buf, int32_t nbytes){
+    /* the whole buffer has to be inside the user page */
+    if(buf == NULL || nbytes < 0 || (uint32_t)buf < _128_MB || (uint32_t)buf + nbytes > _128_MB + FOUR_MB) return -1;
+    return dir_getdents(fd, buf, nbytes);
+}
+
 /* __syscall_close - close the file
  * Inputs: fd - the file associated with file descriptor to be closed
  * Outputs: None
@@ -404,6 +611,11 @@ int32_t __syscall_vidmap(uint8_t** screen_start){
     if((screen_start == NULL) || (screen_start < (uint8_t**)(_128_MB)) || (screen_start >= (uint8_t**)(_128_MB + FOUR_MB))) return -1;
     
     /* build the page structure */
+    pcb_t* cur_pcb = get_current_pcb();
+    if (!cur_pcb->vidmap) {
+        cur_pcb->vidmap = 1;
+        vt_vidmap_acquire(cur_pcb->vt); // the program sees the screen at the start of the page
+    }
     set_vidmap_PDE();
 
     /* load the memory location into scree_start */
@@ -466,7 +678,7 @@ int32_t __syscall_ioctl(int32_t fd, int32_t flag) {
  *         NULL if allocate fails
  */
 void* __syscall_malloc(int32_t size){
-    int32_t* ptr = malloc(size);
+    int32_t* ptr = dynamic_heap_malloc(get_current_pcb()->heap, size);
     // printf("%d\n", (int32_t)ptr);
     // show_memory_usage();
     return ptr;
@@ -478,28 +690,46 @@ void* __syscall_malloc(int32_t size){
  * Return: 0 if free successfully, -1 otherwise
  */
 int32_t __syscall_free(void* ptr){
-    printf("%d\n", (int32_t)ptr);
-    int32_t ret = free(ptr);
-    show_memory_usage();
-    return ret;
+    return dynamic_heap_free(get_current_pcb()->heap, ptr);
 }
 
+/* __syscall_memstat - report the free space and paging statistics of the heap of the current process
+ * Inputs: stats - the user buffer to fill with the statistics
+ * Outputs: None
+ * Return: 0 if the statistics are copied successfully, -1 otherwise
+ */
+int32_t __syscall_memstat(dynamic_memory_stats_t* stats){
+    /* if given address is NULL or not fall within the address range covered by the single use-level page, memstat fails */
+    if((stats == NULL) || ((uint32_t)stats < _128_MB) || ((uint32_t)(stats + 1) > _128_MB + FOUR_MB)) return -1;
+
+    dynamic_memory_stats(get_current_pcb()->heap, stats);
+    return 0;
+}
+
+static const char* sched_state_names[] = {"UNUSED", "RUNNABLE", "SLEEPING", "BLOCKED"};
+
 int32_t __syscall_ps(void) {
     uint32_t cur_pid;
     for (cur_pid = 0; cur_pid < MAX_PID_NUM; ++cur_pid) {
         pcb_t* cur_pcb = get_pcb_by_pid(cur_pid);
-        if(check_pid_occupied(cur_pid) == 0) { // pid not in used
+        if(check_pid_occupied(cur_pid) == 0 || cur_pcb == NULL) { // pid not in used
             continue;
         } 
         printf("PID: %d ", cur_pid);
         printf("VT: %d" , cur_pcb->vt);
         if(cur_pid == vt_check_active_pid(cur_pcb->vt)) {
-            printf(" STATUS: ACTIVE\n");
+            printf(" STATUS: ACTIVE");
+        }
+        else if(cur_pcb->parent_pcb == NULL) {
+            printf(" STATUS: BACKGROUND"); // started with "cmd &"
         }
         else {
-            printf(" STATUS: NOT ACTIVE\n");
+            printf(" STATUS: NOT ACTIVE");
         }
+        printf(" STATE: %s", sched_state_names[sched_table[cur_pid].state]);
+        printf(" PRIO: %d CPU: %d ticks\n", sched_table[cur_pid].priority, sched_table[cur_pid].cpu_ticks);
     }
+    printf("Busy: %d ticks, idle: %d ticks\n", pit_busy_ticks, pit_idle_ticks);
     int32_t vt_id;
     int32_t active_pid;
     for(vt_id = 0; vt_id < NUM_TERMS; ++vt_id) {
@@ -512,6 +742,7 @@ int32_t __syscall_ps(void) {
         }
         printf("\n");
     }
+    printf("Executable cache: %d hits, %d misses\n", exe_cache_hit_num, exe_cache_miss_num);
     return 0;
 }
 
@@ -6,8 +6,9 @@
 #include "devices/rtc.h"
 #include "devices/vt.h"
 #include "date.h"
+#include "dynamic_alloc.h"
 
-#define FILE_NAME_LEN 32  // 32B to store file name in FS
+#define FILE_NAME_LEN MAX_PATH_LEN  // a file name or a path of them in FS
 #define MAX_ARG_NUM 24
 #define INVALID_CMD -1
 
@@ -17,11 +18,16 @@
 #define MAGIC_NUM_2 0x45
 #define MAGIC_NUM_3 0x4c
 #define MAGIC_NUM_4 0x46
+#define ELF_HEADER_SIZE 28  // enough bytes of the header to reach the entry point
+#define ELF_ENTRY_OFFSET 24 // 24 is the offset of the entry point in the header
 
 int32_t __syscall_execute(const uint8_t* command);
 int32_t __syscall_halt(uint8_t status);
+int32_t program_page_fault(uint32_t fault_addr);
 
 int32_t __syscall_open(const uint8_t* filename);
+int32_t __syscall_open_flags(const uint8_t* filename, uint32_t open_flags);
+int32_t __syscall_getdents(int32_t fd, dirent_t* buf, int32_t nbytes);
 int32_t __syscall_close(int32_t fd);
 int32_t __syscall_read(int32_t fd, void* buf, int32_t nbytes);
 int32_t __syscall_write(int32_t fd, const void* buf, int32_t nbytes);
@@ -33,6 +39,9 @@ int32_t __syscall_sigreturn(void);
 int32_t __syscall_ioctl(int32_t fd, int32_t flag);
 int32_t __syscall_ps(void);
 int32_t __syscall_date(void);
+int32_t __syscall_memstat(dynamic_memory_stats_t* stats);
+int32_t __syscall_spawn(const uint8_t* command);
+int32_t process_spawn(const uint8_t* command, uint32_t vt, int32_t foreground);
 int32_t __syscall_donut(void);
 
 /*
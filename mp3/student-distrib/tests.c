@@ -5,6 +5,9 @@
 #include "filesys.h"
 #include "pcb.h"
 #include "syscall_task.h"
+#include "GUI/gui.h"
+#include "bcache.h"
+#include "dcache.h"
 
 #define PASS 1
 #define FAIL 0
@@ -29,6 +32,40 @@ static inline void assertion_failure(){
 	asm volatile("int $15");
 }
 
+/* PIT channel 2 is used to calibrate the time stamp counter for benchmarks */
+#define PIT_CH2_DATA_PORT	0x42
+#define PIT_CMD_PORT		0x43
+#define PIT_CH2_GATE_PORT	0x61
+#define PIT_CH2_CALIBRATE_LATCH	11932	// 1193182 Hz / 100, which is 10 ms
+
+/* read the low 32 bits of the time stamp counter */
+static inline uint32_t rdtsc_low(){
+	uint32_t low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return low;
+}
+
+/* tsc_calibrate_mhz
+ *
+ * Count how many time stamp counter cycles pass in 10 ms of PIT channel 2
+ * Inputs: None
+ * Outputs: number of cycles per microsecond
+ * Side Effects: reprogram PIT channel 2 (the speaker channel)
+ */
+static uint32_t tsc_calibrate_mhz(){
+	uint32_t start, end;
+	/* enable the channel 2 gate and keep the speaker off */
+	outb((inb(PIT_CH2_GATE_PORT) & ~0x02) | 0x01, PIT_CH2_GATE_PORT);
+	/* channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count) */
+	outb(0xB0, PIT_CMD_PORT);
+	outb(PIT_CH2_CALIBRATE_LATCH & 0xFF, PIT_CH2_DATA_PORT);
+	outb(PIT_CH2_CALIBRATE_LATCH >> 8, PIT_CH2_DATA_PORT);
+	start = rdtsc_low();
+	while((inb(PIT_CH2_GATE_PORT) & 0x20) == 0);	// bit 5 goes high on terminal count
+	end = rdtsc_low();
+	return (end - start) / 10000;
+}
+
 
 /* Checkpoint 1 tests */
 
@@ -615,6 +652,281 @@ int syscall_edge_test(){
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+/* dentry_lookup_cost_test
+ *
+ * Compare the number of file name comparisons done by read_dentry_by_name
+ * with and without the directory name index, using the lookups a shell startup does
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: None
+ */
+int dentry_lookup_cost_test(){
+	TEST_HEADER;
+
+	const int8_t* names[7] = {"shell", "shell", "ls", "cat", "frame0.txt", "rtc", "BYDBYD"};
+	dentry_t dentry_linear, dentry_hashed;
+	uint32_t i, cmp_linear, cmp_hashed;
+	int32_t ret_linear, ret_hashed;
+	int result = PASS;
+
+	cmp_linear = 0;
+	cmp_hashed = 0;
+	for(i = 0; i < 7; i++){
+		dentry_index_enabled = 0;
+		dentry_lookup_cmp_num = 0;
+		ret_linear = read_dentry_by_name((const uint8_t*)names[i], &dentry_linear);
+		cmp_linear += dentry_lookup_cmp_num;
+
+		dentry_index_enabled = 1;
+		dentry_lookup_cmp_num = 0;
+		ret_hashed = read_dentry_by_name((const uint8_t*)names[i], &dentry_hashed);
+		cmp_hashed += dentry_lookup_cmp_num;
+
+		/* both ways must agree on the result */
+		if(ret_linear != ret_hashed) result = FAIL;
+		if(ret_linear == 0 && dentry_linear.inode_index != dentry_hashed.inode_index) result = FAIL;
+	}
+	printf("linear scan: %u name compares, name index: %u name compares\n", cmp_linear, cmp_hashed);
+	return result;
+}
+
+
+static uint8_t bench_buf[BLOCK_SIZE * 10 + 4];	// 10 blocks plus room to misalign the destination
+static uint8_t bench_ref[BLOCK_SIZE * 10];		// the same range read one block per call
+
+/* read_data_bench_test
+ *
+ * Report the read_data throughput in MB/s for several file offsets and buffer alignments,
+ * and check each result against the same range read one block per call
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: None
+ */
+int read_data_bench_test(){
+	TEST_HEADER;
+
+	const uint32_t offsets[4] = {0, 1, 2047, BLOCK_SIZE};
+	const uint32_t aligns[3] = {0, 1, 3};
+	dentry_t dentry;
+	uint32_t i, j, k, mhz, bytes, cycles, start, length, expect;
+	int32_t ret;
+
+	if(read_dentry_by_name((const uint8_t*)"fish", &dentry) == -1) return FAIL;
+	length = read_file_length(dentry.inode_index);
+	mhz = tsc_calibrate_mhz();
+	if(mhz == 0) return FAIL;
+	printf("TSC runs at %u MHz\n", mhz);
+
+	for(i = 0; i < 4; i++){
+		if(offsets[i] >= length) return FAIL;
+		expect = length - offsets[i];
+		if(expect > BLOCK_SIZE * 10) expect = BLOCK_SIZE * 10;
+		for(k = 0; k < expect; k += BLOCK_SIZE){
+			if(read_data(dentry.inode_index, offsets[i] + k, bench_ref + k, BLOCK_SIZE) <= 0) return FAIL;
+		}
+		for(j = 0; j < 3; j++){
+			bytes = 0;
+			start = rdtsc_low();
+			for(k = 0; k < 100; k++){
+				ret = read_data(dentry.inode_index, offsets[i], bench_buf + aligns[j], BLOCK_SIZE * 10);
+				if(ret != expect) return FAIL;
+				bytes += ret;
+			}
+			cycles = rdtsc_low() - start;
+			for(k = 0; k < expect; k++){
+				if(bench_buf[aligns[j] + k] != bench_ref[k]) return FAIL;
+			}
+			if(cycles < mhz) cycles = mhz;		// less than 1 us, avoid dividing by zero
+			/* bytes per microsecond is MB/s */
+			printf("offset %u align %u: %u MB/s\n", offsets[i], aligns[j], bytes / (cycles / mhz));
+		}
+	}
+	return PASS;
+}
+
+/* glyph_bench_test
+ *
+ * Report how many glyphs per second vt_draw_string puts on the terminal skin
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: builds the terminal skin, draws over the first terminal row of the BGA framebuffer
+ */
+int glyph_bench_test(){
+	TEST_HEADER;
+
+	int8_t row[VT_COL + 1];
+	uint32_t i, mhz, glyphs, cycles, start;
+
+	for(i = 0; i < VT_COL; i++) row[i] = '!' + i % 94;	// every printable character
+	row[VT_COL] = '\0';
+	mhz = tsc_calibrate_mhz();
+	if(mhz == 0) return FAIL;
+	if(gui_init() == -1) return FAIL;			// the glyphs are drawn over the skin it builds
+
+	vt_draw_string(VT_START_X + 15, VT_START_Y + 11, row, 0xFFFFFFFF);	// expand the glyphs first
+	glyphs = 0;
+	start = rdtsc_low();
+	for(i = 0; i < 100; i++){
+		vt_draw_string(VT_START_X + 15, VT_START_Y + 11, row, 0xFFFFFFFF);
+		glyphs += VT_COL;
+	}
+	cycles = rdtsc_low() - start;
+	if(cycles < mhz * 1000) cycles = mhz * 1000;		// less than 1 ms, avoid dividing by zero
+	printf("vt_draw_string: %u glyphs/sec\n", glyphs * 1000 / (cycles / mhz / 1000));
+	return PASS;
+}
+
+static uint8_t write_bench_buf[4096];
+
+/* vt_write_bench_test
+ *
+ * Report how many bytes per second vt_write puts on the screen, lines of text with newlines
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: fills the terminal with text
+ */
+int vt_write_bench_test(){
+	TEST_HEADER;
+
+	uint32_t i, mhz, bytes, cycles, start;
+
+	for(i = 0; i < sizeof(write_bench_buf); i++){
+		write_bench_buf[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;	// 63 characters per line
+	}
+	mhz = tsc_calibrate_mhz();
+	if(mhz == 0) return FAIL;
+
+	bytes = 0;
+	start = rdtsc_low();
+	for(i = 0; i < 16; i++){
+		if(vt_write(1, write_bench_buf, sizeof(write_bench_buf)) != sizeof(write_bench_buf)) return FAIL;
+		bytes += sizeof(write_bench_buf);
+	}
+	cycles = rdtsc_low() - start;
+	if(cycles < mhz * 1000) cycles = mhz * 1000;		// less than 1 ms, avoid dividing by zero
+	printf("\nvt_write: %u bytes/sec\n", bytes * 1000 / (cycles / mhz / 1000));
+	return PASS;
+}
+
+static uint8_t append_bench_buf[1024];
+
+/* append_bench_test
+ *
+ * Append 1 kB records to a growing file the way a write on an O_APPEND file descriptor does,
+ * and report the cost of the first and the last appends, which should be about the same
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: the appended records are cut off again at the end
+ */
+int append_bench_test(){
+	TEST_HEADER;
+
+	dentry_t dentry;
+	uint32_t i, mhz, old_length, start, first, last, check;
+	int result = PASS;
+
+	if(read_dentry_by_name((const uint8_t*)"created.txt", &dentry) == -1) return FAIL;
+	mhz = tsc_calibrate_mhz();
+	if(mhz == 0) return FAIL;
+	old_length = read_file_length(dentry.inode_index);
+
+	first = 0;
+	last = 0;
+	for(i = 0; i < 64; i++){
+		memset(append_bench_buf, 'a' + i % 26, sizeof(append_bench_buf));
+		start = rdtsc_low();
+		if(write_data(dentry.inode_index, read_file_length(dentry.inode_index), append_bench_buf, sizeof(append_bench_buf)) != sizeof(append_bench_buf)){
+			result = FAIL;
+			break;
+		}
+		start = rdtsc_low() - start;
+		if(i < 8) first += start;
+		if(i >= 56) last += start;
+	}
+	printf("%u records appended, first 8: %u us, last 8: %u us\n", i, first / mhz, last / mhz);
+
+	/* every record has to be where it was appended */
+	for(check = 0; check < i; check++){
+		if(read_data(dentry.inode_index, old_length + check * sizeof(append_bench_buf), append_bench_buf, 1) != 1 ||
+		   append_bench_buf[0] != 'a' + check % 26) result = FAIL;
+	}
+	truncate_data(dentry.inode_index, old_length);
+	if(read_file_length(dentry.inode_index) != old_length) result = FAIL;
+	return result;
+}
+
+/* bcache_hit_test
+ *
+ * Read a file twice and report the buffer cache hits and misses of each pass,
+ * the second pass should be served from memory
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: None
+ */
+int bcache_hit_test(){
+	TEST_HEADER;
+
+	dentry_t dentry;
+	uint32_t pass, hit, miss;
+	int32_t length;
+
+	if(read_dentry_by_name((const uint8_t*)"frame0.txt", &dentry) == -1) return FAIL;
+	if(fs_dev->mem != NULL){
+		printf("the file system is in memory, the cache is not used\n");
+		return PASS;
+	}
+	length = read_file_length(dentry.inode_index);
+	for(pass = 0; pass < 2; pass++){
+		hit = bcache_hit_num;
+		miss = bcache_miss_num;
+		if(read_data(dentry.inode_index, 0, bench_buf, length) != length) return FAIL;
+		printf("pass %u: %u hits, %u misses\n", pass, bcache_hit_num - hit, bcache_miss_num - miss);
+	}
+	return (bcache_miss_num == miss) ? PASS : FAIL;
+}
+
+/* path_walk_test
+ *
+ * Check that paths resolve like plain names in the root directory, and that a
+ * second walk into every subdirectory is answered by the dentry cache
+ * Inputs: None
+ * Outputs: PASS or FAIL
+ * Side Effects: None
+ */
+int path_walk_test(){
+	TEST_HEADER;
+
+	const int8_t* same[4] = {"/ls", "./ls", "../ls", "//./ls"};
+	const int8_t* bad[5] = {"", "/", "ls/", "ls/x", "verylargetextwithverylongname.txt/ls"};
+	int8_t path[MAX_FILE_NAME + 3];
+	dentry_t dentry, root_dentry;
+	uint32_t i, pass, hit, miss;
+	int result = PASS;
+
+	if(read_dentry_by_name((const uint8_t*)"ls", &root_dentry) == -1) return FAIL;
+	for(i = 0; i < 4; i++){
+		if(read_dentry_by_name((const uint8_t*)same[i], &dentry) == -1 || dentry.inode_index != root_dentry.inode_index) result = FAIL;
+	}
+	for(i = 0; i < 5; i++){
+		if(read_dentry_by_name((const uint8_t*)bad[i], &dentry) != -1) result = FAIL;
+	}
+
+	/* "<subdirectory>/." twice, only the first walk reads the subdirectory */
+	for(i = 0; read_dentry_by_index(i, &root_dentry) == 0; i++){
+		if(root_dentry.file_type != DIR_FILE_TYPE || root_dentry.inode_index == ROOT_DIR_INODE) continue;
+		memset(path, 0, sizeof(path));
+		memcpy(path, root_dentry.file_name, MAX_FILE_NAME);
+		strcpy(path + strlen(path), "/.");
+		for(pass = 0; pass < 2; pass++){
+			hit = dcache_hit_num;
+			miss = dcache_miss_num;
+			if(read_dentry_by_name((const uint8_t*)path, &dentry) == -1 || dentry.inode_index != root_dentry.inode_index) result = FAIL;
+			printf("%s pass %u: %u dentry cache hits, %u misses\n", path, pass, dcache_hit_num - hit, dcache_miss_num - miss);
+		}
+		if(dcache_miss_num != miss) result = FAIL;
+	}
+	return result;
+}
 
 /* Test suite entry point */
 void launch_tests(){
@@ -657,4 +969,13 @@ void launch_tests(){
 	// TEST_OUTPUT("keyboard_write_syscall_test", keyboard_write_syscall_test());
 	// TEST_OUTPUT("heavy_load_syscall_test", heavy_load_syscall_test());
 	// TEST_OUTPUT("syscall_edge_test", syscall_edge_test());
+
+	/* Checkpoint 5 Tests*/
+	// TEST_OUTPUT("dentry_lookup_cost_test", dentry_lookup_cost_test());
+	// TEST_OUTPUT("read_data_bench_test", read_data_bench_test());
+	// TEST_OUTPUT("glyph_bench_test", glyph_bench_test());
+	// TEST_OUTPUT("vt_write_bench_test", vt_write_bench_test());
+	// TEST_OUTPUT("append_bench_test", append_bench_test());
+	// TEST_OUTPUT("bcache_hit_test", bcache_hit_test());
+	// TEST_OUTPUT("path_walk_test", path_walk_test());
 }
@@ -5,6 +5,7 @@
 
 #define BUFSIZE 1024
 #define SBUFSIZE 33
+#define DIRENT_NUM 64   /* more than a directory holds, one getdents call reads it all */
 
 int32_t
 do_one_file (const char* s, const char* fname) 
@@ -67,9 +68,10 @@ do_one_file (const char* s, const char* fname)
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i, j;
+    uint8_t name[SBUFSIZE];
     uint8_t search[BUFSIZE];
+    ece391_dirent_t ents[DIRENT_NUM];
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
@@ -81,16 +83,20 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, ents, sizeof(ents)))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
-	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	for (i = 0; i < cnt / (int32_t)sizeof(ece391_dirent_t); i++) {
+	    if (2 != ents[i].type) /* only regular files hold lines */
+		continue;
+	    for (j = 0; j < SBUFSIZE - 1; j++)
+		name[j] = ents[i].name[j];
+	    name[SBUFSIZE - 1] = '\0';
+	    if (0 != do_one_file ((char*)search, (char*)name))
+		return 3;
+	}
     }
 
     return 0;
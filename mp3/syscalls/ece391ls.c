@@ -3,26 +3,67 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define SBUFSIZE 128            /* "-l" and a path */
+#define DIRENT_NUM 64           /* the whole root directory, one getdents call reads it all */
+#define LINE_MAX 56             /* type, size and a 32-byte name with room to spare */
+
+static uint8_t out[DIRENT_NUM * LINE_MAX];
+
+/* append one entry to the output, "-l" adds the type and the size in front of the name */
+static int32_t put_entry (uint8_t* line, const ece391_dirent_t* ent, int32_t long_format)
+{
+    int32_t len = 0, i, digits;
+    uint8_t num[16];
+
+    if (long_format) {
+        line[len++] = (ent->type == 2) ? '-' : (ent->type == 1) ? 'd' : 'c';
+        ece391_itoa(ent->length, num, 10);
+        digits = ece391_strlen(num);
+        for (i = digits; i < 9; i++)
+            line[len++] = ' ';
+        for (i = 0; i < digits; i++)
+            line[len++] = num[i];
+        line[len++] = ' ';
+    }
+    for (i = 0; i < 32 && ent->name[i] != '\0'; i++)
+        line[len++] = ent->name[i];
+    line[len++] = '\n';
+    return len;
+}
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i, len, long_format = 0;
+    uint8_t args[SBUFSIZE + 1];
+    uint8_t* dir = args;
+    ece391_dirent_t ents[DIRENT_NUM];
+
+    /* ls [-l] [directory] */
+    if (0 != ece391_getargs (args, SBUFSIZE))
+        args[0] = '\0';
+    args[SBUFSIZE] = '\0';
+    if (0 == ece391_strncmp (dir, (uint8_t*)"-l", 2) && (dir[2] == '\0' || dir[2] == ' ')) {
+        long_format = 1;
+        for (dir += 2; *dir == ' '; dir++);
+    }
+    if (*dir == '\0')
+        dir = (uint8_t*)".";
 
-    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+    if (-1 == (fd = ece391_open (dir))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, ents, sizeof(ents)))) {
         if (-1 == cnt) {
-	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
-	        return 3;
-	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
-	        return 3;
+            ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
+            return 3;
+        }
+        len = 0;
+        for (i = 0; i < cnt / (int32_t)sizeof(ece391_dirent_t); i++)
+            len += put_entry (out + len, &ents[i], long_format);
+        if (-1 == ece391_write (1, out, len))
+            return 3;
     }
 
     return 0;
@@ -3,6 +3,101 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
+#define STRESS_SLOTS    256
+#define STRESS_ROUNDS   20000
+#define STRESS_MAX_SIZE 2048
+
+static void* slots[STRESS_SLOTS];
+
+static uint32_t rdtsc_low (void)
+{
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return low;
+}
+
+static uint32_t next_rand (uint32_t* seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+static void put_number (const char* label, uint32_t value, const char* unit)
+{
+    uint8_t buf[16];
+
+    ece391_fdputs(1, (uint8_t*)label);
+    ece391_itoa(value, buf, 10);
+    ece391_fdputs(1, buf);
+    ece391_fdputs(1, (uint8_t*)unit);
+}
+
+/* count TSC cycles across one 2 Hz RTC period, returns cycles per second */
+static uint32_t cycles_per_second (void)
+{
+    int32_t rtc_fd, freq = 2, garbage;
+    uint32_t start;
+
+    if (-1 == (rtc_fd = ece391_open((uint8_t*)"rtc")))
+        return 0;
+    ece391_write(rtc_fd, &freq, 4);
+    ece391_read(rtc_fd, &garbage, 4);
+    start = rdtsc_low();
+    ece391_read(rtc_fd, &garbage, 4);
+    start = rdtsc_low() - start;
+    ece391_close(rtc_fd);
+    return start * freq;
+}
+
+/* randomly allocate and free blocks of 1 to STRESS_MAX_SIZE bytes, then report
+   the allocation rate and how fragmented the free memory is */
+static void stress_test (void)
+{
+    uint32_t seed = 391, i, slot, allocs = 0, failures = 0, cycles;
+    uint32_t cps;
+    ece391_memstat_t stats;
+
+    cps = cycles_per_second();
+
+    cycles = rdtsc_low();
+    for (i = 0; i < STRESS_ROUNDS; i++) {
+        slot = next_rand(&seed) % STRESS_SLOTS;
+        if (slots[slot] != 0) {
+            ece391_free(slots[slot]);
+            slots[slot] = 0;
+        } else {
+            if (0 == (slots[slot] = ece391_malloc(next_rand(&seed) % STRESS_MAX_SIZE + 1))) {
+                failures++;
+                continue;
+            }
+            *((uint8_t*)slots[slot]) = 1;
+            allocs++;
+        }
+    }
+    cycles = rdtsc_low() - cycles;
+
+    /* ask the kernel how the free space looks while the survivors are still live */
+    ece391_memstat(&stats);
+
+    for (i = 0; i < STRESS_SLOTS; i++) {
+        if (slots[i] != 0)
+            ece391_free(slots[i]);
+    }
+
+    put_number("stress: ", STRESS_ROUNDS, " operations, ");
+    put_number("", allocs, " allocations, ");
+    put_number("", failures, " failures\n");
+    if (allocs != 0 && cycles / allocs != 0 && cps != 0)
+        put_number("allocation rate: ", cps / (cycles / allocs), " allocations/sec\n");
+    put_number("free bytes: ", stats.total_free_bytes, ", ");
+    put_number("largest free block: ", stats.largest_free_block, ", ");
+    put_number("", stats.free_fragments, " fragments\n");
+    if (stats.total_free_bytes != 0)
+        put_number("fragmentation: ", 100 - stats.largest_free_block / (stats.total_free_bytes / 100 + 1), "%\n");
+    put_number("pages: ", stats.mapped_pages, " mapped, ");
+    put_number("", stats.touched_pages, " touched\n");
+}
+
 int main ()
 {
     void* ptr1;
@@ -30,5 +125,7 @@ int main ()
     ece391_free(ptr4);
     ece391_free(ptr2);
     ece391_free(ptr1);
+
+    stress_test();
     return 0;
 }
@@ -7,8 +7,9 @@
 
 int main ()
 {
-    int32_t cnt, rval;
+    int32_t cnt, rval, background;
     uint8_t buf[BUFSIZE];
+    uint8_t pid_buf[16];
     ece391_fdputs (1, (uint8_t*)"Starting 391 Shell\n");
 
     while (1) {
@@ -19,11 +20,29 @@ int main ()
 	}
 	if (cnt > 0 && '\n' == buf[cnt - 1])
 	    cnt--;
+	/* a trailing '&' starts the command in the background */
+	background = 0;
+	if (cnt > 0 && '&' == buf[cnt - 1]) {
+	    background = 1;
+	    cnt--;
+	    while (cnt > 0 && ' ' == buf[cnt - 1])
+		cnt--;
+	}
 	buf[cnt] = '\0';
 	if (0 == ece391_strcmp (buf, (uint8_t*)"exit"))
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
+	if (background) {
+	    if (-1 == (rval = ece391_spawn (buf))) {
+		ece391_fdputs (1, (uint8_t*)"no such command\n");
+	    } else {
+		ece391_fdputs (1, (uint8_t*)"[");
+		ece391_fdputs (1, ece391_itoa (rval, pid_buf, 10));
+		ece391_fdputs (1, (uint8_t*)"]\n");
+	    }
+	    continue;
+	}
 	rval = ece391_execute (buf);
 	if (-1 == rval)
 	    ece391_fdputs (1, (uint8_t*)"no such command\n");
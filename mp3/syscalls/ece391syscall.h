@@ -5,6 +5,28 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* statistics of the heap of the calling process filled by ece391_memstat */
+typedef struct ece391_memstat {
+    uint32_t total_free_bytes;
+    uint32_t largest_free_block;
+    uint32_t free_fragments;
+    uint32_t mapped_pages;
+    uint32_t touched_pages;
+} ece391_memstat_t;
+
+/* one directory entry filled by ece391_getdents */
+typedef struct ece391_dirent {
+    uint8_t name[32];       /* not '\0' terminated when the name takes all 32 bytes */
+    uint32_t type;          /* 0 rtc, 1 directory, 2 regular file */
+    uint32_t inode;
+    uint32_t length;        /* length in bytes of a regular file, 0 otherwise */
+} ece391_dirent_t;
+
+/* flags of ece391_open_flags, writes without any overwrite in place at the file position,
+   ece391_open behaves like ECE391_O_REPLACE */
+#define ECE391_O_APPEND  0x1    /* every write goes to the end of the file */
+#define ECE391_O_REPLACE 0x2    /* every write also ends the file */
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -25,6 +47,10 @@ extern void* ece391_malloc(int32_t size);
 extern int32_t ece391_free(void* ptr);
 extern int32_t ece391_ioctl(int32_t fd, int32_t flag);
 extern int32_t ece391_ps(void);
+extern int32_t ece391_memstat(ece391_memstat_t* stats);
+extern int32_t ece391_spawn(const uint8_t* command);
+extern int32_t ece391_open_flags(const uint8_t* filename, uint32_t flags);
+extern int32_t ece391_getdents(int32_t fd, ece391_dirent_t* buf, int32_t nbytes);
 
 enum signums {
 	DIV_ZERO = 0,
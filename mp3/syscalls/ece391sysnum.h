@@ -16,5 +16,9 @@
 #define SYS_IOCTL  13
 #define SYS_PS           14
 #define SYS_DATE         15
+#define SYS_MEMSTAT      16
+#define SYS_SPAWN        17
+#define SYS_OPEN_FLAGS   18
+#define SYS_GETDENTS     19
 
 #endif /* ECE391SYSNUM_H */